@@ -0,0 +1,328 @@
+/*
+ * admission_bench.c - Admission microbenchmark without a cluster
+ *
+ * Simulates many backends (10,000 by default) spread over a pool of
+ * threads. Each backend alternately admits and releases a statement for its
+ * tenant through the mock shared state and qos_adm_decide(), so the cost of
+ * admission and the contention on its lock can be measured directly and
+ * compared between data-structure strategies.
+ *
+ * Usage: admission_bench [-b backends] [-t threads] [-n operations]
+ *                        [-T tenants] [-l limit] [-m off|shadow|on]
+ *                        [-s scan|partitioned|atomic|all]
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock_shmem.h"
+
+/* Command class the bench admits (CMD_SELECT in the extension) */
+#define BENCH_CMD 1
+
+typedef struct BenchConfig
+{
+    int         backends;
+    int         threads;
+    long        operations;     /* admissions attempted, all threads together */
+    int         tenants;
+    int         limit;
+    int         mode;
+} BenchConfig;
+
+typedef struct BenchThread
+{
+    pthread_t   thread;
+    int         id;
+    const BenchConfig *config;
+    QoSMockShmem *shm;
+    bool       *held;           /* Per backend, owned by the thread running it */
+    long        admitted;
+    long        shadow_admitted;
+    long        rejected;
+    long        released;
+    double      start;
+    double      end;
+} BenchThread;
+
+static pthread_barrier_t start_barrier;
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Thread t runs backends t, t + threads, ... Each step of a backend either
+ * releases its statement or tries to admit one, so about half of the
+ * backends want a slot at any time.
+ */
+static void *
+bench_thread_main(void *arg)
+{
+    BenchThread *bt = arg;
+    const BenchConfig *config = bt->config;
+    long attempts = config->operations / config->threads;
+    int backend = bt->id;
+
+    pthread_barrier_wait(&start_barrier);
+    bt->start = now_seconds();
+
+    while (attempts > 0)
+    {
+        int tenant = backend % config->tenants;
+
+        if (bt->held[backend])
+        {
+            qos_mock_release(bt->shm, backend, tenant);
+            bt->held[backend] = false;
+            bt->released++;
+        }
+        else
+        {
+            switch (qos_mock_admit(bt->shm, backend, tenant, BENCH_CMD,
+                                   config->limit, config->mode))
+            {
+                case QOS_ADM_ADMIT:
+                    bt->admitted++;
+                    bt->held[backend] = true;
+                    break;
+                case QOS_ADM_SHADOW_ADMIT:
+                    bt->shadow_admitted++;
+                    bt->held[backend] = true;
+                    break;
+                case QOS_ADM_REJECT:
+                    bt->rejected++;
+                    break;
+            }
+            attempts--;
+        }
+
+        backend += config->threads;
+        if (backend >= config->backends)
+            backend = bt->id;
+    }
+
+    bt->end = now_seconds();
+    return NULL;
+}
+
+/*
+ * Slots must match the backends that hold one, and with enforcement on no
+ * tenant may hold more than its limit. Releases everything afterwards and
+ * checks that the counts drop back to zero.
+ */
+static bool
+check_invariants(const BenchConfig *config, QoSMockShmem *shm, bool *held)
+{
+    int *holders = calloc(config->tenants, sizeof(int));
+    bool ok = true;
+    int b, t;
+
+    for (b = 0; b < config->backends; b++)
+    {
+        if (held[b])
+            holders[b % config->tenants]++;
+    }
+
+    for (t = 0; t < config->tenants; t++)
+    {
+        int active = qos_mock_active(shm, t, BENCH_CMD);
+
+        if (active != holders[t])
+        {
+            fprintf(stderr, "tenant %d: %d slots in use, %d backends hold one\n",
+                    t, active, holders[t]);
+            ok = false;
+        }
+        if (config->mode == QOS_ADM_MODE_ON && config->limit > 0 && holders[t] > config->limit)
+        {
+            fprintf(stderr, "tenant %d: %d backends admitted, limit %d\n",
+                    t, holders[t], config->limit);
+            ok = false;
+        }
+    }
+
+    for (b = 0; b < config->backends; b++)
+    {
+        if (held[b])
+        {
+            qos_mock_release(shm, b, b % config->tenants);
+            held[b] = false;
+        }
+    }
+
+    for (t = 0; t < config->tenants; t++)
+    {
+        if (qos_mock_active(shm, t, BENCH_CMD) != 0)
+        {
+            fprintf(stderr, "tenant %d: slots left after releasing all\n", t);
+            ok = false;
+        }
+    }
+
+    free(holders);
+    return ok;
+}
+
+static bool
+run_strategy(const BenchConfig *config, QoSMockStrategy strategy)
+{
+    QoSMockShmem *shm = qos_mock_create(strategy, config->backends, config->tenants);
+    BenchThread *threads = calloc(config->threads, sizeof(BenchThread));
+    bool *held = calloc(config->backends, sizeof(bool));
+    long admitted = 0, shadow_admitted = 0, rejected = 0, released = 0, total;
+    double start = 0, end = 0, elapsed;
+    bool ok;
+    int i;
+
+    pthread_barrier_init(&start_barrier, NULL, config->threads + 1);
+
+    for (i = 0; i < config->threads; i++)
+    {
+        threads[i].id = i;
+        threads[i].config = config;
+        threads[i].shm = shm;
+        threads[i].held = held;
+        pthread_create(&threads[i].thread, NULL, bench_thread_main, &threads[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    /* Wall time from the first thread starting to the last one finishing */
+    for (i = 0; i < config->threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        if (i == 0 || threads[i].start < start)
+            start = threads[i].start;
+        if (threads[i].end > end)
+            end = threads[i].end;
+        admitted += threads[i].admitted;
+        shadow_admitted += threads[i].shadow_admitted;
+        rejected += threads[i].rejected;
+        released += threads[i].released;
+    }
+
+    elapsed = end - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    ok = check_invariants(config, shm, held);
+
+    /* Releases count as operations too */
+    total = admitted + shadow_admitted + rejected + released;
+    printf("%-12s %10ld %12.0f %10.1f %10ld %10ld %10ld  %s\n",
+           qos_mock_strategy_name(strategy), total,
+           total / elapsed, elapsed * 1e9 / total,
+           admitted, shadow_admitted, rejected, ok ? "ok" : "FAILED");
+
+    qos_mock_destroy(shm);
+    free(threads);
+    free(held);
+
+    return ok;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [-b backends] [-t threads] [-n operations] [-T tenants]\n"
+            "       [-l limit] [-m off|shadow|on] [-s scan|partitioned|atomic|all]\n",
+            progname);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    BenchConfig config = {
+        .backends = 10000,
+        .threads = 8,
+        .operations = 200000,
+        .tenants = 100,
+        .limit = 20,
+        .mode = QOS_ADM_MODE_ON
+    };
+    int first = 0, last = QOS_MOCK_STRATEGY_COUNT - 1;
+    bool ok = true;
+    int opt, s;
+
+    while ((opt = getopt(argc, argv, "b:t:n:T:l:m:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                config.backends = atoi(optarg);
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'n':
+                config.operations = atol(optarg);
+                break;
+            case 'T':
+                config.tenants = atoi(optarg);
+                break;
+            case 'l':
+                config.limit = atoi(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "off") == 0)
+                    config.mode = QOS_ADM_MODE_OFF;
+                else if (strcmp(optarg, "shadow") == 0)
+                    config.mode = QOS_ADM_MODE_SHADOW;
+                else if (strcmp(optarg, "on") == 0)
+                    config.mode = QOS_ADM_MODE_ON;
+                else
+                    usage(argv[0]);
+                break;
+            case 's':
+                if (strcmp(optarg, "all") == 0)
+                    break;
+                for (s = 0; s < QOS_MOCK_STRATEGY_COUNT; s++)
+                {
+                    if (strcmp(optarg, qos_mock_strategy_name(s)) == 0)
+                        break;
+                }
+                if (s == QOS_MOCK_STRATEGY_COUNT)
+                    usage(argv[0]);
+                first = last = s;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (config.backends <= 0 || config.threads <= 0 || config.tenants <= 0 ||
+        config.operations <= 0 || config.threads > config.backends)
+        usage(argv[0]);
+
+    printf("backends=%d threads=%d operations=%ld tenants=%d limit=%d mode=%d\n",
+           config.backends, config.threads, config.operations,
+           config.tenants, config.limit, config.mode);
+    printf("%-12s %10s %12s %10s %10s %10s %10s\n",
+           "strategy", "ops", "ops/s", "ns/op", "admitted", "shadow", "rejected");
+
+    for (s = first; s <= last; s++)
+        ok = run_strategy(&config, s) && ok;
+
+    return ok ? 0 : 1;
+}
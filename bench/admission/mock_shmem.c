@@ -0,0 +1,224 @@
+/*
+ * mock_shmem.c - In-process stand-in for the qos shared state
+ *
+ * QOS_MOCK_SCAN follows qos_track_statement_start/end: take the lock
+ * exclusively, count the other backends of the same tenant and command,
+ * decide, register. The other strategies keep a count per tenant instead
+ * of scanning, which is what a change to the shared layout would do.
+ * Decisions always go through qos_adm_decide().
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mock_shmem.h"
+
+/* Tenant t is role t + 1 in database 1 */
+#define MOCK_DATABASE 1
+#define MOCK_ROLE(tenant) ((uint32_t) (tenant) + 1)
+
+static const char *const strategy_names[QOS_MOCK_STRATEGY_COUNT] = {
+    "scan",
+    "partitioned",
+    "atomic"
+};
+
+static void *
+mock_alloc(size_t size)
+{
+    void *ptr = calloc(1, size);
+
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "mock_shmem: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+const char *
+qos_mock_strategy_name(QoSMockStrategy strategy)
+{
+    return strategy_names[strategy];
+}
+
+QoSMockShmem *
+qos_mock_create(QoSMockStrategy strategy, int max_backends, int num_tenants)
+{
+    QoSMockShmem *shm = mock_alloc(sizeof(QoSMockShmem));
+    int i;
+
+    shm->strategy = strategy;
+    shm->max_backends = max_backends;
+    shm->num_tenants = num_tenants;
+
+    pthread_mutex_init(&shm->lock, NULL);
+    shm->slots = mock_alloc(sizeof(QoSMockSlot) * max_backends);
+    for (i = 0; i < max_backends; i++)
+    {
+        /* Every simulated backend is connected and owns its slot */
+        shm->slots[i].pid = i + 1;
+        shm->slots[i].cmd = -1;
+    }
+
+    for (i = 0; i < QOS_MOCK_PARTITIONS; i++)
+        pthread_mutex_init(&shm->partition_locks[i], NULL);
+    shm->partition_active = mock_alloc(sizeof(int) * num_tenants);
+
+    shm->atomic_active = mock_alloc(sizeof(atomic_int) * num_tenants);
+    for (i = 0; i < num_tenants; i++)
+        atomic_init(&shm->atomic_active[i], 0);
+
+    return shm;
+}
+
+void
+qos_mock_destroy(QoSMockShmem *shm)
+{
+    int i;
+
+    pthread_mutex_destroy(&shm->lock);
+    for (i = 0; i < QOS_MOCK_PARTITIONS; i++)
+        pthread_mutex_destroy(&shm->partition_locks[i]);
+    free(shm->slots);
+    free(shm->partition_active);
+    free(shm->atomic_active);
+    free(shm);
+}
+
+static QoSAdmDecision
+mock_admit_scan(QoSMockShmem *shm, int backend, int tenant, int cmd, int limit, int mode)
+{
+    QoSMockSlot *me = &shm->slots[backend];
+    uint32_t role = MOCK_ROLE(tenant);
+    QoSAdmDecision decision;
+    int count = 0;
+    int i;
+
+    pthread_mutex_lock(&shm->lock);
+
+    for (i = 0; i < shm->max_backends; i++)
+    {
+        const QoSMockSlot *slot = &shm->slots[i];
+
+        if (slot->pid == 0 || i == backend)
+            continue;
+        if (slot->role == role && slot->database == MOCK_DATABASE && slot->cmd == cmd)
+            count++;
+    }
+
+    decision = qos_adm_decide(count, limit, mode);
+    if (decision != QOS_ADM_REJECT)
+    {
+        me->role = role;
+        me->database = MOCK_DATABASE;
+        me->cmd = cmd;
+    }
+
+    pthread_mutex_unlock(&shm->lock);
+
+    return decision;
+}
+
+static QoSAdmDecision
+mock_admit_partitioned(QoSMockShmem *shm, int tenant, int limit, int mode)
+{
+    pthread_mutex_t *lock = &shm->partition_locks[tenant % QOS_MOCK_PARTITIONS];
+    QoSAdmDecision decision;
+
+    pthread_mutex_lock(lock);
+    decision = qos_adm_decide(shm->partition_active[tenant], limit, mode);
+    if (decision != QOS_ADM_REJECT)
+        shm->partition_active[tenant]++;
+    pthread_mutex_unlock(lock);
+
+    return decision;
+}
+
+static QoSAdmDecision
+mock_admit_atomic(QoSMockShmem *shm, int tenant, int limit, int mode)
+{
+    int active = atomic_fetch_add(&shm->atomic_active[tenant], 1);
+    QoSAdmDecision decision = qos_adm_decide(active, limit, mode);
+
+    if (decision == QOS_ADM_REJECT)
+        atomic_fetch_sub(&shm->atomic_active[tenant], 1);
+
+    return decision;
+}
+
+/*
+ * Admission of one statement; the mock counts every command class together
+ * except under QOS_MOCK_SCAN, which checks cmd like the extension does
+ */
+QoSAdmDecision
+qos_mock_admit(QoSMockShmem *shm, int backend, int tenant, int cmd, int limit, int mode)
+{
+    switch (shm->strategy)
+    {
+        case QOS_MOCK_SCAN:
+            return mock_admit_scan(shm, backend, tenant, cmd, limit, mode);
+        case QOS_MOCK_PARTITIONED:
+            return mock_admit_partitioned(shm, tenant, limit, mode);
+        case QOS_MOCK_ATOMIC:
+            return mock_admit_atomic(shm, tenant, limit, mode);
+        default:
+            return QOS_ADM_ADMIT;
+    }
+}
+
+void
+qos_mock_release(QoSMockShmem *shm, int backend, int tenant)
+{
+    switch (shm->strategy)
+    {
+        case QOS_MOCK_SCAN:
+            pthread_mutex_lock(&shm->lock);
+            shm->slots[backend].cmd = -1;
+            pthread_mutex_unlock(&shm->lock);
+            break;
+        case QOS_MOCK_PARTITIONED:
+            pthread_mutex_lock(&shm->partition_locks[tenant % QOS_MOCK_PARTITIONS]);
+            shm->partition_active[tenant]--;
+            pthread_mutex_unlock(&shm->partition_locks[tenant % QOS_MOCK_PARTITIONS]);
+            break;
+        case QOS_MOCK_ATOMIC:
+            atomic_fetch_sub(&shm->atomic_active[tenant], 1);
+            break;
+        default:
+            break;
+    }
+}
+
+int
+qos_mock_active(QoSMockShmem *shm, int tenant, int cmd)
+{
+    int count = 0;
+    int i;
+
+    switch (shm->strategy)
+    {
+        case QOS_MOCK_SCAN:
+            for (i = 0; i < shm->max_backends; i++)
+            {
+                if (shm->slots[i].role == MOCK_ROLE(tenant) && shm->slots[i].cmd == cmd)
+                    count++;
+            }
+            return count;
+        case QOS_MOCK_PARTITIONED:
+            return shm->partition_active[tenant];
+        case QOS_MOCK_ATOMIC:
+            return atomic_load(&shm->atomic_active[tenant]);
+        default:
+            return 0;
+    }
+}
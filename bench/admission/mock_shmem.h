@@ -0,0 +1,80 @@
+/*
+ * mock_shmem.h - In-process stand-in for the qos shared state
+ *
+ * This header declares a mock of the shared memory that admission works
+ * on: a backend slot array guarded by one lock, as in QoSSharedState, plus
+ * alternative layouts (partitioned locks, per-tenant atomic counters) so
+ * data-structure changes can be compared with the same workload. Threads
+ * play the role of backends.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_MOCK_SHMEM_H
+#define QOS_MOCK_SHMEM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "admission.h"
+
+#define QOS_MOCK_PARTITIONS 16
+
+/* How admission keeps count of the slots in use */
+typedef enum QoSMockStrategy
+{
+    QOS_MOCK_SCAN = 0,          /* One lock, scan every backend slot (the extension today) */
+    QOS_MOCK_PARTITIONED,       /* Per-tenant counters under QOS_MOCK_PARTITIONS locks */
+    QOS_MOCK_ATOMIC,            /* Per-tenant atomic counter, undone when over the limit */
+    QOS_MOCK_STRATEGY_COUNT
+} QoSMockStrategy;
+
+/* The QoSBackendStatus fields admission reads and writes */
+typedef struct QoSMockSlot
+{
+    int32_t     pid;            /* 0 if slot unused */
+    uint32_t    role;
+    uint32_t    database;
+    int         cmd;            /* Command class, -1 if none */
+} QoSMockSlot;
+
+typedef struct QoSMockShmem
+{
+    QoSMockStrategy strategy;
+    int         max_backends;
+    int         num_tenants;
+
+    /* QOS_MOCK_SCAN: qos_shared_state->lock and backend_status[] */
+    pthread_mutex_t lock;
+    QoSMockSlot *slots;
+
+    /* QOS_MOCK_PARTITIONED: tenant t is guarded by partition t % QOS_MOCK_PARTITIONS */
+    pthread_mutex_t partition_locks[QOS_MOCK_PARTITIONS];
+    int        *partition_active;
+
+    /* QOS_MOCK_ATOMIC */
+    atomic_int *atomic_active;
+} QoSMockShmem;
+
+extern const char *qos_mock_strategy_name(QoSMockStrategy strategy);
+extern QoSMockShmem *qos_mock_create(QoSMockStrategy strategy, int max_backends, int num_tenants);
+extern void qos_mock_destroy(QoSMockShmem *shm);
+
+/* Admission for one statement of backend (0-based) on behalf of tenant */
+extern QoSAdmDecision qos_mock_admit(QoSMockShmem *shm, int backend, int tenant, int cmd,
+                                     int limit, int mode);
+extern void qos_mock_release(QoSMockShmem *shm, int backend, int tenant);
+
+/* Slots currently held by tenant (for checks after a run) */
+extern int qos_mock_active(QoSMockShmem *shm, int tenant, int cmd);
+
+#endif /* QOS_MOCK_SHMEM_H */
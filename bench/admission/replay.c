@@ -0,0 +1,741 @@
+/*
+ * replay.c - Offline statement trace replay for limit tuning
+ *
+ * Reads a statement trace and replays it in simulated time through the
+ * admission engine (qos_adm_merge_limit, qos_adm_merge_mode and
+ * qos_adm_decide) once per candidate configuration, reporting per-tenant
+ * admissions, rejections, rejected execution time and throughput
+ * (admitted statements per second of trace). Statements keep their recorded
+ * start time and duration; a rejected statement is dropped, as the
+ * extension rejects instead of queueing.
+ *
+ * Trace formats (-f):
+ *   trace   start_ms,duration_ms,role,database,command per line
+ *   csvlog  PostgreSQL csvlog with log_min_duration_statement = 0 (or
+ *           log_duration = on); the start is log_time minus the duration
+ *
+ * Configuration file, one setting per line, "#" starts a comment:
+ *   <config> role=<r>|database=<d>|role=<r>,database=<d> <setting> <value>
+ * with setting max_concurrent_select/insert/update/delete or
+ * enforcement_mode (off, shadow, on). A configuration "none" without any
+ * limit is always replayed first as the baseline.
+ *
+ * Usage: replay [-f trace|csvlog] [-v] -c configs.conf trace-file
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "admission.h"
+
+#define NUM_CMDS 4
+
+static const char *const cmd_names[NUM_CMDS] = {"select", "insert", "update", "delete"};
+
+/* One statement of the trace */
+typedef struct ReplayStatement
+{
+    double      start;          /* Seconds */
+    double      end;
+    int         tenant;
+    int         cmd;
+} ReplayStatement;
+
+/* A role/database pair, as QoSTenantEntry */
+typedef struct ReplayTenant
+{
+    char       *role;
+    char       *database;
+} ReplayTenant;
+
+/* One line of the configuration file */
+typedef struct ReplaySetting
+{
+    char       *role;           /* NULL = any */
+    char       *database;       /* NULL = any */
+    int         cmd;            /* -1 = enforcement_mode */
+    int64_t     value;
+} ReplaySetting;
+
+typedef struct ReplayConfig
+{
+    char       *name;
+    ReplaySetting *settings;
+    int         num_settings;
+} ReplayConfig;
+
+/* Per-tenant result of one replay */
+typedef struct ReplayResult
+{
+    long        statements;
+    long        admitted;
+    long        shadow_admitted;
+    long        rejected;
+    double      rejected_seconds;   /* Execution time of rejected statements */
+    int         peak_active;
+} ReplayResult;
+
+/* Admitted statement still running: end time and where it is counted */
+typedef struct ReplayRunning
+{
+    double      end;
+    int         tenant;
+    int         cmd;
+} ReplayRunning;
+
+static ReplayStatement *statements;
+static long num_statements;
+static ReplayTenant *tenants;
+static int num_tenants;
+static ReplayConfig *configs;
+static int num_configs;
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "replay: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static char *
+xstrdup(const char *s)
+{
+    return strcpy(xrealloc(NULL, strlen(s) + 1), s);
+}
+
+static int
+cmd_index(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_CMDS; i++)
+    {
+        if (strncasecmp(name, cmd_names[i], strlen(cmd_names[i])) == 0 &&
+            !isalnum((unsigned char) name[strlen(cmd_names[i])]))
+            return i;
+    }
+    return -1;
+}
+
+static int
+tenant_index(const char *role, const char *database)
+{
+    int i;
+
+    for (i = 0; i < num_tenants; i++)
+    {
+        if (strcmp(tenants[i].role, role) == 0 && strcmp(tenants[i].database, database) == 0)
+            return i;
+    }
+
+    tenants = xrealloc(tenants, sizeof(ReplayTenant) * (num_tenants + 1));
+    tenants[num_tenants].role = xstrdup(role);
+    tenants[num_tenants].database = xstrdup(database);
+    return num_tenants++;
+}
+
+static void
+add_statement(double start, double duration, const char *role, const char *database,
+              const char *command)
+{
+    static long capacity = 0;
+    int cmd = cmd_index(command);
+
+    /* Only the statement classes with a concurrency limit are replayed */
+    if (cmd < 0 || duration < 0)
+        return;
+
+    if (num_statements == capacity)
+    {
+        capacity = capacity ? capacity * 2 : 4096;
+        statements = xrealloc(statements, sizeof(ReplayStatement) * capacity);
+    }
+
+    statements[num_statements].start = start;
+    statements[num_statements].end = start + duration;
+    statements[num_statements].tenant = tenant_index(role, database);
+    statements[num_statements].cmd = cmd;
+    num_statements++;
+}
+
+/*
+ * Read one CSV record into fields (quoted fields may contain commas, doubled
+ * quotes and newlines, as in csvlog). Returns the number of fields, or -1
+ * at end of file. The fields point into a buffer reused by the next call.
+ */
+static int
+read_csv_record(FILE *fp, char ***fields_out)
+{
+    static char *buf = NULL;
+    static size_t buf_size = 0;
+    static char **fields = NULL;
+    static int fields_size = 0;
+    size_t len = 0;
+    int nfields = 0;
+    bool in_quotes = false;
+    bool field_start = true;
+    int c;
+    int i;
+
+    c = getc(fp);
+    if (c == EOF)
+        return -1;
+
+    /* Collect the record, with '\0' between fields */
+    for (; c != EOF; c = getc(fp))
+    {
+        if (len + 2 >= buf_size)
+        {
+            buf_size = buf_size ? buf_size * 2 : 1024;
+            buf = xrealloc(buf, buf_size);
+        }
+
+        if (in_quotes)
+        {
+            if (c == '"')
+            {
+                int next = getc(fp);
+
+                if (next == '"')
+                    buf[len++] = '"';
+                else
+                {
+                    in_quotes = false;
+                    ungetc(next, fp);
+                }
+            }
+            else
+                buf[len++] = c;
+            continue;
+        }
+
+        if (c == '"' && field_start)
+        {
+            in_quotes = true;
+            field_start = false;
+        }
+        else if (c == ',')
+        {
+            buf[len++] = '\0';
+            nfields++;
+            field_start = true;
+        }
+        else if (c == '\n')
+            break;
+        else if (c != '\r')
+        {
+            buf[len++] = c;
+            field_start = false;
+        }
+    }
+    buf[len++] = '\0';
+    nfields++;
+
+    if (nfields > fields_size)
+    {
+        fields_size = nfields;
+        fields = xrealloc(fields, sizeof(char *) * fields_size);
+    }
+    fields[0] = buf;
+    for (i = 1; i < nfields; i++)
+        fields[i] = fields[i - 1] + strlen(fields[i - 1]) + 1;
+
+    *fields_out = fields;
+    return nfields;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static long
+days_from_civil(int y, int m, int d)
+{
+    long era;
+    int yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/* "2026-10-17 12:34:56.789 UTC" to seconds; the time zone is ignored */
+static bool
+parse_log_time(const char *text, double *seconds)
+{
+    int year, month, day, hour, minute;
+    double second;
+
+    if (sscanf(text, "%d-%d-%d %d:%d:%lf", &year, &month, &day, &hour, &minute, &second) != 6)
+        return false;
+
+    *seconds = days_from_civil(year, month, day) * 86400.0 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+/*
+ * csvlog columns used: log_time (0), user_name (1), database_name (2),
+ * command_tag (7) and message (13), e.g.
+ * "duration: 1.234 ms  statement: SELECT ..."
+ */
+static void
+load_csvlog(FILE *fp)
+{
+    char **fields;
+    int nfields;
+
+    while ((nfields = read_csv_record(fp, &fields)) >= 0)
+    {
+        const char *command;
+        const char *text;
+        double end, duration_ms;
+
+        if (nfields < 14 || strncmp(fields[13], "duration: ", 10) != 0)
+            continue;
+        if (!parse_log_time(fields[0], &end) ||
+            sscanf(fields[13] + 10, "%lf ms", &duration_ms) != 1)
+            continue;
+
+        /* Without a command tag, take the first word of the statement text */
+        command = fields[7];
+        if (cmd_index(command) < 0 && (text = strstr(fields[13], ": ")) != NULL &&
+            (text = strstr(text + 2, ": ")) != NULL)
+        {
+            command = text + 2;
+            while (isspace((unsigned char) *command))
+                command++;
+        }
+
+        add_statement(end - duration_ms / 1000.0, duration_ms / 1000.0,
+                      fields[1], fields[2], command);
+    }
+}
+
+static void
+load_trace(FILE *fp)
+{
+    char **fields;
+    int nfields;
+
+    while ((nfields = read_csv_record(fp, &fields)) >= 0)
+    {
+        char *endp;
+        double start_ms, duration_ms;
+
+        if (nfields < 5 || fields[0][0] == '#')
+            continue;
+
+        /* Skips a header line too */
+        start_ms = strtod(fields[0], &endp);
+        if (endp == fields[0])
+            continue;
+        duration_ms = strtod(fields[1], &endp);
+        if (endp == fields[1])
+            continue;
+
+        add_statement(start_ms / 1000.0, duration_ms / 1000.0, fields[2], fields[3], fields[4]);
+    }
+}
+
+static int
+compare_statements(const void *a, const void *b)
+{
+    const ReplayStatement *sa = a;
+    const ReplayStatement *sb = b;
+
+    if (sa->start != sb->start)
+        return (sa->start < sb->start) ? -1 : 1;
+    return (sa->end < sb->end) ? -1 : (sa->end > sb->end);
+}
+
+static ReplayConfig *
+config_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < num_configs; i++)
+    {
+        if (strcmp(configs[i].name, name) == 0)
+            return &configs[i];
+    }
+
+    configs = xrealloc(configs, sizeof(ReplayConfig) * (num_configs + 1));
+    memset(&configs[num_configs], 0, sizeof(ReplayConfig));
+    configs[num_configs].name = xstrdup(name);
+    return &configs[num_configs++];
+}
+
+static void
+config_error(const char *path, int lineno, const char *msg)
+{
+    fprintf(stderr, "replay: %s:%d: %s\n", path, lineno, msg);
+    exit(1);
+}
+
+static void
+load_configs(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[1024];
+    int lineno = 0;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "replay: could not open \"%s\": %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    /* The baseline */
+    config_by_name("none");
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char name[256], scope[512], setting[256], value[256];
+        ReplaySetting s = {NULL, NULL, -1, -1};
+        ReplayConfig *config;
+        char *hash = strchr(line, '#');
+        char *item;
+
+        lineno++;
+        if (hash)
+            *hash = '\0';
+        if (sscanf(line, "%255s", name) != 1)
+            continue;
+        if (sscanf(line, "%255s %511s %255s %255s", name, scope, setting, value) != 4)
+            config_error(path, lineno, "expected: config scope setting value");
+
+        for (item = strtok(scope, ","); item != NULL; item = strtok(NULL, ","))
+        {
+            if (strncmp(item, "role=", 5) == 0)
+                s.role = xstrdup(item + 5);
+            else if (strncmp(item, "database=", 9) == 0)
+                s.database = xstrdup(item + 9);
+            else
+                config_error(path, lineno, "scope must be role=..., database=... or both");
+        }
+
+        if (strcmp(setting, "enforcement_mode") == 0)
+        {
+            if (strcmp(value, "off") == 0)
+                s.value = QOS_ADM_MODE_OFF;
+            else if (strcmp(value, "shadow") == 0)
+                s.value = QOS_ADM_MODE_SHADOW;
+            else if (strcmp(value, "on") == 0)
+                s.value = QOS_ADM_MODE_ON;
+            else
+                config_error(path, lineno, "enforcement_mode must be off, shadow or on");
+        }
+        else if (strncmp(setting, "max_concurrent_", 15) == 0 &&
+                 (s.cmd = cmd_index(setting + 15)) >= 0)
+        {
+            char *endp;
+
+            s.value = strtoll(value, &endp, 10);
+            if (*endp != '\0' || s.value < 0)
+                config_error(path, lineno, "limit must be a non-negative integer");
+        }
+        else
+            config_error(path, lineno, "unknown setting");
+
+        config = config_by_name(name);
+        config->settings = xrealloc(config->settings,
+                                    sizeof(ReplaySetting) * (config->num_settings + 1));
+        config->settings[config->num_settings++] = s;
+    }
+
+    fclose(fp);
+}
+
+/*
+ * Effective limits and mode of a tenant, merged over the three scopes the
+ * way qos_refresh_cached_limits() does
+ */
+static void
+tenant_limits(const ReplayConfig *config, const ReplayTenant *tenant,
+              int *limits, int *mode)
+{
+    int64_t scoped[3][NUM_CMDS];
+    int scoped_mode[3] = {-1, -1, -1};
+    int i, c;
+
+    for (i = 0; i < 3; i++)
+        for (c = 0; c < NUM_CMDS; c++)
+            scoped[i][c] = -1;
+
+    for (i = 0; i < config->num_settings; i++)
+    {
+        const ReplaySetting *s = &config->settings[i];
+        int scope;
+
+        if ((s->role && strcmp(s->role, tenant->role) != 0) ||
+            (s->database && strcmp(s->database, tenant->database) != 0))
+            continue;
+
+        /* 0 = role, 1 = database, 2 = role in database */
+        scope = (s->role && s->database) ? 2 : (s->database ? 1 : 0);
+        if (s->cmd < 0)
+            scoped_mode[scope] = (int) s->value;
+        else
+            scoped[scope][s->cmd] = s->value;
+    }
+
+    *mode = qos_adm_merge_mode(scoped_mode[0], scoped_mode[1], scoped_mode[2]);
+    for (c = 0; c < NUM_CMDS; c++)
+        limits[c] = (int) qos_adm_merge_limit(scoped[0][c], scoped[1][c], scoped[2][c]);
+}
+
+static void
+heap_push(ReplayRunning *heap, long *size, ReplayRunning item)
+{
+    long i = (*size)++;
+
+    while (i > 0 && heap[(i - 1) / 2].end > item.end)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = item;
+}
+
+static ReplayRunning
+heap_pop(ReplayRunning *heap, long *size)
+{
+    ReplayRunning top = heap[0];
+    ReplayRunning last = heap[--(*size)];
+    long i = 0;
+
+    for (;;)
+    {
+        long child = 2 * i + 1;
+
+        if (child >= *size)
+            break;
+        if (child + 1 < *size && heap[child + 1].end < heap[child].end)
+            child++;
+        if (last.end <= heap[child].end)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*size > 0)
+        heap[i] = last;
+
+    return top;
+}
+
+/*
+ * Replay the trace under one configuration. Statements finishing at the
+ * same instant another starts are released first.
+ */
+static void
+replay_config(const ReplayConfig *config, ReplayResult *results)
+{
+    int *limits = xrealloc(NULL, sizeof(int) * num_tenants * NUM_CMDS);
+    int *modes = xrealloc(NULL, sizeof(int) * num_tenants);
+    int *active = xrealloc(NULL, sizeof(int) * num_tenants * NUM_CMDS);
+    ReplayRunning *running = xrealloc(NULL, sizeof(ReplayRunning) * (num_statements + 1));
+    long num_running = 0;
+    long i;
+    int t;
+
+    memset(results, 0, sizeof(ReplayResult) * num_tenants);
+    memset(active, 0, sizeof(int) * num_tenants * NUM_CMDS);
+    for (t = 0; t < num_tenants; t++)
+        tenant_limits(config, &tenants[t], &limits[t * NUM_CMDS], &modes[t]);
+
+    for (i = 0; i < num_statements; i++)
+    {
+        const ReplayStatement *stmt = &statements[i];
+        ReplayResult *result = &results[stmt->tenant];
+        int slot = stmt->tenant * NUM_CMDS + stmt->cmd;
+        int tenant_active = 0;
+        int c;
+
+        while (num_running > 0 && running[0].end <= stmt->start)
+        {
+            ReplayRunning done = heap_pop(running, &num_running);
+
+            active[done.tenant * NUM_CMDS + done.cmd]--;
+        }
+
+        result->statements++;
+        switch (qos_adm_decide(active[slot], limits[slot], modes[stmt->tenant]))
+        {
+            case QOS_ADM_REJECT:
+                result->rejected++;
+                result->rejected_seconds += stmt->end - stmt->start;
+                continue;
+            case QOS_ADM_SHADOW_ADMIT:
+                result->shadow_admitted++;
+                break;
+            case QOS_ADM_ADMIT:
+                result->admitted++;
+                break;
+        }
+
+        active[slot]++;
+        heap_push(running, &num_running,
+                  (ReplayRunning) {stmt->end, stmt->tenant, stmt->cmd});
+
+        for (c = 0; c < NUM_CMDS; c++)
+            tenant_active += active[stmt->tenant * NUM_CMDS + c];
+        if (tenant_active > result->peak_active)
+            result->peak_active = tenant_active;
+    }
+
+    free(limits);
+    free(modes);
+    free(active);
+    free(running);
+}
+
+static void
+print_results(const ReplayConfig *config, const ReplayResult *results, double span,
+              bool per_tenant)
+{
+    ReplayResult total = {0};
+    int t;
+
+    for (t = 0; t < num_tenants; t++)
+    {
+        const ReplayResult *r = &results[t];
+
+        total.statements += r->statements;
+        total.admitted += r->admitted;
+        total.shadow_admitted += r->shadow_admitted;
+        total.rejected += r->rejected;
+        total.rejected_seconds += r->rejected_seconds;
+        total.peak_active += r->peak_active;
+
+        if (per_tenant)
+        {
+            char name[128];
+
+            snprintf(name, sizeof(name), "%s@%s", tenants[t].role, tenants[t].database);
+            printf("%-12s %-24s %10ld %10ld %10ld %10ld %7.2f%% %10.1f %10.1f %8d\n",
+                   config->name, name, r->statements, r->admitted,
+                   r->shadow_admitted, r->rejected,
+                   r->statements ? 100.0 * r->rejected / r->statements : 0.0,
+                   r->rejected_seconds, (r->admitted + r->shadow_admitted) / span,
+                   r->peak_active);
+        }
+    }
+
+    /* Peak is summed over tenants, an upper bound for the whole trace */
+    printf("%-12s %-24s %10ld %10ld %10ld %10ld %7.2f%% %10.1f %10.1f %8d\n",
+           config->name, "(all)", total.statements, total.admitted,
+           total.shadow_admitted, total.rejected,
+           total.statements ? 100.0 * total.rejected / total.statements : 0.0,
+           total.rejected_seconds, (total.admitted + total.shadow_admitted) / span,
+           total.peak_active);
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-f trace|csvlog] [-v] -c configs.conf trace-file\n", progname);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *format = "trace";
+    const char *config_path = NULL;
+    bool per_tenant = false;
+    ReplayResult *results;
+    double first, last, span;
+    FILE *fp;
+    long i;
+    int opt, c;
+
+    while ((opt = getopt(argc, argv, "f:c:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                format = optarg;
+                break;
+            case 'c':
+                config_path = optarg;
+                break;
+            case 'v':
+                per_tenant = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (config_path == NULL || optind != argc - 1 ||
+        (strcmp(format, "trace") != 0 && strcmp(format, "csvlog") != 0))
+        usage(argv[0]);
+
+    load_configs(config_path);
+
+    fp = fopen(argv[optind], "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "replay: could not open \"%s\": %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (strcmp(format, "csvlog") == 0)
+        load_csvlog(fp);
+    else
+        load_trace(fp);
+    fclose(fp);
+
+    if (num_statements == 0)
+    {
+        fprintf(stderr, "replay: no SELECT, INSERT, UPDATE or DELETE statements in the trace\n");
+        return 1;
+    }
+
+    qsort(statements, num_statements, sizeof(ReplayStatement), compare_statements);
+
+    first = statements[0].start;
+    last = statements[0].end;
+    for (i = 0; i < num_statements; i++)
+    {
+        if (statements[i].end > last)
+            last = statements[i].end;
+    }
+    span = (last > first) ? last - first : 1.0;
+
+    printf("statements=%ld tenants=%d span=%.1fs configs=%d\n",
+           num_statements, num_tenants, span, num_configs);
+    printf("%-12s %-24s %10s %10s %10s %10s %8s %10s %10s %8s\n",
+           "config", per_tenant ? "tenant" : "", "statements", "admitted", "shadow",
+           "rejected", "rej%", "rej_sec", "per_sec", "peak");
+
+    results = xrealloc(NULL, sizeof(ReplayResult) * num_tenants);
+    for (c = 0; c < num_configs; c++)
+    {
+        replay_config(&configs[c], results);
+        print_results(&configs[c], results, span, per_tenant);
+    }
+
+    free(results);
+    return 0;
+}
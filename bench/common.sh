@@ -0,0 +1,155 @@
+#!/usr/bin/env bash
+#
+# common.sh - Throwaway cluster and pgbench helpers for the QoS benchmarks
+#
+# Sourced by the bench/*.sh scripts. Creates a temporary cluster listening
+# only on a Unix socket inside BENCH_DIR and removes it on exit (set
+# BENCH_KEEP=1 to keep it for inspection).
+#
+# Author:  M.Atif Ceylan
+# Company: AppstoniA OÜ
+# Created: October 17, 2026
+# Version: 1.1
+# License: See LICENSE file in the project root
+#
+# Copyright (c) 2025 AppstoniA OÜ
+# All rights reserved.
+#
+
+set -euo pipefail
+
+PG_CONFIG=${PG_CONFIG:-pg_config}
+PGBIN=$("$PG_CONFIG" --bindir)
+NPROC=$(nproc 2>/dev/null || getconf _NPROCESSORS_ONLN)
+
+BENCH_PORT=${BENCH_PORT:-54329}
+BENCH_SCALE=${BENCH_SCALE:-50}
+BENCH_DURATION=${BENCH_DURATION:-20}
+BENCH_MAX_CONNECTIONS=${BENCH_MAX_CONNECTIONS:-1100}
+BENCH_SHARED_BUFFERS=${BENCH_SHARED_BUFFERS:-1GB}
+BENCH_DIR=${BENCH_DIR:-$(mktemp -d "${TMPDIR:-/tmp}/qos-bench.XXXXXX")}
+BENCH_KEEP=${BENCH_KEEP:-0}
+
+PGDATA="$BENCH_DIR/data"
+export PGHOST="$BENCH_DIR"
+export PGPORT="$BENCH_PORT"
+export PGUSER=postgres
+export PGDATABASE=postgres
+
+bench_log()
+{
+    echo "[$(date +%H:%M:%S)] $*" >&2
+}
+
+# Create the cluster; called once per script
+bench_init_cluster()
+{
+    mkdir -p "$BENCH_DIR"
+    trap bench_cleanup EXIT
+
+    # 1000 pgbench clients need more than the usual 1024 descriptors
+    ulimit -n 65536 2>/dev/null || ulimit -n 4096 2>/dev/null || true
+
+    bench_log "initdb in $PGDATA"
+    "$PGBIN/initdb" -D "$PGDATA" -U postgres -A trust >"$BENCH_DIR/initdb.log" 2>&1
+
+    cat >>"$PGDATA/postgresql.conf" <<EOF
+
+# qos benchmark settings
+listen_addresses = ''
+port = $BENCH_PORT
+unix_socket_directories = '$BENCH_DIR'
+max_connections = $BENCH_MAX_CONNECTIONS
+shared_buffers = $BENCH_SHARED_BUFFERS
+max_wal_size = 8GB
+checkpoint_timeout = 30min
+compute_query_id = on
+EOF
+}
+
+# Start the server, with qos preloaded when $1 = qos
+bench_start()
+{
+    local preload=""
+
+    if [ "${1:-}" = "qos" ]; then
+        preload="-c shared_preload_libraries=qos"
+    fi
+
+    "$PGBIN/pg_ctl" -D "$PGDATA" -l "$BENCH_DIR/server.log" -w \
+        -o "$preload" start >/dev/null
+}
+
+bench_stop()
+{
+    if [ -f "$PGDATA/postmaster.pid" ]; then
+        "$PGBIN/pg_ctl" -D "$PGDATA" -m fast -w stop >/dev/null
+    fi
+}
+
+bench_cleanup()
+{
+    bench_stop || true
+    if [ "$BENCH_KEEP" = "1" ]; then
+        bench_log "cluster kept in $BENCH_DIR"
+    else
+        rm -rf "$BENCH_DIR"
+    fi
+}
+
+bench_psql()
+{
+    "$PGBIN/psql" -X -q -v ON_ERROR_STOP=1 "$@"
+}
+
+# Create a login role owning a database of the same name, loaded with
+# pgbench tables at BENCH_SCALE
+bench_create_tenant()
+{
+    local name=$1
+
+    bench_psql -c "CREATE ROLE $name LOGIN" -c "CREATE DATABASE $name OWNER $name"
+    "$PGBIN/pgbench" -i -q -s "$BENCH_SCALE" -U "$name" "$name" >/dev/null 2>&1
+}
+
+# pgbench threads: one per client up to the number of CPUs
+bench_threads()
+{
+    local clients=$1
+
+    if [ "$clients" -lt "$NPROC" ]; then
+        echo "$clients"
+    else
+        echo "$NPROC"
+    fi
+}
+
+# Run pgbench and print "tps<TAB>avg_latency_ms"; remaining arguments are
+# passed to pgbench
+bench_pgbench()
+{
+    local out
+
+    out=$("$PGBIN/pgbench" -n "$@" 2>&1) || {
+        echo "$out" >&2
+        return 1
+    }
+
+    echo "$out" | awk '
+        /^tps = / && !tps { tps = $3 }
+        /^latency average = / { lat = $4 }
+        END { printf "%s\t%s\n", (tps == "" ? "0" : tps), (lat == "" ? "0" : lat) }'
+}
+
+# p99 latency in ms from pgbench per-transaction logs (--log); the third
+# field of each line is the latency in microseconds
+bench_log_p99()
+{
+    cat "$@" | awk '{ print $3 }' | sort -n | awk '
+        { v[NR] = $1 }
+        END {
+            if (NR == 0) { print "0"; exit }
+            i = int(NR * 0.99); if (i < 1) i = 1
+            printf "%.3f\n", v[i] / 1000.0
+        }'
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/env bash
+#
+# noisy_neighbour.sh - Does a QoS mechanism isolate a tenant? (make bench-noisy)
+#
+# Three tenants, each a role with its own database on one throwaway cluster:
+#
+#   victim    latency-sensitive select-only pgbench at a fixed rate
+#   analytic  one client per CPU running parallel aggregate/sort queries
+#             with a large work_mem
+#   bulk      writers updating large ranges of pgbench_accounts
+#
+# For each scenario the noisy tenants get a different set of qos.* limits
+# and the victim's throughput, average and p99 latency are recorded next to
+# the noisy tenants' throughput. "alone" runs the victim without noise and
+# is the target the other scenarios should approach.
+#
+# Environment: BENCH_SCENARIOS (default "alone off shadow cpu_core_limit
+# work_mem_limit combined"), BENCH_DURATION, BENCH_VICTIM_CLIENTS (default
+# 8), BENCH_VICTIM_RATE (transactions/s, default 2000), BENCH_CORE_LIMIT
+# (cores for each noisy tenant, default a quarter of the CPUs),
+# BENCH_OUTPUT and those in bench/common.sh.
+#
+# New enforcement mechanisms get a scenario by adding a case to
+# apply_scenario.
+#
+# Author:  M.Atif Ceylan
+# Company: AppstoniA OÜ
+# Created: October 17, 2026
+# Version: 1.1
+# License: See LICENSE file in the project root
+#
+# Copyright (c) 2025 AppstoniA OÜ
+# All rights reserved.
+#
+
+. "$(dirname "$0")/common.sh"
+
+BENCH_SCENARIOS=${BENCH_SCENARIOS:-"alone off shadow cpu_core_limit work_mem_limit combined"}
+BENCH_DURATION=${BENCH_DURATION:-60}
+BENCH_VICTIM_CLIENTS=${BENCH_VICTIM_CLIENTS:-8}
+BENCH_VICTIM_RATE=${BENCH_VICTIM_RATE:-2000}
+BENCH_CORE_LIMIT=${BENCH_CORE_LIMIT:-$(( NPROC / 4 > 0 ? NPROC / 4 : 1 ))}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+
+# Seconds the noisy tenants run before the victim starts measuring
+WARMUP=5
+
+write_scripts()
+{
+    cat >"$BENCH_DIR/analytic.sql" <<'EOF'
+SELECT aid % 1000 AS k, sum(abalance), count(DISTINCT bid)
+FROM pgbench_accounts GROUP BY 1 ORDER BY 2 DESC LIMIT 10;
+EOF
+
+    cat >"$BENCH_DIR/bulk.sql" <<'EOF'
+\set a random(1, 100000 * :scale - 5000)
+UPDATE pgbench_accounts SET abalance = abalance + 1 WHERE aid BETWEEN :a AND :a + 5000;
+EOF
+}
+
+reset_limits()
+{
+    local role
+
+    for role in analytic bulk; do
+        bench_psql -c "ALTER ROLE $role RESET qos.cpu_core_limit" \
+                   -c "ALTER ROLE $role RESET qos.work_mem_limit" \
+                   -c "ALTER ROLE $role RESET qos.enforcement"
+    done
+}
+
+apply_scenario()
+{
+    local role
+
+    reset_limits
+
+    case "$1" in
+        alone|off)
+            ;;
+        shadow)
+            for role in analytic bulk; do
+                bench_psql -c "ALTER ROLE $role SET qos.cpu_core_limit = '$BENCH_CORE_LIMIT'" \
+                           -c "ALTER ROLE $role SET qos.work_mem_limit = '16MB'" \
+                           -c "ALTER ROLE $role SET qos.enforcement = 'shadow'"
+            done
+            ;;
+        cpu_core_limit)
+            for role in analytic bulk; do
+                bench_psql -c "ALTER ROLE $role SET qos.cpu_core_limit = '$BENCH_CORE_LIMIT'"
+            done
+            ;;
+        work_mem_limit)
+            bench_psql -c "ALTER ROLE analytic SET qos.work_mem_limit = '16MB'"
+            ;;
+        combined)
+            for role in analytic bulk; do
+                bench_psql -c "ALTER ROLE $role SET qos.cpu_core_limit = '$BENCH_CORE_LIMIT'" \
+                           -c "ALTER ROLE $role SET qos.work_mem_limit = '16MB'"
+            done
+            ;;
+        *)
+            echo "unknown scenario: $1" >&2
+            exit 1
+            ;;
+    esac
+}
+
+# Print the tps of a finished background pgbench from its output file
+noise_tps()
+{
+    awk '/^tps = / { print $3; exit }' "$1" 2>/dev/null || true
+}
+
+run_scenario()
+{
+    local scenario=$1
+    local logdir="$BENCH_DIR/log/$scenario"
+    local noise_time=$(( BENCH_DURATION + 2 * WARMUP ))
+    local pids=()
+    local victim p99 analytic_tps="" bulk_tps=""
+
+    apply_scenario "$scenario"
+    bench_psql -c "CHECKPOINT"
+    mkdir -p "$logdir"
+
+    if [ "$scenario" != "alone" ]; then
+        "$PGBIN/pgbench" -n -f "$BENCH_DIR/analytic.sql" -c "$NPROC" -j "$NPROC" \
+            -T "$noise_time" -U analytic analytic >"$logdir/analytic.out" 2>&1 &
+        pids+=($!)
+        "$PGBIN/pgbench" -n -f "$BENCH_DIR/bulk.sql" -s "$BENCH_SCALE" -c 4 -j 4 \
+            -T "$noise_time" -U bulk bulk >"$logdir/bulk.out" 2>&1 &
+        pids+=($!)
+        sleep "$WARMUP"
+    fi
+
+    bench_log "$scenario: victim running for ${BENCH_DURATION}s"
+    victim=$(bench_pgbench -S -M prepared -c "$BENCH_VICTIM_CLIENTS" \
+             -j "$(bench_threads "$BENCH_VICTIM_CLIENTS")" \
+             -R "$BENCH_VICTIM_RATE" -T "$BENCH_DURATION" \
+             --log --log-prefix="$logdir/victim" -U victim victim)
+    p99=$(bench_log_p99 "$logdir"/victim.*)
+
+    if [ "${#pids[@]}" -gt 0 ]; then
+        wait "${pids[@]}" || true
+        analytic_tps=$(noise_tps "$logdir/analytic.out")
+        bulk_tps=$(noise_tps "$logdir/bulk.out")
+    fi
+
+    printf "%s\t%s\t%s\t%s\t%s\n" "$scenario" "$victim" "$p99" \
+        "${analytic_tps:--}" "${bulk_tps:--}" >>"$BENCH_OUTPUT"
+}
+
+bench_init_cluster
+: >"$BENCH_OUTPUT"
+write_scripts
+
+bench_start qos
+for tenant in victim analytic bulk; do
+    bench_create_tenant "$tenant"
+    bench_psql -d "$tenant" -c "CREATE EXTENSION IF NOT EXISTS qos"
+done
+bench_psql -c "ALTER ROLE analytic SET work_mem = '1GB'" \
+           -c "ALTER ROLE analytic SET max_parallel_workers_per_gather = '$NPROC'"
+
+for scenario in $BENCH_SCENARIOS; do
+    run_scenario "$scenario"
+done
+bench_stop
+
+awk -F'\t' '
+    BEGIN {
+        printf "%-16s %10s %10s %10s %12s %10s\n", "scenario", "victim_tps", "avg_ms", "p99_ms", "analytic_tps", "bulk_tps"
+    }
+    {
+        printf "%-16s %10.1f %10.3f %10.3f %12s %10s\n", $1, $2, $3, $4, $5, $6
+    }' "$BENCH_OUTPUT"
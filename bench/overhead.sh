@@ -0,0 +1,117 @@
+#!/usr/bin/env bash
+#
+# overhead.sh - Hot-path cost of the qos hooks (make bench)
+#
+# Runs pgbench against one throwaway cluster in three configurations:
+#
+#   off     qos not in shared_preload_libraries (baseline)
+#   on      qos preloaded, no limits set for the benchmark role
+#   limits  qos preloaded, every limit set high enough never to bind, so
+#           each statement goes through the full admission path
+#
+# with select-only, TPC-B-like and prepared select-only workloads at each
+# client count, and reports TPS and average latency with their change
+# relative to the baseline.
+#
+# Environment: BENCH_CLIENTS (default "1 10 50 100 500 1000"),
+# BENCH_DURATION (seconds per run, default 20), BENCH_SCALE (default 50),
+# BENCH_WORKLOADS (default "select tpcb prepared"), BENCH_OUTPUT (raw
+# results, default bench_output.txt) and those in bench/common.sh.
+#
+# Author:  M.Atif Ceylan
+# Company: AppstoniA OÜ
+# Created: October 17, 2026
+# Version: 1.1
+# License: See LICENSE file in the project root
+#
+# Copyright (c) 2025 AppstoniA OÜ
+# All rights reserved.
+#
+
+. "$(dirname "$0")/common.sh"
+
+BENCH_CLIENTS=${BENCH_CLIENTS:-"1 10 50 100 500 1000"}
+BENCH_WORKLOADS=${BENCH_WORKLOADS:-"select tpcb prepared"}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+
+workload_args()
+{
+    case "$1" in
+        select)   echo "-S -M simple" ;;
+        tpcb)     echo "-b tpcb-like -M simple" ;;
+        prepared) echo "-S -M prepared" ;;
+        *)        echo "unknown workload: $1" >&2; exit 1 ;;
+    esac
+}
+
+set_limits()
+{
+    bench_psql -c "ALTER ROLE bench SET qos.max_concurrent_tx = '100000'" \
+               -c "ALTER ROLE bench SET qos.max_concurrent_select = '100000'" \
+               -c "ALTER ROLE bench SET qos.max_concurrent_update = '100000'" \
+               -c "ALTER ROLE bench SET qos.max_concurrent_insert = '100000'" \
+               -c "ALTER ROLE bench SET qos.max_concurrent_delete = '100000'" \
+               -c "ALTER ROLE bench SET qos.work_mem_limit = '1GB'" \
+               -c "ALTER ROLE bench SET qos.cpu_core_limit = '$NPROC'"
+}
+
+run_config()
+{
+    local config=$1
+    local workload clients result
+
+    for workload in $BENCH_WORKLOADS; do
+        for clients in $BENCH_CLIENTS; do
+            bench_log "$config $workload clients=$clients"
+            # shellcheck disable=SC2046
+            result=$(bench_pgbench $(workload_args "$workload") \
+                     -c "$clients" -j "$(bench_threads "$clients")" \
+                     -T "$BENCH_DURATION" -U bench bench)
+            printf "%s\t%s\t%s\t%s\n" "$config" "$workload" "$clients" "$result" >>"$BENCH_OUTPUT"
+        done
+    done
+}
+
+bench_init_cluster
+: >"$BENCH_OUTPUT"
+
+bench_start
+bench_create_tenant bench
+bench_psql -c "CHECKPOINT"
+run_config off
+bench_stop
+
+bench_start qos
+bench_psql -d bench -c "CREATE EXTENSION IF NOT EXISTS qos"
+bench_psql -c "CHECKPOINT"
+run_config on
+
+set_limits
+bench_psql -c "CHECKPOINT"
+run_config limits
+bench_stop
+
+# Report: one line per workload/clients/config with the change from "off"
+awk -F'\t' '
+    {
+        key = $2 "\t" $3
+        tps[$1, key] = $4
+        lat[$1, key] = $5
+        if (!(key in seen)) { seen[key] = 1; order[++n] = key }
+    }
+    function pct(v, base) { return (base > 0) ? sprintf("%+.1f%%", (v - base) * 100.0 / base) : "n/a" }
+    END {
+        printf "%-9s %7s %-7s %12s %8s %10s %8s\n", "workload", "clients", "config", "tps", "d_tps", "lat_ms", "d_lat"
+        for (i = 1; i <= n; i++) {
+            split(order[i], k, "\t")
+            split("off on limits", cfgs, " ")
+            for (c = 1; c <= 3; c++) {
+                cfg = cfgs[c]
+                if (!((cfg, order[i]) in tps))
+                    continue
+                printf "%-9s %7s %-7s %12.1f %8s %10.3f %8s\n", k[1], k[2], cfg,
+                       tps[cfg, order[i]], (cfg == "off") ? "" : pct(tps[cfg, order[i]], tps["off", order[i]]),
+                       lat[cfg, order[i]], (cfg == "off") ? "" : pct(lat[cfg, order[i]], lat["off", order[i]])
+            }
+        }
+    }' "$BENCH_OUTPUT"
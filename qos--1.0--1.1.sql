@@ -0,0 +1,490 @@
+-- qos--1.0--1.1.sql
+-- PostgreSQL QoS Resource Governor Extension
+-- Upgrade script from 1.0 to 1.1
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION qos UPDATE TO '1.1'" to load this file. \quit
+
+-- Function: qos_get_stats()
+-- Returns per-tenant (role, database) QoS statistics
+DROP FUNCTION qos_get_stats();
+CREATE FUNCTION qos_get_stats(
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT select_admitted bigint,
+    OUT select_rejected bigint,
+    OUT select_throttled bigint,
+    OUT update_admitted bigint,
+    OUT update_rejected bigint,
+    OUT update_throttled bigint,
+    OUT delete_admitted bigint,
+    OUT delete_rejected bigint,
+    OUT delete_throttled bigint,
+    OUT insert_admitted bigint,
+    OUT insert_rejected bigint,
+    OUT insert_throttled bigint,
+    OUT tx_admitted bigint,
+    OUT tx_rejected bigint,
+    OUT work_mem_caps bigint,
+    OUT cpu_pinnings bigint,
+    OUT select_shadow_rejected bigint,
+    OUT update_shadow_rejected bigint,
+    OUT delete_shadow_rejected bigint,
+    OUT insert_shadow_rejected bigint,
+    OUT tx_shadow_rejected bigint,
+    OUT shadow_throttled bigint,
+    OUT work_mem_shadow_caps bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_stats';
+
+-- View: qos_stats
+-- Shows QoS statistics per role and database
+CREATE VIEW qos_stats AS
+SELECT
+    COALESCE(r.rolname, s.role_oid::text, 'overflow') as rolname,
+    COALESCE(d.datname, s.database_oid::text, 'overflow') as datname,
+    s.select_admitted,
+    s.select_rejected,
+    s.select_throttled,
+    s.update_admitted,
+    s.update_rejected,
+    s.update_throttled,
+    s.delete_admitted,
+    s.delete_rejected,
+    s.delete_throttled,
+    s.insert_admitted,
+    s.insert_rejected,
+    s.insert_throttled,
+    s.tx_admitted,
+    s.tx_rejected,
+    s.work_mem_caps,
+    s.cpu_pinnings,
+    s.select_shadow_rejected,
+    s.update_shadow_rejected,
+    s.delete_shadow_rejected,
+    s.insert_shadow_rejected,
+    s.tx_shadow_rejected,
+    s.shadow_throttled,
+    s.work_mem_shadow_caps
+FROM qos_get_stats() s
+LEFT JOIN pg_roles r ON r.oid = s.role_oid
+LEFT JOIN pg_database d ON d.oid = s.database_oid;
+
+COMMENT ON FUNCTION qos_get_stats() IS 'Returns per-tenant QoS statistics';
+COMMENT ON VIEW qos_stats IS 'QoS statistics per role and database';
+
+-- Function: qos_latency_histogram()
+-- Returns the non-empty latency histogram buckets per tenant and kind
+-- (admission, planning, executor); bounds are in microseconds
+CREATE FUNCTION qos_latency_histogram(
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT kind text,
+    OUT bucket_lower_us bigint,
+    OUT bucket_upper_us bigint,
+    OUT count bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_latency_histogram';
+
+-- Function: qos_latency_percentiles()
+-- Returns sample count, mean and p50/p95/p99 (bucket upper bounds, in
+-- microseconds) per tenant and latency kind
+CREATE FUNCTION qos_latency_percentiles(
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT kind text,
+    OUT samples bigint,
+    OUT mean_us double precision,
+    OUT p50_us bigint,
+    OUT p95_us bigint,
+    OUT p99_us bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_latency_percentiles';
+
+-- View: qos_latency
+-- Shows latency percentiles per role, database and kind
+CREATE VIEW qos_latency AS
+SELECT
+    COALESCE(r.rolname, l.role_oid::text, 'overflow') as rolname,
+    COALESCE(d.datname, l.database_oid::text, 'overflow') as datname,
+    l.kind,
+    l.samples,
+    l.mean_us,
+    l.p50_us,
+    l.p95_us,
+    l.p99_us
+FROM qos_latency_percentiles() l
+LEFT JOIN pg_roles r ON r.oid = l.role_oid
+LEFT JOIN pg_database d ON d.oid = l.database_oid;
+
+COMMENT ON FUNCTION qos_latency_histogram() IS 'Returns per-tenant QoS latency histogram buckets';
+COMMENT ON FUNCTION qos_latency_percentiles() IS 'Returns per-tenant QoS latency percentiles';
+COMMENT ON VIEW qos_latency IS 'QoS latency percentiles per role, database and kind';
+
+-- Function: qos_get_activity()
+-- Returns one row per backend tracked by QoS, read from a consistent
+-- snapshot of shared memory
+CREATE FUNCTION qos_get_activity(
+    OUT pid integer,
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT command text,
+    OUT in_transaction boolean,
+    OUT statement_start timestamptz,
+    OUT work_mem_kb integer,
+    OUT parallel_workers_planned integer,
+    OUT parallel_workers_granted integer,
+    OUT cpu_cores integer[],
+    OUT idle_tx_since timestamptz)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_activity';
+
+-- View: qos_activity
+-- Shows live QoS state per backend alongside pg_stat_activity
+CREATE VIEW qos_activity AS
+SELECT
+    a.pid,
+    r.rolname,
+    d.datname,
+    a.command,
+    a.in_transaction,
+    a.idle_tx_since,
+    a.statement_start,
+    a.work_mem_kb,
+    a.parallel_workers_planned,
+    a.parallel_workers_granted,
+    a.cpu_cores,
+    sa.state,
+    sa.wait_event_type,
+    sa.wait_event
+FROM qos_get_activity() a
+LEFT JOIN pg_roles r ON r.oid = a.role_oid
+LEFT JOIN pg_database d ON d.oid = a.database_oid
+LEFT JOIN pg_stat_activity sa ON sa.pid = a.pid;
+
+COMMENT ON FUNCTION qos_get_activity() IS 'Returns live QoS state per backend';
+COMMENT ON VIEW qos_activity IS 'Live QoS state per backend';
+
+-- Function: qos_metrics()
+-- Returns all QoS counters, gauges and histograms in Prometheus text format
+CREATE FUNCTION qos_metrics()
+RETURNS text
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_metrics';
+
+COMMENT ON FUNCTION qos_metrics() IS 'Returns QoS metrics in Prometheus exposition format';
+
+-- Function: qos_recent_events()
+-- Returns the recent rejections, throttles, work_mem caps and idle
+-- transaction terminations kept in the shared event ring
+-- (qos.event_buffer_size entries), oldest first. work_mem values are in kB;
+-- cpu_core_limit events compare parallel workers; terminate events compare
+-- idle milliseconds with qos.idle_tx_timeout and carry the pid of the
+-- terminated backend.
+CREATE FUNCTION qos_recent_events(
+    OUT event_time timestamptz,
+    OUT pid integer,
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT action text,
+    OUT limit_name text,
+    OUT observed bigint,
+    OUT limit_value bigint,
+    OUT query_id bigint,
+    OUT shadow boolean)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_recent_events';
+
+-- View: qos_events
+-- Shows recent enforcement events with role and database names
+CREATE VIEW qos_events AS
+SELECT
+    e.event_time,
+    e.pid,
+    COALESCE(r.rolname, e.role_oid::text) as rolname,
+    COALESCE(d.datname, e.database_oid::text) as datname,
+    e.action,
+    e.limit_name,
+    e.observed,
+    e.limit_value,
+    e.query_id,
+    e.shadow
+FROM qos_recent_events() e
+LEFT JOIN pg_roles r ON r.oid = e.role_oid
+LEFT JOIN pg_database d ON d.oid = e.database_oid;
+
+COMMENT ON FUNCTION qos_recent_events() IS 'Returns recent QoS enforcement events';
+COMMENT ON VIEW qos_events IS 'Recent QoS enforcement events';
+
+-- Function: qos_overhead()
+-- Returns the time spent in QoS hooks (excluding the chained hooks and
+-- standard functions) and waiting for the QoS lock, in nanoseconds.
+-- Samples are only collected while qos.track_overhead is on.
+CREATE FUNCTION qos_overhead(
+    OUT hook text,
+    OUT calls bigint,
+    OUT total_ns bigint,
+    OUT mean_ns double precision,
+    OUT p50_ns bigint,
+    OUT p95_ns bigint,
+    OUT p99_ns bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_overhead';
+
+COMMENT ON FUNCTION qos_overhead() IS 'Returns QoS hook and lock wait overhead';
+
+-- Function: qos_get_cpu_map()
+-- Returns one row per online CPU with its NUMA node, last-level cache, last
+-- perf load sample and the tenants (role, database) pinned to it
+CREATE FUNCTION qos_get_cpu_map(
+    OUT cpu integer,
+    OUT numa_node integer,
+    OUT llc_id integer,
+    OUT cycles bigint,
+    OUT sampled_at timestamptz,
+    OUT role_oids oid[],
+    OUT database_oids oid[],
+    OUT backends integer)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_cpu_map';
+
+-- View: qos_cpu_map
+-- Shows per-CPU load and tenant placement with role and database names
+CREATE VIEW qos_cpu_map AS
+SELECT
+    c.cpu,
+    c.numa_node,
+    c.llc_id,
+    c.cycles,
+    c.sampled_at,
+    ARRAY(SELECT COALESCE(r.rolname, t.role_oid::text) || '@' ||
+                 COALESCE(d.datname, t.database_oid::text)
+          FROM unnest(c.role_oids, c.database_oids) AS t(role_oid, database_oid)
+          LEFT JOIN pg_roles r ON r.oid = t.role_oid
+          LEFT JOIN pg_database d ON d.oid = t.database_oid) as tenants,
+    c.backends
+FROM qos_get_cpu_map() c;
+
+COMMENT ON FUNCTION qos_get_cpu_map() IS 'Returns per-CPU load and tenant placement';
+COMMENT ON VIEW qos_cpu_map IS 'Per-CPU load, NUMA/LLC topology and tenant placement';
+
+-- Function: qos_get_usage(reset)
+-- Returns per-tenant resource usage of top-level statements: CPU time
+-- (getrusage), executor time, buffer hits/reads, WAL and temp file bytes.
+-- With reset = true every counter is read and zeroed atomically, for
+-- periodic export to a billing system.
+CREATE FUNCTION qos_get_usage(
+    reset boolean DEFAULT false,
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT statements bigint,
+    OUT exec_time_us bigint,
+    OUT cpu_user_us bigint,
+    OUT cpu_system_us bigint,
+    OUT blks_hit bigint,
+    OUT blks_read bigint,
+    OUT wal_bytes bigint,
+    OUT temp_bytes bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_usage';
+
+-- Reading with reset = true wipes the chargeback data; the qos_usage view
+-- below stays readable by everyone.
+REVOKE ALL ON FUNCTION qos_get_usage(boolean) FROM PUBLIC;
+
+-- qos_reset_stats() now clears usage as well
+REVOKE ALL ON FUNCTION qos_reset_stats() FROM PUBLIC;
+
+-- View: qos_usage
+-- Shows accumulated resource usage per role and database
+CREATE VIEW qos_usage AS
+SELECT
+    COALESCE(r.rolname, u.role_oid::text, 'overflow') as rolname,
+    COALESCE(d.datname, u.database_oid::text, 'overflow') as datname,
+    u.statements,
+    u.exec_time_us,
+    u.cpu_user_us,
+    u.cpu_system_us,
+    u.blks_hit,
+    u.blks_read,
+    u.wal_bytes,
+    u.temp_bytes
+FROM qos_get_usage() u
+LEFT JOIN pg_roles r ON r.oid = u.role_oid
+LEFT JOIN pg_database d ON d.oid = u.database_oid;
+
+COMMENT ON FUNCTION qos_get_usage(boolean) IS 'Returns per-tenant resource usage, optionally resetting it';
+COMMENT ON VIEW qos_usage IS 'Resource usage per role and database';
+
+-- Function: qos_get_hw_counters
+-- Returns per-tenant hardware counters (user-space cycles, instructions,
+-- last-level cache misses and task clock) collected while
+-- qos.track_hw_counters is on. Tenants without samples are omitted.
+CREATE FUNCTION qos_get_hw_counters(
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT cycles bigint,
+    OUT instructions bigint,
+    OUT llc_misses bigint,
+    OUT task_clock_ns bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_hw_counters';
+
+-- View: qos_hw_counters
+-- Shows hardware counters per role and database with IPC and LLC miss rate
+CREATE VIEW qos_hw_counters AS
+SELECT
+    COALESCE(r.rolname, h.role_oid::text, 'overflow') as rolname,
+    COALESCE(d.datname, h.database_oid::text, 'overflow') as datname,
+    h.cycles,
+    h.instructions,
+    h.llc_misses,
+    h.task_clock_ns,
+    round(h.instructions::numeric / NULLIF(h.cycles, 0), 2) as ipc,
+    round(h.llc_misses::numeric * 1000 / NULLIF(h.instructions, 0), 3) as llc_misses_per_kinstr
+FROM qos_get_hw_counters() h
+LEFT JOIN pg_roles r ON r.oid = h.role_oid
+LEFT JOIN pg_database d ON d.oid = h.database_oid;
+
+-- Function: qos_query_stats
+-- Returns per-queryId executions, concurrency (current, limit, peak),
+-- rejections by qos_set_query_limit(), parallel worker throttling and
+-- hardware counters. Requires compute_query_id; at most qos.max_queries
+-- queryIds are tracked.
+CREATE FUNCTION qos_query_stats(
+    OUT query_id bigint,
+    OUT calls bigint,
+    OUT active integer,
+    OUT max_concurrent integer,
+    OUT peak_active bigint,
+    OUT rejected bigint,
+    OUT shadow_rejected bigint,
+    OUT throttled bigint,
+    OUT throttled_time_us bigint,
+    OUT cycles bigint,
+    OUT instructions bigint,
+    OUT llc_misses bigint,
+    OUT task_clock_ns bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_query_stats';
+
+-- View: qos_queries
+-- Shows per-queryId limits, concurrency and hardware counters with IPC
+-- and LLC miss rate
+CREATE VIEW qos_queries AS
+SELECT
+    q.query_id,
+    q.calls,
+    q.active,
+    q.max_concurrent,
+    q.peak_active,
+    q.rejected,
+    q.shadow_rejected,
+    q.throttled,
+    q.throttled_time_us,
+    q.cycles,
+    q.instructions,
+    q.llc_misses,
+    q.task_clock_ns,
+    round(q.instructions::numeric / NULLIF(q.cycles, 0), 2) as ipc,
+    round(q.llc_misses::numeric * 1000 / NULLIF(q.instructions, 0), 3) as llc_misses_per_kinstr
+FROM qos_query_stats() q;
+
+COMMENT ON FUNCTION qos_get_hw_counters() IS 'Returns per-tenant hardware performance counters';
+COMMENT ON VIEW qos_hw_counters IS 'Hardware counters, IPC and LLC miss rate per role and database';
+COMMENT ON FUNCTION qos_query_stats() IS 'Returns per-queryId executions, limits, rejections and hardware counters';
+COMMENT ON VIEW qos_queries IS 'Limits, concurrency, hardware counters, IPC and LLC miss rate per queryId';
+
+-- Function: qos_get_saturation
+-- Returns per-tenant concurrency saturation for each max_concurrent_*
+-- slot type (select, update, delete, insert, transaction): current level
+-- and limit, high-water mark, and the time integrals from which average
+-- concurrency and time at the limit are derived. Maintained at every
+-- admission and release; the overflow entry is not included.
+CREATE FUNCTION qos_get_saturation(
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT slot text,
+    OUT active integer,
+    OUT limit_value integer,
+    OUT peak bigint,
+    OUT observed_us bigint,
+    OUT occupancy_us bigint,
+    OUT at_limit_us bigint)
+RETURNS SETOF record
+LANGUAGE C STRICT VOLATILE
+AS '$libdir/qos', 'qos_get_saturation';
+
+-- View: qos_saturation
+-- Shows how close each role and database runs to its concurrency limits
+CREATE VIEW qos_saturation AS
+SELECT
+    COALESCE(r.rolname, s.role_oid::text) as rolname,
+    COALESCE(d.datname, s.database_oid::text) as datname,
+    s.slot,
+    s.active,
+    s.limit_value,
+    s.peak,
+    round(s.occupancy_us::numeric / NULLIF(s.observed_us, 0), 2) as avg_active,
+    round(s.occupancy_us::numeric * 100 / NULLIF(s.observed_us * s.limit_value, 0), 1) as avg_occupancy_pct,
+    round(s.at_limit_us::numeric / 1000000, 1) as seconds_at_limit,
+    round(s.at_limit_us::numeric * 100 / NULLIF(s.observed_us, 0), 1) as pct_time_at_limit
+FROM qos_get_saturation() s
+LEFT JOIN pg_roles r ON r.oid = s.role_oid
+LEFT JOIN pg_database d ON d.oid = s.database_oid;
+
+COMMENT ON FUNCTION qos_get_saturation() IS 'Returns per-tenant concurrency high-water marks and time at limit';
+COMMENT ON VIEW qos_saturation IS 'Concurrency saturation per role, database and slot type';
+
+-- Function: qos_stats_history
+-- Returns per-tenant statistics rollups kept by the qos history worker
+-- (qos.history_interval > 0): how much each counter grew in every minute
+-- of the last hour ('minute') or every hour of the last week ('hour'),
+-- oldest first. tenant restricts the result to one role and since to
+-- buckets ending after that time. The current bucket is still filling.
+CREATE FUNCTION qos_stats_history(
+    tenant regrole DEFAULT NULL,
+    since timestamptz DEFAULT NULL,
+    granularity text DEFAULT 'minute',
+    OUT bucket_start timestamptz,
+    OUT role_oid oid,
+    OUT database_oid oid,
+    OUT admitted bigint,
+    OUT rejected bigint,
+    OUT throttled bigint,
+    OUT tx_admitted bigint,
+    OUT tx_rejected bigint,
+    OUT work_mem_caps bigint,
+    OUT statements bigint,
+    OUT exec_time_us bigint,
+    OUT cpu_time_us bigint)
+RETURNS SETOF record
+LANGUAGE C VOLATILE
+AS '$libdir/qos', 'qos_stats_history';
+
+COMMENT ON FUNCTION qos_stats_history(regrole, timestamptz, text) IS 'Returns per-minute or per-hour rollups of per-tenant statistics';
+
+-- Function: qos_set_query_limit
+-- Caps concurrent executions of one queryId (pg_stat_statements.queryid)
+-- across all tenants; further executions are rejected at admission,
+-- or only reported under qos.enforcement = shadow. NULL or -1 removes
+-- the limit. Limits live in shared memory and are not kept across a
+-- restart.
+CREATE FUNCTION qos_set_query_limit(queryid bigint, max_concurrent integer)
+RETURNS void
+LANGUAGE C VOLATILE
+AS '$libdir/qos', 'qos_set_query_limit';
+
+REVOKE ALL ON FUNCTION qos_set_query_limit(bigint, integer) FROM PUBLIC;
+
+COMMENT ON FUNCTION qos_set_query_limit(bigint, integer) IS 'Limits concurrent executions of one queryId';
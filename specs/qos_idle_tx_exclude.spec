@@ -0,0 +1,44 @@
+# qos.idle_tx_slot_policy = exclude
+#
+# s1 and s2 run as a role limited to one concurrent transaction; s0 is a
+# superuser that changes the policy and inspects qos_activity. While s1 is
+# idle in its transaction block s2 is admitted; s1 then resumes without
+# being checked again, so both transactions stay open until they end.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_idle_ex;
+    ALTER ROLE qos_iso_idle_ex SET qos.max_concurrent_tx = '1';
+}
+
+teardown
+{
+    DROP ROLE qos_iso_idle_ex;
+}
+
+session s0
+step s0_exclude { ALTER SYSTEM SET qos.idle_tx_slot_policy = 'exclude'; }
+step s0_reset   { ALTER SYSTEM RESET qos.idle_tx_slot_policy; }
+step s0_reload  { SELECT r AS reloaded FROM pg_reload_conf() r, LATERAL pg_sleep(1) s; }
+step s0_idle    { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_idle_ex' AND idle_tx_since IS NOT NULL; }
+step s0_held    { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_idle_ex' AND in_transaction; }
+
+session s1
+setup           { SET ROLE qos_iso_idle_ex; }
+step s1_begin   { BEGIN; }
+step s1_sel     { SELECT 1 AS n; }
+step s1_commit  { COMMIT; }
+
+session s2
+setup           { SET ROLE qos_iso_idle_ex; }
+step s2_begin   { BEGIN; }
+step s2_sel     { SELECT 1 AS n; }
+step s2_commit  { COMMIT; }
+
+# Under count (the default) the idle transaction keeps its slot
+permutation s1_begin s1_sel s2_sel s1_commit s2_sel
+
+# Under exclude it does not, and the resumed transaction runs over the
+# limit until it commits
+permutation s0_exclude s0_reload s1_begin s1_sel s0_idle s2_begin s2_sel s1_sel s0_held s1_commit s2_commit s0_held s0_reset s0_reload
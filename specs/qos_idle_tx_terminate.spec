@@ -0,0 +1,59 @@
+# qos.idle_tx_slot_policy = terminate_after
+#
+# s1, s2 and s3 run as a role limited to one concurrent transaction; s1
+# and s2 become that role with SET SESSION AUTHORIZATION, s3 is a
+# superuser session that switched to it with SET ROLE. s0 is a superuser that changes the settings (a zero
+# qos.idle_tx_timeout makes every idle transaction eligible) and inspects
+# the results. The permutation that terminates s1 comes last, as its
+# connection is gone afterwards.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_idle_term;
+    ALTER ROLE qos_iso_idle_term SET qos.max_concurrent_tx = '1';
+}
+
+teardown
+{
+    DROP ROLE qos_iso_idle_term;
+}
+
+session s0
+step s0_policy  { ALTER SYSTEM SET qos.idle_tx_slot_policy = 'terminate_after'; }
+step s0_timeout { ALTER SYSTEM SET qos.idle_tx_timeout = 0; }
+step s0_reset_policy  { ALTER SYSTEM RESET qos.idle_tx_slot_policy; }
+step s0_reset_timeout { ALTER SYSTEM RESET qos.idle_tx_timeout; }
+step s0_reload  { SELECT r AS reloaded FROM pg_reload_conf() r, LATERAL pg_sleep(1) s; }
+step s0_shadow  { ALTER ROLE qos_iso_idle_term SET qos.enforcement = 'shadow'; }
+step s0_events  { SELECT count(*) AS n FROM qos_events WHERE rolname = 'qos_iso_idle_term' AND action = 'terminate'; }
+step s0_held    { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_idle_term' AND in_transaction; }
+
+session s1
+setup           { SET SESSION AUTHORIZATION qos_iso_idle_term; }
+step s1_begin   { BEGIN; }
+step s1_sel     { SELECT 1 AS n; }
+step s1_commit  { COMMIT; }
+
+session s2
+setup           { SET SESSION AUTHORIZATION qos_iso_idle_term; }
+step s2_begin   { BEGIN; }
+step s2_sel     { SELECT 1 AS n; }
+step s2_victim  { SELECT count(*) AS n FROM qos_events WHERE rolname = 'qos_iso_idle_term' AND action = 'terminate' AND pid <> pg_backend_pid(); }
+step s2_commit  { COMMIT; }
+
+session s3
+setup           { SET ROLE qos_iso_idle_term; }
+step s3_begin   { BEGIN; }
+step s3_sel     { SELECT 1 AS n; }
+step s3_commit  { COMMIT; }
+
+# A superuser session is never terminated: s2 is rejected instead
+permutation s0_policy s0_timeout s0_reload s3_begin s3_sel s2_sel s0_events s3_sel s3_commit s0_reset_policy s0_reset_timeout s0_reload
+
+# Under qos.enforcement = shadow s2 is admitted and nothing is terminated
+permutation s0_policy s0_timeout s0_reload s0_shadow s1_begin s1_sel s2_sel s0_events s1_sel s1_commit s0_reset_policy s0_reset_timeout s0_reload
+
+# Otherwise s1, idle past the timeout, is terminated and s2 takes its slot;
+# the event names s1, not s2
+permutation s0_policy s0_timeout s0_reload s1_begin s1_sel s2_begin s2_sel s0_held s0_events s2_victim s2_commit s0_reset_policy s0_reset_timeout s0_reload
@@ -0,0 +1,40 @@
+# Limit changes reach running sessions
+#
+# ALTER ROLE ... SET qos.* bumps the shared settings epoch, so s2, which
+# already cached its limits, sees the new value on its next statement.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_epoch;
+    ALTER ROLE qos_iso_epoch SET qos.max_concurrent_select = '1';
+}
+
+teardown
+{
+    DROP ROLE qos_iso_epoch;
+}
+
+session s0
+step s0_begin  { BEGIN; }
+step s0_lock   { SELECT count(*) AS n FROM pg_advisory_xact_lock(1); }
+step s0_commit { COMMIT; }
+
+session s1
+setup          { SET ROLE qos_iso_epoch; }
+step s1_wait   { SELECT count(*) AS n FROM pg_advisory_xact_lock_shared(1); }
+
+session s2
+setup          { SET ROLE qos_iso_epoch; }
+step s2_sel    { SELECT 1 AS n; }
+
+session s3
+step s3_raise  { ALTER ROLE qos_iso_epoch SET qos.max_concurrent_select = '2'; }
+step s3_lower  { ALTER ROLE qos_iso_epoch SET qos.max_concurrent_select = '1'; }
+step s3_shadow { ALTER ROLE qos_iso_epoch SET qos.enforcement = 'shadow'; }
+step s3_on     { ALTER ROLE qos_iso_epoch RESET qos.enforcement; }
+
+permutation s0_begin s0_lock s1_wait s2_sel s3_raise s2_sel s3_lower s2_sel s0_commit
+
+# Shadow mode admits the statement that would have been rejected
+permutation s0_begin s0_lock s1_wait s2_sel s3_shadow s2_sel s3_on s2_sel s0_commit
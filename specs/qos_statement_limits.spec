@@ -0,0 +1,98 @@
+# Statement concurrency limits
+#
+# s1 holds a SELECT slot while it waits for an advisory lock taken by s0
+# (a superuser, not limited); s2 runs as the same limited role.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_stmt;
+    ALTER ROLE qos_iso_stmt SET qos.max_concurrent_select = '1';
+    ALTER ROLE qos_iso_stmt SET qos.max_concurrent_insert = '1';
+    CREATE TABLE qos_iso_stmt_t (id int);
+    GRANT ALL ON qos_iso_stmt_t TO qos_iso_stmt;
+    CREATE FUNCTION qos_iso_stmt_nested() RETURNS int LANGUAGE plpgsql AS $$
+    BEGIN
+        PERFORM count(*) FROM qos_iso_stmt_t;
+        PERFORM pg_advisory_xact_lock_shared(1);
+        RETURN 1;
+    END $$;
+    CREATE FUNCTION qos_iso_stmt_fold() RETURNS int LANGUAGE plpgsql IMMUTABLE AS $$
+    BEGIN
+        PERFORM count(*) FROM qos_iso_stmt_t;
+        RETURN 1;
+    END $$;
+    CREATE PROCEDURE qos_iso_stmt_proc() LANGUAGE plpgsql AS $$
+    BEGIN
+        INSERT INTO qos_iso_stmt_t VALUES (1);
+        PERFORM pg_advisory_xact_lock_shared(1);
+    END $$;
+    CREATE FUNCTION qos_iso_stmt_idx(int) RETURNS int LANGUAGE plpgsql IMMUTABLE AS $$
+    BEGIN
+        PERFORM count(*) FROM qos_iso_stmt_t;
+        PERFORM pg_advisory_xact_lock_shared(1);
+        RETURN $1;
+    END $$;
+    CREATE TABLE qos_iso_stmt_idx_t (id int);
+    INSERT INTO qos_iso_stmt_idx_t VALUES (1);
+    ALTER TABLE qos_iso_stmt_idx_t OWNER TO qos_iso_stmt;
+}
+
+teardown
+{
+    DROP TABLE qos_iso_stmt_idx_t;
+    DROP FUNCTION qos_iso_stmt_idx(int);
+    DROP PROCEDURE qos_iso_stmt_proc();
+    DROP FUNCTION qos_iso_stmt_fold();
+    DROP FUNCTION qos_iso_stmt_nested();
+    DROP TABLE qos_iso_stmt_t;
+    DROP ROLE qos_iso_stmt;
+}
+
+session s0
+step s0_begin  { BEGIN; }
+step s0_lock   { SELECT count(*) AS n FROM pg_advisory_xact_lock(1); }
+step s0_held   { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_stmt' AND command IS NOT NULL; }
+step s0_commit { COMMIT; }
+
+session s1
+setup          { SET ROLE qos_iso_stmt; }
+step s1_wait   { SELECT count(*) AS n FROM pg_advisory_xact_lock_shared(1); }
+step s1_fail   { SELECT 1 / 0 AS n; }
+step s1_nested { INSERT INTO qos_iso_stmt_t SELECT qos_iso_stmt_nested(); }
+step s1_call   { CALL qos_iso_stmt_proc(); }
+step s1_fold   { SELECT count(*) AS n FROM pg_advisory_xact_lock_shared(qos_iso_stmt_fold()); }
+step s1_index  { CREATE INDEX ON qos_iso_stmt_idx_t (qos_iso_stmt_idx(id)); }
+step s1_ctas   { CREATE TEMP TABLE qos_iso_stmt_ctas ON COMMIT DROP AS SELECT count(*) AS n FROM pg_advisory_xact_lock_shared(1); }
+
+session s2
+setup          { SET ROLE qos_iso_stmt; }
+step s2_sel    { SELECT 1 AS n; }
+step s2_ins    { INSERT INTO qos_iso_stmt_t VALUES (1); }
+
+# A running SELECT takes the only slot; the slot is freed when it completes
+permutation s0_begin s0_lock s1_wait s0_held s2_sel s0_commit s2_sel s0_held
+
+# Limits are per command type: the INSERT slot is still free
+permutation s0_begin s0_lock s1_wait s2_ins s0_commit
+
+# A statement that fails gives its slot back
+permutation s1_fail s0_held s2_sel
+
+# Statements run by a function keep the INSERT slot of the outer statement
+# and take no SELECT slot of their own
+permutation s0_begin s0_lock s1_nested s0_held s2_ins s2_sel s0_commit s2_ins
+
+# The statements of a CALL share the slot of the first one until it returns
+permutation s0_begin s0_lock s1_call s0_held s2_ins s2_sel s0_commit s0_held
+
+# An immutable function folded while planning runs its statements before
+# the outer SELECT executes; they leave its slot alone
+permutation s0_begin s0_lock s1_fold s0_held s2_sel s0_commit s0_held
+
+# Statements run by other utilities (here an index expression evaluated by
+# CREATE INDEX) are nested: they take no slot and do not end the statement
+permutation s0_begin s0_lock s1_index s0_held s2_sel s0_commit
+
+# The query of CREATE TABLE AS holds a SELECT slot until the command returns
+permutation s0_begin s0_lock s1_ctas s0_held s2_sel s0_commit s0_held
@@ -0,0 +1,44 @@
+# Transaction concurrency limits
+#
+# s1 and s2 run as a role limited to one concurrent transaction; s0 is a
+# superuser that blocks s1 on an advisory lock and inspects qos_activity.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_tx;
+    ALTER ROLE qos_iso_tx SET qos.max_concurrent_tx = '1';
+}
+
+teardown
+{
+    DROP ROLE qos_iso_tx;
+}
+
+session s0
+step s0_begin  { BEGIN; }
+step s0_lock   { SELECT count(*) AS n FROM pg_advisory_xact_lock(1); }
+step s0_held   { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_tx' AND in_transaction; }
+step s0_commit { COMMIT; }
+
+session s1
+setup          { SET ROLE qos_iso_tx; }
+step s1_begin  { BEGIN; }
+step s1_wait   { SELECT count(*) AS n FROM pg_advisory_xact_lock_shared(1); }
+step s1_sel    { SELECT 1 AS n; }
+step s1_fail   { SELECT 1 / 0 AS n; }
+step s1_commit { COMMIT; }
+step s1_rollback { ROLLBACK; }
+
+session s2
+setup          { SET ROLE qos_iso_tx; }
+step s2_sel    { SELECT 1 AS n; }
+
+# A running statement holds the transaction slot
+permutation s0_begin s0_lock s1_wait s0_held s2_sel s0_commit s2_sel
+
+# Transaction block between statements: the slot is held until COMMIT
+permutation s1_begin s1_sel s0_held s2_sel s1_commit s2_sel
+
+# An aborted transaction gives its slot back before ROLLBACK
+permutation s1_begin s1_sel s1_fail s0_held s2_sel s1_rollback
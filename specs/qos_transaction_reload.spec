@@ -0,0 +1,36 @@
+# Transaction slot across a reload that disables QoS
+#
+# s1 holds the only transaction slot of its role in an open block when s0
+# turns qos.enabled off; COMMIT must still give the slot back, so s2 and
+# s1 itself are admitted once QoS is enabled again.
+
+setup
+{
+    CREATE EXTENSION IF NOT EXISTS qos;
+    CREATE ROLE qos_iso_reload;
+    ALTER ROLE qos_iso_reload SET qos.max_concurrent_tx = '1';
+}
+
+teardown
+{
+    DROP ROLE qos_iso_reload;
+}
+
+session s0
+step s0_off    { ALTER SYSTEM SET qos.enabled = off; }
+step s0_on     { ALTER SYSTEM RESET qos.enabled; }
+step s0_reload { SELECT r AS reloaded FROM pg_reload_conf() r, LATERAL pg_sleep(1) s; }
+step s0_held   { SELECT count(*) AS n FROM qos_activity WHERE rolname = 'qos_iso_reload' AND in_transaction; }
+
+session s1
+setup          { SET ROLE qos_iso_reload; }
+step s1_begin  { BEGIN; }
+step s1_sel    { SELECT 1 AS n; }
+step s1_commit { COMMIT; }
+
+session s2
+setup          { SET ROLE qos_iso_reload; }
+step s2_sel    { SELECT 1 AS n; }
+
+# qos.enabled = off reaches s1 while it is idle in its transaction block
+permutation s1_begin s1_sel s0_off s0_reload s1_commit s0_held s0_on s0_reload s2_sel s1_begin s1_sel s0_held s1_commit
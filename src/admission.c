@@ -0,0 +1,142 @@
+/*
+ * admission.c - Backend-independent admission engine
+ *
+ * This file implements the parts of admission control that only compute:
+ * limit merging (most restrictive scope wins), the admission decision for
+ * a concurrency limit under each enforcement mode, and choosing CPU cores
+ * from cycle samples. The hooks supply the inputs from catalogs, shared
+ * memory and perf events; bench/admission links this file with a mock
+ * shared-memory layer to measure admission without a cluster.
+ *
+ * Must not include postgres.h or use palloc/elog.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "admission.h"
+
+/*
+ * Effective limit from the three setting scopes:
+ *   role          = ALTER ROLE x SET qos.*
+ *   database      = ALTER DATABASE y SET qos.*
+ *   role_database = ALTER ROLE x IN DATABASE y SET qos.*
+ * The minimum of those that are set (>= 0) wins; -1 if none is set.
+ */
+int64_t
+qos_adm_merge_limit(int64_t role, int64_t database, int64_t role_database)
+{
+    return qos_adm_pick_min(qos_adm_pick_min(role, database), role_database);
+}
+
+/*
+ * Effective enforcement mode: the most restrictive scope wins
+ * (on > shadow > off) and unset counts as on
+ */
+int
+qos_adm_merge_mode(int role, int database, int role_database)
+{
+    int mode = role;
+
+    if (database > mode)
+        mode = database;
+    if (role_database > mode)
+        mode = role_database;
+
+    return (mode < 0) ? QOS_ADM_MODE_ON : mode;
+}
+
+/*
+ * Admission decision for a limit (<= 0 = none) when "active" others
+ * already hold a slot
+ */
+QoSAdmDecision
+qos_adm_decide(int active, int limit, int mode)
+{
+    if (limit <= 0 || active < limit || mode == QOS_ADM_MODE_OFF)
+        return QOS_ADM_ADMIT;
+
+    return (mode == QOS_ADM_MODE_SHADOW) ? QOS_ADM_SHADOW_ADMIT : QOS_ADM_REJECT;
+}
+
+/*
+ * Pick the "requested" least busy cores by cycle count, skipping cores that
+ * could not be measured. order is scratch space for total_cores entries.
+ * Returns the number of cores written to selected, or 0 if no core was
+ * measured (the caller then falls back to qos_adm_round_robin_cores).
+ */
+int
+qos_adm_select_cores(const int64_t *cycles, int total_cores, int requested,
+                     int *order, int *selected)
+{
+    int valid_count = 0;
+    int i, j;
+
+    if (requested <= 0 || total_cores <= 0)
+        return 0;
+
+    if (requested > total_cores)
+        requested = total_cores;
+
+    for (i = 0; i < total_cores; i++)
+    {
+        order[i] = i;
+        if (cycles[i] >= 0)
+            valid_count++;
+    }
+
+    if (valid_count == 0)
+        return 0;
+
+    /* Partial selection sort, ascending = less busy first */
+    for (i = 0; i < requested; i++)
+    {
+        int min_idx = i;
+
+        for (j = i + 1; j < total_cores; j++)
+        {
+            if (cycles[order[j]] < 0)
+                continue;
+            if (cycles[order[min_idx]] < 0 || cycles[order[j]] < cycles[order[min_idx]])
+                min_idx = j;
+        }
+        if (min_idx != i)
+        {
+            int tmp = order[i];
+
+            order[i] = order[min_idx];
+            order[min_idx] = tmp;
+        }
+    }
+
+    for (i = 0; i < requested; i++)
+        selected[i] = order[i];
+
+    return requested;
+}
+
+/*
+ * "requested" consecutive cores starting at start_core, wrapping around
+ */
+int
+qos_adm_round_robin_cores(int start_core, int total_cores, int requested, int *selected)
+{
+    int i;
+
+    if (requested <= 0 || total_cores <= 0)
+        return 0;
+
+    if (requested > total_cores)
+        requested = total_cores;
+
+    for (i = 0; i < requested; i++)
+        selected[i] = (start_core + i) % total_cores;
+
+    return requested;
+}
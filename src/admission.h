@@ -0,0 +1,63 @@
+/*
+ * admission.h - Backend-independent admission engine
+ *
+ * This header declares the admission logic that does not depend on backend
+ * globals: merging limits from the role, database and role-in-database
+ * scopes, the admit/reject/shadow decision, and CPU core selection. It
+ * includes no PostgreSQL headers, so the same code is built into the
+ * extension and into the standalone tools under bench/admission.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_ADMISSION_H
+#define QOS_ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Enforcement modes, same values as QoSEnforcementMode in qos.h */
+#define QOS_ADM_MODE_OFF        0
+#define QOS_ADM_MODE_SHADOW     1
+#define QOS_ADM_MODE_ON         2
+
+/* Outcome of an admission check */
+typedef enum QoSAdmDecision
+{
+    QOS_ADM_ADMIT = 0,          /* No limit, or below it */
+    QOS_ADM_REJECT,             /* At the limit */
+    QOS_ADM_SHADOW_ADMIT        /* At the limit, admitted by shadow mode */
+} QoSAdmDecision;
+
+/*
+ * Most restrictive of two limits; a negative value means unset
+ */
+static inline int64_t
+qos_adm_pick_min(int64_t a, int64_t b)
+{
+    if (a >= 0 && b >= 0)
+        return (a < b) ? a : b;
+    return (a >= 0) ? a : b;
+}
+
+/* Limit merging across the role, database and role-in-database scopes */
+extern int64_t qos_adm_merge_limit(int64_t role, int64_t database, int64_t role_database);
+extern int qos_adm_merge_mode(int role, int database, int role_database);
+
+/* Decide whether one more unit fits next to "active" others */
+extern QoSAdmDecision qos_adm_decide(int active, int limit, int mode);
+
+/* CPU core selection from per-core cycle samples (-1 = not measured) */
+extern int qos_adm_select_cores(const int64_t *cycles, int total_cores, int requested,
+                                int *order, int *selected);
+extern int qos_adm_round_robin_cores(int start_core, int total_cores, int requested,
+                                     int *selected);
+
+#endif /* QOS_ADMISSION_H */
@@ -0,0 +1,266 @@
+/*
+ * cpumap.c - Per-CPU load and tenant placement
+ *
+ * This file implements qos_get_cpu_map(), which lists every online CPU with
+ * its last perf load sample, the tenants whose cpu_core_limit pinned them
+ * to it, the number of their backends, and its NUMA node and last-level
+ * cache as reported by Linux sysfs.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "stats.h"
+#include "catalog/pg_type.h"
+#include "storage/fd.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <unistd.h>
+
+#define QOS_CPU_MAP_COLS 8
+
+#ifdef __linux__
+#define QOS_SYSFS_CPU_DIR "/sys/devices/system/cpu"
+#define QOS_SYSFS_MAX_CACHE_INDEX 16
+
+static bool qos_read_sysfs_int(const char *path, int *value);
+static int qos_cpu_numa_node(int cpu);
+static int qos_cpu_llc_id(int cpu);
+#endif
+
+PG_FUNCTION_INFO_V1(qos_get_cpu_map);
+
+#ifdef __linux__
+/*
+ * Read the leading integer of a sysfs file (e.g. "3" or "0-7,16-23")
+ */
+static bool
+qos_read_sysfs_int(const char *path, int *value)
+{
+    FILE *file;
+    bool ok;
+
+    file = AllocateFile(path, "r");
+    if (file == NULL)
+        return false;
+
+    ok = (fscanf(file, "%d", value) == 1);
+    FreeFile(file);
+
+    return ok;
+}
+
+/*
+ * NUMA node of a CPU: sysfs links it as cpuN/nodeM. Returns -1 if unknown.
+ */
+static int
+qos_cpu_numa_node(int cpu)
+{
+    char path[MAXPGPATH];
+    DIR *dir;
+    struct dirent *de;
+    int node = -1;
+
+    snprintf(path, sizeof(path), QOS_SYSFS_CPU_DIR "/cpu%d", cpu);
+    dir = AllocateDir(path);
+
+    while ((de = ReadDirExtended(dir, path, DEBUG1)) != NULL)
+    {
+        if (strncmp(de->d_name, "node", 4) == 0 &&
+            sscanf(de->d_name + 4, "%d", &node) == 1)
+            break;
+        node = -1;
+    }
+
+    if (dir)
+        FreeDir(dir);
+
+    return node;
+}
+
+/*
+ * Last-level cache of a CPU: the highest cache level's "id", or the first
+ * CPU sharing it on kernels without cache ids. Returns -1 if unknown.
+ */
+static int
+qos_cpu_llc_id(int cpu)
+{
+    char path[MAXPGPATH];
+    int best_index = -1;
+    int best_level = -1;
+    int index;
+    int id;
+
+    for (index = 0; index < QOS_SYSFS_MAX_CACHE_INDEX; index++)
+    {
+        int level;
+
+        snprintf(path, sizeof(path), QOS_SYSFS_CPU_DIR "/cpu%d/cache/index%d/level",
+                 cpu, index);
+        if (!qos_read_sysfs_int(path, &level))
+            break;
+        if (level > best_level)
+        {
+            best_level = level;
+            best_index = index;
+        }
+    }
+
+    if (best_index < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), QOS_SYSFS_CPU_DIR "/cpu%d/cache/index%d/id",
+             cpu, best_index);
+    if (qos_read_sysfs_int(path, &id))
+        return id;
+
+    snprintf(path, sizeof(path), QOS_SYSFS_CPU_DIR "/cpu%d/cache/index%d/shared_cpu_list",
+             cpu, best_index);
+    if (qos_read_sysfs_int(path, &id))
+        return id;
+
+    return -1;
+}
+#endif /* __linux__ */
+
+/*
+ * qos_get_cpu_map() - one row per online CPU
+ *
+ * affinity_entries[] and backend_status[] are copied under a shared lock;
+ * load samples are read lock-free.
+ */
+Datum
+qos_get_cpu_map(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    QoSBackendStatus *backends;
+    QoSAffinityEntry *affinity;
+    Datum *role_datums;
+    Datum *db_datums;
+    long total_cpus;
+    int max_backends;
+    int cpu;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state)
+        return (Datum) 0;
+
+    total_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (total_cpus <= 0)
+        total_cpus = 1;
+    if (total_cpus > QOS_MAX_CPUS)
+        total_cpus = QOS_MAX_CPUS;
+
+    max_backends = qos_shared_state->max_backends;
+    backends = palloc(mul_size(max_backends, sizeof(QoSBackendStatus)));
+    affinity = palloc(sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+    role_datums = palloc(sizeof(Datum) * MAX_AFFINITY_ENTRIES);
+    db_datums = palloc(sizeof(Datum) * MAX_AFFINITY_ENTRIES);
+
+    qos_lock_acquire(LW_SHARED);
+    memcpy(backends, qos_shared_state->backend_status,
+           mul_size(max_backends, sizeof(QoSBackendStatus)));
+    memcpy(affinity, qos_shared_state->affinity_entries,
+           sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+    LWLockRelease(qos_shared_state->lock);
+
+    for (cpu = 0; cpu < total_cpus; cpu++)
+    {
+        Datum values[QOS_CPU_MAP_COLS];
+        bool nulls[QOS_CPU_MAP_COLS];
+        TimestampTz sample_time;
+        int ntenants = 0;
+        int nbackends = 0;
+        int i;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        /* Tenants pinned to this CPU and their backends */
+        for (i = 0; i < MAX_AFFINITY_ENTRIES; i++)
+        {
+            QoSAffinityEntry *entry = &affinity[i];
+            int num_cores = Min(entry->num_cores, MAX_CORES_PER_ENTRY);
+            int j;
+
+            if (entry->database_oid == InvalidOid)
+                continue;
+
+            for (j = 0; j < num_cores; j++)
+            {
+                if (entry->assigned_cores[j] == cpu)
+                    break;
+            }
+            if (j == num_cores)
+                continue;
+
+            role_datums[ntenants] = ObjectIdGetDatum(entry->role_oid);
+            db_datums[ntenants] = ObjectIdGetDatum(entry->database_oid);
+            ntenants++;
+
+            for (j = 0; j < max_backends; j++)
+            {
+                if (backends[j].pid != 0 &&
+                    backends[j].role_oid == entry->role_oid &&
+                    backends[j].database_oid == entry->database_oid)
+                    nbackends++;
+            }
+        }
+
+        values[0] = Int32GetDatum(cpu);
+
+#ifdef __linux__
+        {
+            int numa_node = qos_cpu_numa_node(cpu);
+            int llc_id = qos_cpu_llc_id(cpu);
+
+            values[1] = Int32GetDatum(numa_node);
+            nulls[1] = (numa_node < 0);
+            values[2] = Int32GetDatum(llc_id);
+            nulls[2] = (llc_id < 0);
+        }
+#else
+        nulls[1] = true;
+        nulls[2] = true;
+#endif
+
+        sample_time = (TimestampTz) pg_atomic_read_u64(&qos_shared_state->cpu_samples[cpu].sample_time);
+        if (sample_time != 0)
+        {
+            values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&qos_shared_state->cpu_samples[cpu].cycles));
+            values[4] = TimestampTzGetDatum(sample_time);
+        }
+        else
+        {
+            nulls[3] = true;
+            nulls[4] = true;
+        }
+
+        values[5] = PointerGetDatum(construct_array(role_datums, ntenants, OIDOID,
+                                                    sizeof(Oid), true, TYPALIGN_INT));
+        values[6] = PointerGetDatum(construct_array(db_datums, ntenants, OIDOID,
+                                                    sizeof(Oid), true, TYPALIGN_INT));
+        values[7] = Int32GetDatum(nbackends);
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    pfree(backends);
+    pfree(affinity);
+    pfree(role_datums);
+    pfree(db_datums);
+
+    return (Datum) 0;
+}
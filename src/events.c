@@ -0,0 +1,260 @@
+/*
+ * events.c - Recent QoS enforcement events
+ *
+ * This file implements a fixed-size ring buffer in shared memory that
+ * records every rejection, throttle and cap (including the ones only
+ * reported in shadow mode), and the qos_recent_events() SQL function.
+ *
+ * Writers claim a slot with an atomic fetch-add and never take the qos
+ * lock. Each slot carries a sequence number that a writer swaps to "busy"
+ * before filling the slot, so a reader that races with a writer skips the
+ * entry instead of returning a mix of two events. Two writers whose claims
+ * are a multiple of the ring size apart can target the same slot at once;
+ * the swap lets only one of them write it.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "events.h"
+#include "stats.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/backend_status.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#define QOS_EVENTS_COLS 10
+
+/* seq of a slot that a writer is filling */
+#define QOS_EVENT_SEQ_BUSY  PG_UINT64_MAX
+
+QoSEventRing *qos_event_ring = NULL;
+
+static const char *const qos_event_action_names[QOS_EVENT_ACTION_COUNT] = {
+    "reject",
+    "throttle",
+    "cap",
+    "terminate"
+};
+
+static const char *const qos_event_limit_names[QOS_LIMIT_COUNT] = {
+    "max_concurrent_select",
+    "max_concurrent_update",
+    "max_concurrent_delete",
+    "max_concurrent_insert",
+    "max_concurrent_tx",
+    "work_mem_limit",
+    "cpu_core_limit",
+    "query_max_concurrent"
+};
+
+PG_FUNCTION_INFO_V1(qos_recent_events);
+
+/*
+ * Shared memory needed for the event ring
+ */
+Size
+qos_events_shmem_size(void)
+{
+    Size size;
+
+    size = offsetof(QoSEventRing, events);
+    size = add_size(size, mul_size(qos_event_buffer_size, sizeof(QoSEvent)));
+
+    return MAXALIGN(size);
+}
+
+/*
+ * Initialize the event ring (caller holds AddinShmemInitLock)
+ */
+void
+qos_events_shmem_init(void)
+{
+    bool found;
+    Size size = qos_events_shmem_size();
+    int i;
+
+    qos_event_ring = ShmemInitStruct("qos_event_ring", size, &found);
+
+    if (!found)
+    {
+        memset(qos_event_ring, 0, size);
+        qos_event_ring->size = qos_event_buffer_size;
+        pg_atomic_init_u64(&qos_event_ring->next, 0);
+        for (i = 0; i < qos_event_ring->size; i++)
+            pg_atomic_init_u64(&qos_event_ring->events[i].seq, 0);
+    }
+}
+
+/*
+ * Record an enforcement event for the current backend (lock-free)
+ */
+void
+qos_event_record(QoSEventAction action, QoSEventLimit limit,
+                 int64 observed, int64 limit_value, bool shadow)
+{
+    qos_event_record_backend(action, limit, MyProcPid, GetUserId(), MyDatabaseId,
+                             (int64) pgstat_get_my_query_id(),
+                             observed, limit_value, shadow);
+}
+
+/*
+ * Record an enforcement event that concerns another backend, e.g. the one
+ * terminated by qos.idle_tx_slot_policy (lock-free)
+ *
+ * The slot is taken over only if it is not being written and holds an
+ * older event. Otherwise this event is dropped: another writer is still
+ * filling the slot (more concurrent writers than qos.event_buffer_size),
+ * or a writer a full lap ahead has already stored a newer event there.
+ */
+void
+qos_event_record_backend(QoSEventAction action, QoSEventLimit limit,
+                         int pid, Oid role_oid, Oid database_oid, int64 query_id,
+                         int64 observed, int64 limit_value, bool shadow)
+{
+    QoSEvent *event;
+    uint64 claim;
+    uint64 seq;
+
+    if (!qos_event_ring)
+        return;
+
+    claim = pg_atomic_fetch_add_u64(&qos_event_ring->next, 1);
+    event = &qos_event_ring->events[claim % qos_event_ring->size];
+
+    /* Mark the slot busy before overwriting it */
+    seq = pg_atomic_read_u64(&event->seq);
+    do
+    {
+        if (seq == QOS_EVENT_SEQ_BUSY || seq > claim)
+            return;
+    } while (!pg_atomic_compare_exchange_u64(&event->seq, &seq, QOS_EVENT_SEQ_BUSY));
+
+    event->event_time = GetCurrentTimestamp();
+    event->pid = pid;
+    event->role_oid = role_oid;
+    event->database_oid = database_oid;
+    event->action = (uint8) action;
+    event->limit_type = (uint8) limit;
+    event->shadow = shadow;
+    event->observed = observed;
+    event->limit_value = limit_value;
+    event->query_id = query_id;
+
+    pg_write_barrier();
+    pg_atomic_write_u64(&event->seq, claim + 1);
+}
+
+QoSEventLimit
+qos_event_limit_for_cmd(CmdType operation)
+{
+    switch (operation)
+    {
+        case CMD_UPDATE: return QOS_LIMIT_MAX_CONCURRENT_UPDATE;
+        case CMD_DELETE: return QOS_LIMIT_MAX_CONCURRENT_DELETE;
+        case CMD_INSERT: return QOS_LIMIT_MAX_CONCURRENT_INSERT;
+        default:         return QOS_LIMIT_MAX_CONCURRENT_SELECT;
+    }
+}
+
+const char *
+qos_event_limit_name(QoSEventLimit limit)
+{
+    if ((int) limit < 0 || limit >= QOS_LIMIT_COUNT)
+        return "unknown";
+    return qos_event_limit_names[limit];
+}
+
+/*
+ * qos_recent_events() - events still in the ring, oldest first
+ *
+ * Slots that are being written, or were overwritten while being copied,
+ * are skipped.
+ */
+Datum
+qos_recent_events(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    uint64 next;
+    uint64 claim;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_event_ring)
+        return (Datum) 0;
+
+    next = pg_atomic_read_u64(&qos_event_ring->next);
+    claim = (next > (uint64) qos_event_ring->size) ? next - qos_event_ring->size : 0;
+
+    for (; claim < next; claim++)
+    {
+        QoSEvent *event = &qos_event_ring->events[claim % qos_event_ring->size];
+        Datum values[QOS_EVENTS_COLS];
+        bool nulls[QOS_EVENTS_COLS];
+        TimestampTz event_time;
+        int pid;
+        Oid role_oid;
+        Oid database_oid;
+        uint8 action;
+        uint8 limit_type;
+        bool shadow;
+        int64 observed;
+        int64 limit_value;
+        int64 query_id;
+
+        if (pg_atomic_read_u64(&event->seq) != claim + 1)
+            continue;
+        pg_read_barrier();
+
+        event_time = event->event_time;
+        pid = event->pid;
+        role_oid = event->role_oid;
+        database_oid = event->database_oid;
+        action = event->action;
+        limit_type = event->limit_type;
+        shadow = event->shadow;
+        observed = event->observed;
+        limit_value = event->limit_value;
+        query_id = event->query_id;
+
+        /* Overwritten while copying? */
+        pg_read_barrier();
+        if (pg_atomic_read_u64(&event->seq) != claim + 1)
+            continue;
+
+        if (action >= QOS_EVENT_ACTION_COUNT)
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = TimestampTzGetDatum(event_time);
+        values[1] = Int32GetDatum(pid);
+        values[2] = ObjectIdGetDatum(role_oid);
+        values[3] = ObjectIdGetDatum(database_oid);
+        values[4] = CStringGetTextDatum(qos_event_action_names[action]);
+        values[5] = CStringGetTextDatum(qos_event_limit_name((QoSEventLimit) limit_type));
+        values[6] = Int64GetDatum(observed);
+        values[7] = Int64GetDatum(limit_value);
+        if (query_id != 0)
+            values[8] = Int64GetDatum(query_id);
+        else
+            nulls[8] = true;
+        values[9] = BoolGetDatum(shadow);
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * events.h - PostgreSQL Quality of Service (QoS) Extension Event Ring
+ *
+ * This header file contains the declarations for the shared-memory ring
+ * buffer of recent enforcement events (rejections, throttles and caps).
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_EVENTS_H
+#define QOS_EVENTS_H
+
+#include "postgres.h"
+#include "nodes/nodes.h"
+#include "qos.h"
+
+/* Shared memory setup (called from qos.c shmem hooks) */
+extern Size qos_events_shmem_size(void);
+extern void qos_events_shmem_init(void);
+
+/* Record an event for the current backend, role and database (lock-free) */
+extern void qos_event_record(QoSEventAction action, QoSEventLimit limit,
+                             int64 observed, int64 limit_value, bool shadow);
+
+/* Record an event on behalf of another backend (lock-free) */
+extern void qos_event_record_backend(QoSEventAction action, QoSEventLimit limit,
+                                     int pid, Oid role_oid, Oid database_oid,
+                                     int64 query_id, int64 observed,
+                                     int64 limit_value, bool shadow);
+
+/* Map a CmdType to its max_concurrent_* limit */
+extern QoSEventLimit qos_event_limit_for_cmd(CmdType operation);
+
+/* GUC-style name of a limit, e.g. "max_concurrent_select" */
+extern const char *qos_event_limit_name(QoSEventLimit limit);
+
+#endif /* QOS_EVENTS_H */
@@ -0,0 +1,488 @@
+/*
+ * history.c - Per-tenant statistics history
+ *
+ * This file implements the qos history background worker and the
+ * qos_stats_history() SQL function. Every qos.history_interval seconds the
+ * worker reads the tenant counters, and adds how much each one grew since
+ * the previous sample to the current one-minute and one-hour buckets. The
+ * last hour is kept at one-minute and the last week at one-hour
+ * granularity, so trends are available without an external poller.
+ *
+ * Buckets have their own lock; the worker holds the qos lock only in
+ * shared mode while copying the counters.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "history.h"
+#include "stats.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#define QOS_HISTORY_COLS 12
+
+/* Shared history: lock, then QOS_HISTORY_MINUTES + QOS_HISTORY_HOURS buckets */
+typedef struct QoSHistoryShared
+{
+    LWLock     *lock;
+    int         rows_per_bucket;    /* qos.max_tenants + 1 */
+    char        buckets[FLEXIBLE_ARRAY_MEMBER];
+} QoSHistoryShared;
+
+/* Counter values of one tenant entry, as last seen by the worker */
+typedef struct QoSHistorySample
+{
+    Oid     role_oid;
+    Oid     database_oid;
+    bool    in_use;
+    uint64  values[QOS_HISTORY_VALUE_COUNT];
+} QoSHistorySample;
+
+static QoSHistoryShared *qos_history = NULL;
+
+PG_FUNCTION_INFO_V1(qos_stats_history);
+
+static Size
+qos_history_bucket_size(int rows)
+{
+    return MAXALIGN(add_size(offsetof(QoSHistoryBucket, rows),
+                             mul_size(rows, sizeof(QoSHistoryRow))));
+}
+
+/* Bucket i; minute buckets come first, then hour buckets */
+static QoSHistoryBucket *
+qos_history_bucket(int i)
+{
+    return (QoSHistoryBucket *) (qos_history->buckets +
+                                 i * qos_history_bucket_size(qos_history->rows_per_bucket));
+}
+
+/*
+ * Shared memory needed for the history (none when the worker is disabled)
+ */
+Size
+qos_history_shmem_size(void)
+{
+    Size size;
+
+    if (qos_history_interval <= 0)
+        return 0;
+
+    size = offsetof(QoSHistoryShared, buckets);
+    size = add_size(size, mul_size(QOS_HISTORY_BUCKETS,
+                                   qos_history_bucket_size(qos_max_tenants + 1)));
+
+    return MAXALIGN(size);
+}
+
+void
+qos_history_shmem_request(void)
+{
+    if (qos_history_interval <= 0)
+        return;
+
+    RequestAddinShmemSpace(qos_history_shmem_size());
+    RequestNamedLWLockTranche("qos_history", 1);
+}
+
+/*
+ * Initialize the history buckets (caller holds AddinShmemInitLock)
+ */
+void
+qos_history_shmem_init(void)
+{
+    bool found;
+    Size size = qos_history_shmem_size();
+
+    if (size == 0)
+        return;
+
+    qos_history = ShmemInitStruct("qos_history", size, &found);
+
+    if (!found)
+    {
+        memset(qos_history, 0, size);
+        qos_history->lock = &(GetNamedLWLockTranche("qos_history")->lock);
+        qos_history->rows_per_bucket = qos_max_tenants + 1;
+    }
+}
+
+/*
+ * Register the history worker when qos.history_interval > 0
+ */
+void
+qos_history_register_worker(void)
+{
+    BackgroundWorker worker;
+
+    if (qos_history_interval <= 0)
+        return;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    worker.bgw_start_time = BgWorkerStart_ConsistentState;
+    worker.bgw_restart_time = 10;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "qos");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "qos_history_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "qos history");
+    snprintf(worker.bgw_type, BGW_MAXLEN, "qos history");
+
+    RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Read the counters history keeps from one tenant entry
+ */
+static void
+qos_history_read_entry(QoSTenantEntry *entry, QoSHistorySample *sample)
+{
+    uint64 admitted = 0;
+    uint64 rejected = 0;
+    uint64 throttled = 0;
+    int cmd;
+
+    for (cmd = 0; cmd < QOS_CMD_COUNT; cmd++)
+    {
+        admitted += qos_stats_read(entry->stats.admitted[cmd]);
+        rejected += qos_stats_read(entry->stats.rejected[cmd]);
+        throttled += qos_stats_read(entry->stats.throttled[cmd]);
+    }
+
+    sample->role_oid = entry->role_oid;
+    sample->database_oid = entry->database_oid;
+    sample->in_use = entry->in_use;
+    sample->values[QOS_HISTORY_ADMITTED] = admitted;
+    sample->values[QOS_HISTORY_REJECTED] = rejected;
+    sample->values[QOS_HISTORY_THROTTLED] = throttled;
+    sample->values[QOS_HISTORY_TX_ADMITTED] = qos_stats_read(entry->stats.tx_admitted);
+    sample->values[QOS_HISTORY_TX_REJECTED] = qos_stats_read(entry->stats.tx_rejected);
+    sample->values[QOS_HISTORY_WORK_MEM_CAPS] = qos_stats_read(entry->stats.work_mem_caps);
+    sample->values[QOS_HISTORY_STATEMENTS] = qos_stats_read(entry->usage.statements);
+    sample->values[QOS_HISTORY_EXEC_TIME_US] = qos_stats_read(entry->usage.exec_time_us);
+    sample->values[QOS_HISTORY_CPU_TIME_US] = qos_stats_read(entry->usage.cpu_user_us) +
+                                             qos_stats_read(entry->usage.cpu_system_us);
+}
+
+/*
+ * Add a tenant's deltas to a bucket, starting the bucket over if it still
+ * holds an older minute/hour (caller holds the history lock exclusively)
+ */
+static void
+qos_history_add(QoSHistoryBucket *bucket, TimestampTz start, int hint,
+                const QoSHistorySample *sample, const uint64 *delta)
+{
+    QoSHistoryRow *row = NULL;
+    int i;
+
+    if (bucket->start != start)
+    {
+        memset(bucket->rows, 0, mul_size(qos_history->rows_per_bucket, sizeof(QoSHistoryRow)));
+        bucket->start = start;
+        bucket->num_rows = 0;
+    }
+
+    /* The tenant usually keeps its table index, so try that row first */
+    if (hint < bucket->num_rows && bucket->rows[hint].in_use &&
+        bucket->rows[hint].role_oid == sample->role_oid &&
+        bucket->rows[hint].database_oid == sample->database_oid)
+        row = &bucket->rows[hint];
+
+    for (i = 0; row == NULL && i < bucket->num_rows; i++)
+    {
+        if (bucket->rows[i].role_oid == sample->role_oid &&
+            bucket->rows[i].database_oid == sample->database_oid)
+            row = &bucket->rows[i];
+    }
+
+    if (row == NULL)
+    {
+        if (bucket->num_rows >= qos_history->rows_per_bucket)
+            return;
+        row = &bucket->rows[bucket->num_rows++];
+        row->role_oid = sample->role_oid;
+        row->database_oid = sample->database_oid;
+        row->in_use = true;
+    }
+
+    for (i = 0; i < QOS_HISTORY_VALUE_COUNT; i++)
+        row->values[i] += delta[i];
+}
+
+/*
+ * Take one sample and fold the deltas since the previous one into the
+ * current minute and hour buckets.
+ *
+ * prev has qos.max_tenants + 1 entries and is indexed like the tenant
+ * table; a reset (new generation) or a different tenant at an index
+ * restarts that entry's counters from zero.
+ */
+static void
+qos_history_sample(QoSHistorySample *prev, uint32 *prev_generation, bool baseline)
+{
+    QoSTenantTable *table = qos_tenant_table;
+    QoSHistorySample *cur;
+    TimestampTz now;
+    TimestampTz minute_start;
+    TimestampTz hour_start;
+    QoSHistoryBucket *minute_bucket;
+    QoSHistoryBucket *hour_bucket;
+    uint32 generation;
+    int max_tenants = table->max_tenants;
+    int num_tenants;
+    int i;
+
+    cur = palloc0(sizeof(QoSHistorySample) * (max_tenants + 1));
+
+    qos_lock_acquire(LW_SHARED);
+    generation = table->generation;
+    num_tenants = table->num_tenants;
+    for (i = 0; i < num_tenants; i++)
+        qos_history_read_entry(&table->entries[i], &cur[i]);
+    qos_history_read_entry(&table->entries[max_tenants], &cur[max_tenants]);
+    LWLockRelease(qos_shared_state->lock);
+
+    now = GetCurrentTimestamp();
+    minute_start = now - now % USECS_PER_MINUTE;
+    hour_start = now - now % USECS_PER_HOUR;
+
+    if (!baseline)
+    {
+        minute_bucket = qos_history_bucket((int) ((minute_start / USECS_PER_MINUTE) % QOS_HISTORY_MINUTES));
+        hour_bucket = qos_history_bucket(QOS_HISTORY_MINUTES +
+                                         (int) ((hour_start / USECS_PER_HOUR) % QOS_HISTORY_HOURS));
+
+        LWLockAcquire(qos_history->lock, LW_EXCLUSIVE);
+
+        for (i = 0; i <= max_tenants; i++)
+        {
+            uint64 delta[QOS_HISTORY_VALUE_COUNT];
+            bool same;
+            bool any = false;
+            int v;
+
+            if (!cur[i].in_use)
+                continue;
+
+            same = (*prev_generation == generation && prev[i].in_use &&
+                    prev[i].role_oid == cur[i].role_oid &&
+                    prev[i].database_oid == cur[i].database_oid);
+
+            for (v = 0; v < QOS_HISTORY_VALUE_COUNT; v++)
+            {
+                if (same && cur[i].values[v] >= prev[i].values[v])
+                    delta[v] = cur[i].values[v] - prev[i].values[v];
+                else
+                    delta[v] = cur[i].values[v];
+                if (delta[v] != 0)
+                    any = true;
+            }
+
+            if (!any)
+                continue;
+
+            qos_history_add(minute_bucket, minute_start, i, &cur[i], delta);
+            qos_history_add(hour_bucket, hour_start, i, &cur[i], delta);
+        }
+
+        LWLockRelease(qos_history->lock);
+    }
+
+    memcpy(prev, cur, sizeof(QoSHistorySample) * (max_tenants + 1));
+    *prev_generation = generation;
+    pfree(cur);
+}
+
+/*
+ * History worker main loop
+ *
+ * The first sample after (re)start is only a baseline: the counters may
+ * have been restored from the stats file, and their growth before this
+ * point can't be attributed to a bucket.
+ */
+void
+qos_history_main(Datum main_arg)
+{
+    QoSHistorySample *prev;
+    uint32 prev_generation = 0;
+    bool baseline = true;
+
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+    BackgroundWorkerUnblockSignals();
+
+    if (!qos_history || !qos_tenant_table || !qos_shared_state)
+        proc_exit(0);
+
+    prev = palloc0(sizeof(QoSHistorySample) * (qos_tenant_table->max_tenants + 1));
+
+    elog(LOG, "qos: history worker started (interval=%ds)", qos_history_interval);
+
+    while (!ShutdownRequestPending)
+    {
+        if (ConfigReloadPending)
+        {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        qos_history_sample(prev, &prev_generation, baseline);
+        baseline = false;
+
+        (void) WaitLatch(MyLatch,
+                         WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                         qos_history_interval * 1000L,
+                         qos_wait_event(QOS_WAIT_HISTORY_MAIN));
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    proc_exit(0);
+}
+
+static int
+qos_history_bucket_cmp(const void *a, const void *b)
+{
+    TimestampTz ta = (*(QoSHistoryBucket *const *) a)->start;
+    TimestampTz tb = (*(QoSHistoryBucket *const *) b)->start;
+
+    if (ta < tb)
+        return -1;
+    return (ta > tb) ? 1 : 0;
+}
+
+/*
+ * qos_stats_history(tenant, since, granularity) - rollups, oldest first
+ *
+ * tenant (a role) and since are optional; granularity is 'minute' (last
+ * hour) or 'hour' (last week). The current bucket is still filling.
+ */
+Datum
+qos_stats_history(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    Oid role_filter = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+    TimestampTz since = PG_ARGISNULL(1) ? 0 : PG_GETARG_TIMESTAMPTZ(1);
+    char *granularity = PG_ARGISNULL(2) ? "minute" : text_to_cstring(PG_GETARG_TEXT_PP(2));
+    QoSHistoryBucket **buckets;
+    Size bucket_size;
+    int first;
+    int count;
+    int nbuckets = 0;
+    int64 width_us;
+    TimestampTz oldest;
+    int i;
+    int r;
+
+    if (strcmp(granularity, "minute") == 0)
+    {
+        first = 0;
+        count = QOS_HISTORY_MINUTES;
+        width_us = USECS_PER_MINUTE;
+    }
+    else if (strcmp(granularity, "hour") == 0)
+    {
+        first = QOS_HISTORY_MINUTES;
+        count = QOS_HISTORY_HOURS;
+        width_us = USECS_PER_HOUR;
+    }
+    else
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("qos: invalid history granularity \"%s\"", granularity),
+                 errhint("Valid values: minute, hour")));
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_history)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("qos: statistics history is disabled"),
+                 errhint("Set qos.history_interval > 0 and restart the server.")));
+
+    /* A slot with no activity since it last wrapped holds an expired bucket */
+    oldest = GetCurrentTimestamp() - count * width_us;
+    if (since < oldest)
+        since = oldest;
+
+    /* Copy the matching buckets so formatting happens without the lock */
+    bucket_size = qos_history_bucket_size(qos_history->rows_per_bucket);
+    buckets = palloc(sizeof(QoSHistoryBucket *) * count);
+
+    LWLockAcquire(qos_history->lock, LW_SHARED);
+    for (i = first; i < first + count; i++)
+    {
+        QoSHistoryBucket *bucket = qos_history_bucket(i);
+
+        if (bucket->start == 0 || bucket->num_rows == 0)
+            continue;
+        if (bucket->start + width_us <= since)
+            continue;
+
+        buckets[nbuckets] = palloc(bucket_size);
+        memcpy(buckets[nbuckets], bucket,
+               offsetof(QoSHistoryBucket, rows) + bucket->num_rows * sizeof(QoSHistoryRow));
+        nbuckets++;
+    }
+    LWLockRelease(qos_history->lock);
+
+    qsort(buckets, nbuckets, sizeof(QoSHistoryBucket *), qos_history_bucket_cmp);
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        for (r = 0; r < buckets[i]->num_rows; r++)
+        {
+            QoSHistoryRow *row = &buckets[i]->rows[r];
+            Datum values[QOS_HISTORY_COLS];
+            bool nulls[QOS_HISTORY_COLS];
+            int v;
+
+            if (!row->in_use)
+                continue;
+            if (OidIsValid(role_filter) && row->role_oid != role_filter)
+                continue;
+
+            memset(nulls, 0, sizeof(nulls));
+
+            values[0] = TimestampTzGetDatum(buckets[i]->start);
+            if (OidIsValid(row->role_oid))
+            {
+                values[1] = ObjectIdGetDatum(row->role_oid);
+                values[2] = ObjectIdGetDatum(row->database_oid);
+            }
+            else
+            {
+                /* Overflow entry has no owner */
+                nulls[1] = true;
+                nulls[2] = true;
+            }
+
+            for (v = 0; v < QOS_HISTORY_VALUE_COUNT; v++)
+                values[3 + v] = Int64GetDatum((int64) row->values[v]);
+
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        }
+    }
+
+    return (Datum) 0;
+}
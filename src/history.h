@@ -0,0 +1,34 @@
+/*
+ * history.h - PostgreSQL Quality of Service (QoS) Extension Statistics History
+ *
+ * This header file contains the declarations for the background worker
+ * that keeps per-tenant statistics rollups in shared memory.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_HISTORY_H
+#define QOS_HISTORY_H
+
+#include "postgres.h"
+#include "qos.h"
+
+/* Shared memory setup (called from qos.c shmem hooks) */
+extern Size qos_history_shmem_size(void);
+extern void qos_history_shmem_request(void);
+extern void qos_history_shmem_init(void);
+
+/* Register the history worker (from _PG_init) */
+extern void qos_history_register_worker(void);
+
+/* Worker entry point */
+extern PGDLLEXPORT void qos_history_main(Datum main_arg);
+
+#endif /* QOS_HISTORY_H */
@@ -22,9 +22,16 @@
 #include "qos.h"
 #include "hooks.h"
 #include "hooks_internal.h"
+#include "stats.h"
+#include "events.h"
+#include "usage.h"
+#include "hwcounters.h"
+#include "queries.h"
 #include "miscadmin.h"
 #include "tcop/utility.h"
 #include "executor/executor.h"
+#include "executor/instrument.h"
+#include "portability/instr_time.h"
 #include "nodes/parsenodes.h"
 #include "optimizer/planner.h"
 #include "commands/defrem.h"
@@ -33,6 +40,8 @@
 #include "parser/parse_node.h"
 #include "nodes/value.h"
 #include "storage/ipc.h"
+#include "tcop/tcopprot.h"
+#include "utils/timestamp.h"
 #include <ctype.h>
 #include <signal.h>
 #include <errno.h>
@@ -40,12 +49,46 @@
 /* Hook save variables */
 static ProcessUtility_hook_type prev_ProcessUtility = NULL;
 static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
 static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
 static planner_hook_type prev_planner_hook = NULL;
 
 /* Flag to suppress concurrency tracking in planner (for EXPLAIN/PREPARE) */
 static bool suppress_concurrency_tracking = false;
 
+/*
+ * Planner/executor/utility nesting depth (as in pg_stat_statements); the
+ * client's own statements run at level 0
+ */
+static int nesting_level = 0;
+
+/*
+ * Nesting level whose statements are admitted. It is 0 except while a
+ * utility run at that level runs statements for the client (CALL/DO
+ * bodies, EXECUTE, EXPLAIN ANALYZE, CREATE TABLE AS, DECLARE CURSOR, COPY
+ * of a query): those share the statement slot of the first one, which the
+ * top-level utility gives back when it returns. Statements run by any other
+ * utility (triggers fired by COPY FROM, functions run by CREATE INDEX or
+ * ANALYZE) are nested and hold no slot.
+ */
+static int statement_level = 0;
+
+/*
+ * The running top-level statement's plan had its parallel workers reduced.
+ * Taken at ExecutorStart: statements planned while it runs (functions)
+ * replace the last plan adjustment before ExecutorEnd.
+ */
+static bool statement_throttled = false;
+
+/* Duration of the admission that gave this backend its statement slot */
+static int64 last_admission_us = -1;
+
+/* This backend's idle_tx_since is set */
+static bool idle_tx_marked = false;
+
+static void qos_admit_statement(CmdType operation, int64 query_id);
+static void qos_set_idle_in_transaction(bool idle);
 static void qos_validate_qos_setstmt(VariableSetStmt *stmt);
 static char *qos_normalize_work_mem_value(const char *value_str);
 #if PG_VERSION_NUM >= 170000
@@ -69,7 +112,7 @@ qos_get_backend_slot(bool allocate_if_missing)
     if (slot >= 0 && qos_shared_state->backend_status[slot].pid == MyProcPid)
         return slot;
 
-    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+    qos_lock_acquire(LW_EXCLUSIVE);
 
     slot = qos_backend_slot;
     if (slot >= 0 && qos_shared_state->backend_status[slot].pid == MyProcPid)
@@ -139,6 +182,55 @@ qos_reset_backend_slot(void)
 }
 #endif /* MyBackendId */
 
+/*
+ * Return this backend's backend_status entry, or NULL if it has none.
+ * Version-independent wrapper over the slot lookup above.
+ */
+QoSBackendStatus *
+qos_my_backend_status(bool allocate_if_missing)
+{
+#ifndef MyBackendId
+    int slot;
+#endif
+
+    if (!qos_shared_state)
+        return NULL;
+
+#ifndef MyBackendId
+    slot = qos_get_backend_slot(allocate_if_missing);
+    if (slot < 0)
+        return NULL;
+    return &qos_shared_state->backend_status[slot];
+#else
+    if (MyBackendId <= 0 || MyBackendId > qos_shared_state->max_backends)
+        return NULL;
+    if (!allocate_if_missing &&
+        qos_shared_state->backend_status[MyBackendId - 1].pid != MyProcPid)
+        return NULL;
+    return &qos_shared_state->backend_status[MyBackendId - 1];
+#endif
+}
+
+/*
+ * Report a limit violation that qos.enforcement = shadow let through: it is
+ * added to the event ring and logged. The statement text goes into the
+ * detail because LOG messages are below the default log_min_error_statement.
+ */
+void
+qos_log_shadow_violation(QoSEventAction action, QoSEventLimit limit,
+                         int64 current, int64 limit_value)
+{
+    qos_event_record(action, limit, current, limit_value, true);
+
+    ereport(LOG,
+            (errmsg("qos: shadow mode: %s would have been exceeded",
+                    qos_event_limit_name(limit)),
+             errdetail("Current: " INT64_FORMAT ", Maximum: " INT64_FORMAT
+                       ", role: %u, database: %u, statement: %s",
+                       current, limit_value, GetUserId(), MyDatabaseId,
+                       debug_query_string ? debug_query_string : "<unknown>")));
+}
+
 /*
  * Shared memory exit callback - clean up backend slot when process exits.
  *
@@ -156,7 +248,7 @@ qos_shmem_exit_cleanup(int code, Datum arg)
     if (!qos_shared_state)
         return;
 
-    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+    qos_lock_acquire(LW_EXCLUSIVE);
 
 #ifndef MyBackendId
     /* PG 17+: use cached slot index or fall back to PID scan */
@@ -194,30 +286,155 @@ qos_shmem_exit_cleanup(int code, Datum arg)
 }
 
 /*
- * Transaction callback to handle cleanup on abort/error
+ * Transaction callback - ends transaction tracking and cleans up on abort
  */
 static void
 qos_xact_callback(XactEvent event, void *arg)
 {
-    /* 
-     * If transaction aborts (error, cancel, disconnect), 
-     * ensure we decrement counters if they were tracked.
-     * ExecutorEnd is not called on error, so we need this safety net.
-     */
-    if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    switch (event)
     {
-        elog(DEBUG3, "qos: transaction callback called on abort, cleaning up concurrency tracking");
-        qos_track_statement_end();
-        qos_track_transaction_end();
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_PARALLEL_COMMIT:
+        case XACT_EVENT_PREPARE:
+            /*
+             * The transaction slot is held from the first admitted statement
+             * until here, so max_concurrent_tx counts transactions and a
+             * transaction block registers once however many statements it has.
+             * A prepared transaction no longer belongs to this backend.
+             */
+            qos_track_transaction_end();
+            break;
+
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+            /*
+             * If transaction aborts (error, cancel, disconnect),
+             * ensure we decrement counters if they were tracked.
+             * ExecutorEnd is not called on error, so we need this safety net.
+             */
+            elog(DEBUG3, "qos: transaction callback called on abort, cleaning up concurrency tracking");
+            qos_track_statement_end();
+            qos_track_transaction_end();
+            break;
+
+        default:
+            break;
     }
 }
 
+/*
+ * A top-level statement ended with a transaction block still open (idle), or
+ * a new one starts (busy). Only kept when qos.idle_tx_slot_policy needs it
+ * and this backend holds a transaction slot; written without the lock like
+ * the other per-backend fields, cleared under it at transaction end.
+ *
+ * Under terminate_after another backend may have picked this one to free
+ * its slot while it was idle (idle_tx_state = terminating). The slot is
+ * already gone and SIGTERM is on its way, so exit before running anything.
+ */
+static void
+qos_set_idle_in_transaction(bool idle)
+{
+    QoSBackendStatus *status;
+    uint32 state;
+
+    if (idle)
+    {
+        if (qos_idle_tx_slot_policy == QOS_IDLE_TX_COUNT || !IsTransactionBlock())
+            return;
+    }
+    else if (!idle_tx_marked)
+        return;
+
+    status = qos_my_backend_status(false);
+    if (status == NULL || (idle && !status->in_transaction))
+        return;
+
+    if (idle)
+    {
+        /* Only this backend moves the state away from busy */
+        if (pg_atomic_read_u32(&status->idle_tx_state) != QOS_IDLE_STATE_BUSY)
+            return;
+
+        /* Publish the time before the state that makes it a candidate */
+        status->idle_tx_since = GetCurrentTimestamp();
+        pg_write_barrier();
+        pg_atomic_write_u32(&status->idle_tx_state, QOS_IDLE_STATE_IDLE);
+    }
+    else
+    {
+        state = QOS_IDLE_STATE_IDLE;
+        if (!pg_atomic_compare_exchange_u32(&status->idle_tx_state, &state,
+                                            QOS_IDLE_STATE_BUSY) &&
+            state == QOS_IDLE_STATE_TERMINATING)
+            ereport(FATAL,
+                    (errcode(ERRCODE_IDLE_IN_TRANSACTION_SESSION_TIMEOUT),
+                     errmsg("qos: terminating connection due to idle-in-transaction timeout"),
+                     errdetail("The transaction slot was given to another transaction "
+                               "(qos.idle_tx_slot_policy = terminate_after).")));
+        status->idle_tx_since = 0;
+    }
+    idle_tx_marked = idle;
+}
+
+/*
+ * Run transaction and statement admission - delegates to hooks_transaction.c
+ * and hooks_statement.c. The transaction is admitted by its first statement
+ * only. When this call admits a new statement, its queryId limit is checked
+ * too, and the time spent (lock wait + slot scan) goes to the tenant's
+ * admission histogram.
+ */
+static void
+qos_admit_statement(CmdType operation, int64 query_id)
+{
+    instr_time start;
+    instr_time duration;
+    bool was_tracked = qos_statement_is_tracked();
+
+    INSTR_TIME_SET_CURRENT(start);
+
+    qos_set_idle_in_transaction(false);
+
+    /* Track transaction if not already tracked */
+    qos_track_transaction_start();
+    
+    /* Track statement-specific concurrency */
+    if (operation == CMD_SELECT || 
+        operation == CMD_UPDATE || 
+        operation == CMD_DELETE ||
+        operation == CMD_INSERT)
+    {
+        qos_track_statement_start(operation);
+    }
+
+    if (!was_tracked && qos_statement_is_tracked())
+    {
+        qos_track_query_start(query_id);
+
+        INSTR_TIME_SET_CURRENT(duration);
+        INSTR_TIME_SUBTRACT(duration, start);
+        last_admission_us = (int64) INSTR_TIME_GET_MICROSEC(duration);
+        qos_stats_record_latency(QOS_LATENCY_ADMISSION, (uint64) last_admission_us);
+    }
+}
+
+int64
+qos_last_admission_us(void)
+{
+    return qos_statement_is_tracked() ? last_admission_us : -1;
+}
+
 /*
  * Planner hook - delegates to hooks_resource.c for CPU limit enforcement
  */
 static PlannedStmt *
 qos_planner(Query *parse, const char *query_string, int cursorOptions, ParamListInfo boundParams)
 {
+    QoSOverheadTimer overhead;
+    PlannedStmt *result;
+
+    qos_overhead_start(&overhead);
+
     /* Enforce work_mem limit BEFORE query planning starts */
     if (qos_enabled)
     {
@@ -228,25 +445,31 @@ qos_planner(Query *parse, const char *query_string, int cursorOptions, ParamList
     /* 
      * Track concurrency limits BEFORE planning to avoid overhead of rejected queries.
      * We skip this for EXPLAIN (no analyze) and PREPARE to avoid leaking counts.
-     * EXECUTE statements will be caught by ExecutorStart hook.
+     * EXECUTE statements will be caught by ExecutorStart hook. Queries
+     * planned inside a running statement (functions) run under its slot.
      */
-    if (qos_enabled && !suppress_concurrency_tracking)
+    if (qos_enabled && !suppress_concurrency_tracking && nesting_level == statement_level)
+        qos_admit_statement(parse->commandType, (int64) parse->queryId);
+    
+    /*
+     * Delegate to hooks_resource.c for parallel worker adjustment. Planning
+     * may run functions (constant folding of immutable ones), whose
+     * statements must not be taken for top-level ones.
+     */
+    nesting_level++;
+    PG_TRY();
     {
-        /* Track transaction */
-        qos_track_transaction_start();
-        
-        /* Track statement */
-        if (parse->commandType == CMD_SELECT || 
-            parse->commandType == CMD_UPDATE || 
-            parse->commandType == CMD_DELETE || 
-            parse->commandType == CMD_INSERT)
-        {
-            qos_track_statement_start(parse->commandType);
-        }
+        result = qos_planner_hook(parse, query_string, cursorOptions, boundParams,
+                                  prev_planner_hook, &overhead);
     }
-    
-    /* Delegate to hooks_resource.c for parallel worker adjustment */
-    return qos_planner_hook(parse, query_string, cursorOptions, boundParams, prev_planner_hook);
+    PG_FINALLY();
+    {
+        nesting_level--;
+    }
+    PG_END_TRY();
+
+    qos_overhead_end(&overhead, QOS_OVERHEAD_PLANNER);
+    return result;
 }
 
 static char *
@@ -340,10 +563,15 @@ qos_validate_qos_setstmt(VariableSetStmt *stmt)
                 (errmsg("qos: invalid parameter name \"%s\"", stmt->name),
                  errhint("Valid parameters: qos.work_mem_limit, qos.cpu_core_limit, qos.max_concurrent_tx, "
                          "qos.max_concurrent_select, qos.max_concurrent_update, qos.max_concurrent_delete, "
-                 "qos.max_concurrent_insert, qos.work_mem_error_level")));
+                 "qos.max_concurrent_insert, qos.work_mem_error_level, qos.enforcement")));
     }
 
-    if (strcmp(stmt->name, "qos.enabled") == 0)
+    /* Real GUCs, validated by the GUC machinery */
+    if (strcmp(stmt->name, "qos.enabled") == 0 ||
+        strcmp(stmt->name, "qos.track_overhead") == 0 ||
+        strcmp(stmt->name, "qos.track_hw_counters") == 0 ||
+        strcmp(stmt->name, "qos.idle_tx_slot_policy") == 0 ||
+        strcmp(stmt->name, "qos.idle_tx_timeout") == 0)
         return;
 
     switch (stmt->kind)
@@ -440,9 +668,15 @@ qos_ProcessUtility(PlannedStmt *pstmt,
                    QueryCompletion *qc)
 {
     Node *parsetree = pstmt->utilityStmt;
+    bool top_level = (nesting_level == 0);
+    bool runs_statements;
+    int saved_statement_level = statement_level;
     bool bump_epoch_after = false;
     VariableSetStmt *qos_set = NULL;
     QoSLimits limits;
+    QoSOverheadTimer overhead;
+
+    qos_overhead_start(&overhead);
     
     /* Enforce work_mem limit on first command in session - delegates to hooks_resource.c */
     if (qos_enabled)
@@ -517,14 +751,46 @@ qos_ProcessUtility(PlannedStmt *pstmt,
             suppress_concurrency_tracking = true;
         }
     }
+
+    /* Utilities whose statements are run for the client and admitted */
+    runs_statements = IsA(parsetree, CallStmt) || IsA(parsetree, DoStmt) ||
+                      IsA(parsetree, ExecuteStmt) ||
+                      IsA(parsetree, CreateTableAsStmt) ||
+                      IsA(parsetree, DeclareCursorStmt) ||
+                      (IsA(parsetree, ExplainStmt) && !suppress_concurrency_tracking) ||
+                      (IsA(parsetree, CopyStmt) && ((CopyStmt *) parsetree)->query != NULL);
     
+    if (top_level)
+        qos_set_idle_in_transaction(false);
+
     /* Call previous hook or standard utility */
-    if (prev_ProcessUtility)
-        prev_ProcessUtility(pstmt, queryString, readOnlyTree, context,
-                          params, queryEnv, dest, qc);
-    else
-        standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+    qos_overhead_pause(&overhead);
+    nesting_level++;
+    if (runs_statements && saved_statement_level == nesting_level - 1)
+        statement_level = nesting_level;
+    PG_TRY();
+    {
+        if (prev_ProcessUtility)
+            prev_ProcessUtility(pstmt, queryString, readOnlyTree, context,
                               params, queryEnv, dest, qc);
+        else
+            standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+                                  params, queryEnv, dest, qc);
+    }
+    PG_FINALLY();
+    {
+        nesting_level--;
+        statement_level = saved_statement_level;
+    }
+    PG_END_TRY();
+    qos_overhead_resume(&overhead);
+
+    /* A top-level utility gives back the slot its statements shared */
+    if (top_level)
+        qos_track_statement_end();
+
+    if (top_level)
+        qos_set_idle_in_transaction(true);
 
     /* For warning mode, enforce work_mem after SET work_mem is applied */
     if (qos_enabled && IsA(parsetree, VariableSetStmt))
@@ -543,6 +809,8 @@ qos_ProcessUtility(PlannedStmt *pstmt,
     /* If relevant QoS setting changed successfully, bump epoch so others reload */
     if (bump_epoch_after)
         qos_notify_settings_change();
+
+    qos_overhead_end(&overhead, QOS_OVERHEAD_PROCESS_UTILITY);
 }
 
 /*
@@ -551,6 +819,10 @@ qos_ProcessUtility(PlannedStmt *pstmt,
 static void
 qos_ExecutorStart(QueryDesc *queryDesc, int eflags)
 {
+    QoSOverheadTimer overhead;
+
+    qos_overhead_start(&overhead);
+
     /* Enforce CPU resource limits - delegates to hooks_resource.c */
     qos_enforce_cpu_limit();
     
@@ -564,23 +836,122 @@ qos_ExecutorStart(QueryDesc *queryDesc, int eflags)
      * to ensure we don't double-count.
      */
     
-    /* Track transaction if not already tracked - delegates to hooks_transaction.c */
-    qos_track_transaction_start();
-    
-    /* Track statement-specific concurrency - delegates to hooks_statement.c */
-    if (queryDesc->operation == CMD_SELECT || 
-        queryDesc->operation == CMD_UPDATE || 
-        queryDesc->operation == CMD_DELETE ||
-        queryDesc->operation == CMD_INSERT)
+    /* Track transaction and statement if not already tracked (top-level only) */
+    if (nesting_level == statement_level)
     {
-        qos_track_statement_start(queryDesc->operation);
+        qos_admit_statement(queryDesc->operation, (int64) queryDesc->plannedstmt->queryId);
+        statement_throttled = qos_plan_was_throttled(queryDesc->plannedstmt);
     }
     
     /* Call previous hook or standard executor */
+    qos_overhead_pause(&overhead);
     if (prev_ExecutorStart)
         prev_ExecutorStart(queryDesc, eflags);
     else
         standard_ExecutorStart(queryDesc, eflags);
+    qos_overhead_resume(&overhead);
+
+    /*
+     * Make sure the executor's total run time is measured so ExecutorEnd can
+     * record it (same approach as pg_stat_statements).
+     */
+    if (qos_enabled && nesting_level == statement_level && queryDesc->totaltime == NULL &&
+        (eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+    {
+        MemoryContext oldcxt;
+
+        oldcxt = MemoryContextSwitchTo(queryDesc->estate->es_query_cxt);
+        queryDesc->totaltime = InstrAlloc(1, INSTRUMENT_ALL, false);
+        MemoryContextSwitchTo(oldcxt);
+    }
+
+    qos_overhead_end(&overhead, QOS_OVERHEAD_EXECUTOR_START);
+}
+
+/*
+ * ExecutorRun hook - track nesting and charge top-level CPU time
+ */
+static void
+#if PG_VERSION_NUM >= 180000
+qos_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count)
+#else
+qos_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
+                bool execute_once)
+#endif
+{
+    PGRUsage ru_start;
+    QoSHwSample hw_start;
+    bool account = qos_enabled && nesting_level == statement_level;
+    bool hw = false;
+
+    if (account)
+    {
+        pg_rusage_init(&ru_start);
+        hw = qos_hw_counters_read(&hw_start);
+    }
+
+    nesting_level++;
+    PG_TRY();
+    {
+#if PG_VERSION_NUM >= 180000
+        if (prev_ExecutorRun)
+            prev_ExecutorRun(queryDesc, direction, count);
+        else
+            standard_ExecutorRun(queryDesc, direction, count);
+#else
+        if (prev_ExecutorRun)
+            prev_ExecutorRun(queryDesc, direction, count, execute_once);
+        else
+            standard_ExecutorRun(queryDesc, direction, count, execute_once);
+#endif
+    }
+    PG_FINALLY();
+    {
+        nesting_level--;
+    }
+    PG_END_TRY();
+
+    if (account)
+        qos_usage_record_cpu(&ru_start);
+    if (hw)
+        qos_hw_counters_record(&hw_start, (int64) queryDesc->plannedstmt->queryId);
+}
+
+/*
+ * ExecutorFinish hook - track nesting and charge top-level CPU time
+ */
+static void
+qos_ExecutorFinish(QueryDesc *queryDesc)
+{
+    PGRUsage ru_start;
+    QoSHwSample hw_start;
+    bool account = qos_enabled && nesting_level == statement_level;
+    bool hw = false;
+
+    if (account)
+    {
+        pg_rusage_init(&ru_start);
+        hw = qos_hw_counters_read(&hw_start);
+    }
+
+    nesting_level++;
+    PG_TRY();
+    {
+        if (prev_ExecutorFinish)
+            prev_ExecutorFinish(queryDesc);
+        else
+            standard_ExecutorFinish(queryDesc);
+    }
+    PG_FINALLY();
+    {
+        nesting_level--;
+    }
+    PG_END_TRY();
+
+    if (account)
+        qos_usage_record_cpu(&ru_start);
+    if (hw)
+        qos_hw_counters_record(&hw_start, (int64) queryDesc->plannedstmt->queryId);
 }
 
 /*
@@ -589,17 +960,58 @@ qos_ExecutorStart(QueryDesc *queryDesc, int eflags)
 static void
 qos_ExecutorEnd(QueryDesc *queryDesc)
 {
+    QoSOverheadTimer overhead;
+
+    qos_overhead_start(&overhead);
+
+    /*
+     * Record executor run time before the EState goes away. Nested statements
+     * are already included in the top-level time and are not sampled.
+     */
+    if (qos_enabled && nesting_level == statement_level && queryDesc->totaltime != NULL &&
+        (queryDesc->estate->es_top_eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+    {
+        InstrEndLoop(queryDesc->totaltime);
+        qos_stats_record_latency(QOS_LATENCY_EXECUTOR,
+                                 (uint64) (queryDesc->totaltime->total * 1000000.0));
+        qos_usage_record_executor(queryDesc->totaltime);
+    }
+
+    /* Per-queryId executions, and time run with fewer workers than planned */
+    if (qos_enabled && nesting_level == statement_level &&
+        (queryDesc->estate->es_top_eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+    {
+        QoSQueryEntry *query = qos_query_entry((int64) queryDesc->plannedstmt->queryId, true);
+
+        if (query)
+        {
+            qos_stats_inc(query->calls);
+            if (statement_throttled && queryDesc->totaltime != NULL)
+                qos_stats_add(query->throttled_time_us,
+                              (uint64) (queryDesc->totaltime->total * 1000000.0));
+        }
+    }
+
     /* Call previous hook or standard executor */
+    qos_overhead_pause(&overhead);
     if (prev_ExecutorEnd)
         prev_ExecutorEnd(queryDesc);
     else
         standard_ExecutorEnd(queryDesc);
+    qos_overhead_resume(&overhead);
     
-    /* Decrement statement counter - delegates to hooks_statement.c */
-    qos_track_statement_end();
-    
-    /* Decrement transaction counter - delegates to hooks_transaction.c */
-    qos_track_transaction_end();
+    /*
+     * Decrement statement counter - delegates to hooks_statement.c. Nested
+     * statements (functions, procedure bodies) leave the outer slot alone.
+     */
+    if (nesting_level == 0)
+    {
+        qos_track_statement_end();
+        qos_set_idle_in_transaction(true);
+    }
+
+    /* The transaction slot is kept until qos_xact_callback (commit or abort) */
+    qos_overhead_end(&overhead, QOS_OVERHEAD_EXECUTOR_END);
 }
 
 /*
@@ -611,15 +1023,22 @@ qos_register_hooks(void)
     /* Save previous hooks */
     prev_ProcessUtility = ProcessUtility_hook;
     prev_ExecutorStart = ExecutorStart_hook;
+    prev_ExecutorRun = ExecutorRun_hook;
+    prev_ExecutorFinish = ExecutorFinish_hook;
     prev_ExecutorEnd = ExecutorEnd_hook;
     prev_planner_hook = planner_hook;
     
     /* Install our hooks */
     ProcessUtility_hook = qos_ProcessUtility;
     ExecutorStart_hook = qos_ExecutorStart;
+    ExecutorRun_hook = qos_ExecutorRun;
+    ExecutorFinish_hook = qos_ExecutorFinish;
     ExecutorEnd_hook = qos_ExecutorEnd;
     planner_hook = qos_planner;
     
+    /* EXPLAIN (QOS) */
+    qos_register_explain_hooks();
+
     /* Initialize cache system with syscache invalidation callbacks */
     qos_init_cache();
     
@@ -645,8 +1064,11 @@ qos_unregister_hooks(void)
     /* Restore previous hooks */
     ProcessUtility_hook = prev_ProcessUtility;
     ExecutorStart_hook = prev_ExecutorStart;
+    ExecutorRun_hook = prev_ExecutorRun;
+    ExecutorFinish_hook = prev_ExecutorFinish;
     ExecutorEnd_hook = prev_ExecutorEnd;
     planner_hook = prev_planner_hook;
+    qos_unregister_explain_hooks();
     
     elog(DEBUG1, "qos: hooks unregistered");
 }
@@ -16,7 +16,9 @@
 
 #include "postgres.h"
 #include "qos.h"
+#include "admission.h"
 #include "hooks_internal.h"
+#include "stats.h"
 #include "miscadmin.h"
 #include "utils/inval.h"
 #include "utils/syscache.h"
@@ -26,7 +28,7 @@
 #include "access/xact.h"
 
 /* Cached QoS limits - invalidated via syscache callback (all -1 = unset) */
-static QoSLimits cached_limits = {-1, -1, -1, -1, -1, -1, -1, -1};
+static QoSLimits cached_limits = {-1, -1, -1, -1, -1, -1, -1, -1, -1};
 static Oid cached_user_id = InvalidOid;
 static Oid cached_db_id = InvalidOid;
 static bool limits_cached = false;
@@ -92,7 +94,7 @@ qos_notify_settings_change(void)
     if (!qos_shared_state)
         return;
 
-    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+    qos_lock_acquire(LW_EXCLUSIVE);
     qos_shared_state->settings_epoch++;
     LWLockRelease(qos_shared_state->lock);
 
@@ -136,21 +138,15 @@ qos_refresh_cached_limits(void)
         role_db_limits = qos_get_role_db_limits(current_user_id, current_db_id);
 
         /*
-         * Calculate limits (most restrictive wins).
+         * Calculate limits (most restrictive wins, see qos_adm_merge_limit).
          * Three sources:
          *   role_limits    = ALTER ROLE x SET qos.*           (db=0, role=X)
          *   db_limits      = ALTER DATABASE y SET qos.*       (db=Y, role=0)
          *   role_db_limits = ALTER ROLE x IN DATABASE y SET   (db=Y, role=X)
-         * Take the minimum of all that are set (>= 0).
          */
-        #define PICK_MIN(a, b) \
-            ((a) >= 0 && (b) >= 0 ? Min((a), (b)) : ((a) >= 0 ? (a) : (b)))
-        
         #define CALC_LIMIT(field) \
-            do { \
-                int64 _tmp = PICK_MIN(role_limits.field, db_limits.field); \
-                cached_limits.field = PICK_MIN(_tmp, role_db_limits.field); \
-            } while (0)
+            (cached_limits.field = qos_adm_merge_limit(role_limits.field, db_limits.field, \
+                                                       role_db_limits.field))
         
         CALC_LIMIT(work_mem_limit);
         CALC_LIMIT(cpu_core_limit);
@@ -162,7 +158,26 @@ qos_refresh_cached_limits(void)
         CALC_LIMIT(work_mem_error_level);
         
         #undef CALC_LIMIT
-        #undef PICK_MIN
+
+        /*
+         * Enforcement mode: unset counts as "on", and the most restrictive
+         * scope wins (on > shadow > off). With enforcement off every limit
+         * is dropped so no check runs at all; statements are still tracked.
+         */
+        cached_limits.enforcement_mode = qos_adm_merge_mode(role_limits.enforcement_mode,
+                                                            db_limits.enforcement_mode,
+                                                            role_db_limits.enforcement_mode);
+
+        if (cached_limits.enforcement_mode == QOS_ENFORCEMENT_OFF)
+        {
+            cached_limits.work_mem_limit = -1;
+            cached_limits.cpu_core_limit = -1;
+            cached_limits.max_concurrent_tx = -1;
+            cached_limits.max_concurrent_select = -1;
+            cached_limits.max_concurrent_update = -1;
+            cached_limits.max_concurrent_delete = -1;
+            cached_limits.max_concurrent_insert = -1;
+        }
     }
 
     /* Update cache metadata */
@@ -170,12 +185,12 @@ qos_refresh_cached_limits(void)
     cached_db_id = current_db_id;
     limits_cached = true;
     
-    elog(DEBUG1, "qos: effective limits - work_mem=%ld cpu=%d tx=%d sel=%d upd=%d del=%d ins=%d errlvl=%d (user=%u db=%u)",
+    elog(DEBUG1, "qos: effective limits - work_mem=%ld cpu=%d tx=%d sel=%d upd=%d del=%d ins=%d errlvl=%d enforcement=%d (user=%u db=%u)",
         cached_limits.work_mem_limit, cached_limits.cpu_core_limit,
         cached_limits.max_concurrent_tx, cached_limits.max_concurrent_select,
         cached_limits.max_concurrent_update, cached_limits.max_concurrent_delete,
         cached_limits.max_concurrent_insert, cached_limits.work_mem_error_level,
-        cached_user_id, cached_db_id);
+        cached_limits.enforcement_mode, cached_user_id, cached_db_id);
 }
 
 /*
@@ -0,0 +1,244 @@
+/*
+ * hooks_explain.c - EXPLAIN (QOS)
+ *
+ * This file implements the QOS option of EXPLAIN, which shows what QoS did
+ * to the statement: the enforcement mode, admission class and limit, time
+ * spent in admission, effective work_mem, parallel workers before and after
+ * the cpu_core_limit cap (also per Gather node) and the assigned CPU cores.
+ *
+ * Extension EXPLAIN options and the per-plan/per-node explain hooks only
+ * exist in PostgreSQL 18 and later; on older servers this file registers
+ * nothing and EXPLAIN rejects the option as unrecognized. There is no
+ * pre-18 fallback: ExplainOneQuery_hook would have to plan the query itself
+ * and could only print after the Query group of structured formats is
+ * closed, with nothing on the Gather nodes.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "qos.h"
+#include "hooks_internal.h"
+#include "stats.h"
+
+#if PG_VERSION_NUM >= 180000
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "commands/explain_format.h"
+#include "commands/explain_state.h"
+#include "lib/stringinfo.h"
+#include "nodes/execnodes.h"
+#include "parser/parse_node.h"
+#include "utils/guc.h"
+
+#define QOS_EXPLAIN_MAX_CORES 64
+
+/* Per-EXPLAIN options stored in the ExplainState */
+typedef struct QoSExplainOptions
+{
+    bool        qos;
+} QoSExplainOptions;
+
+static int qos_explain_extension_id = -1;
+static explain_per_plan_hook_type prev_explain_per_plan_hook = NULL;
+static explain_per_node_hook_type prev_explain_per_node_hook = NULL;
+
+static const char *const qos_enforcement_names[] = {
+    "off",
+    "shadow",
+    "on"
+};
+
+static void
+qos_explain_qos_handler(ExplainState *es, DefElem *opt, ParseState *pstate)
+{
+    QoSExplainOptions *options;
+
+    options = GetExplainExtensionState(es, qos_explain_extension_id);
+    if (options == NULL)
+    {
+        options = palloc0(sizeof(QoSExplainOptions));
+        SetExplainExtensionState(es, qos_explain_extension_id, options);
+    }
+
+    options->qos = defGetBoolean(opt);
+}
+
+static bool
+qos_explain_enabled(ExplainState *es)
+{
+    QoSExplainOptions *options;
+
+    options = GetExplainExtensionState(es, qos_explain_extension_id);
+    return options != NULL && options->qos;
+}
+
+/*
+ * Concurrency limit that applies to a command type (-1 = none)
+ */
+static int
+qos_explain_limit_for_cmd(const QoSLimits *limits, CmdType operation)
+{
+    switch (operation)
+    {
+        case CMD_SELECT: return limits->max_concurrent_select;
+        case CMD_UPDATE: return limits->max_concurrent_update;
+        case CMD_DELETE: return limits->max_concurrent_delete;
+        case CMD_INSERT: return limits->max_concurrent_insert;
+        default: return -1;
+    }
+}
+
+/*
+ * Statement-level QoS details, printed after the plan
+ */
+static void
+qos_explain_per_plan(PlannedStmt *plannedstmt, IntoClause *into,
+                     ExplainState *es, const char *queryString,
+                     ParamListInfo params, QueryEnvironment *queryEnv)
+{
+    QoSLimits limits;
+    const QoSPlanAdjustment *adjustment;
+    int cores[QOS_EXPLAIN_MAX_CORES];
+    int ncores;
+    int limit_val;
+    int64 admission_us;
+    int mode;
+
+    if (prev_explain_per_plan_hook)
+        prev_explain_per_plan_hook(plannedstmt, into, es, queryString, params, queryEnv);
+
+    if (!qos_explain_enabled(es))
+        return;
+
+    limits = qos_get_cached_limits();
+    mode = (limits.enforcement_mode < 0) ? QOS_ENFORCEMENT_ON : limits.enforcement_mode;
+    limit_val = qos_explain_limit_for_cmd(&limits, plannedstmt->commandType);
+    adjustment = qos_last_plan_adjustment();
+    admission_us = qos_last_admission_us();
+
+    ExplainOpenGroup("QoS", "QoS", true, es);
+    if (es->format == EXPLAIN_FORMAT_TEXT)
+    {
+        ExplainIndentText(es);
+        appendStringInfoString(es->str, "QoS:\n");
+        es->indent++;
+    }
+
+    ExplainPropertyText("Enabled", qos_enabled ? "true" : "false", es);
+    ExplainPropertyText("Enforcement", qos_enforcement_names[mode], es);
+
+    if (qos_stats_cmd_index(plannedstmt->commandType) >= 0)
+    {
+        const char *cmd_names[QOS_CMD_COUNT] = {"select", "update", "delete", "insert"};
+
+        ExplainPropertyText("Admission Class",
+                            cmd_names[qos_stats_cmd_index(plannedstmt->commandType)], es);
+        if (limit_val > 0)
+            ExplainPropertyInteger("Concurrency Limit", NULL, limit_val, es);
+        else
+            ExplainPropertyText("Concurrency Limit", "none", es);
+    }
+    if (limits.max_concurrent_tx > 0)
+        ExplainPropertyInteger("Transaction Limit", NULL, limits.max_concurrent_tx, es);
+
+    /* Only statements that ran (EXPLAIN ANALYZE) went through admission */
+    if (admission_us >= 0)
+        ExplainPropertyInteger("Admission Time", "us", admission_us, es);
+
+    ExplainPropertyInteger("Effective work_mem", "kB", work_mem, es);
+    if (limits.work_mem_limit > 0)
+        ExplainPropertyInteger("work_mem Limit", "kB", limits.work_mem_limit / 1024, es);
+
+    if (adjustment->stmt == plannedstmt)
+    {
+        ExplainPropertyInteger("Parallel Workers Planned", NULL, adjustment->planned_workers, es);
+        ExplainPropertyInteger("Parallel Workers Granted", NULL, adjustment->granted_workers, es);
+    }
+    if (limits.cpu_core_limit > 0)
+        ExplainPropertyInteger("CPU Core Limit", NULL, limits.cpu_core_limit, es);
+
+    ncores = qos_assigned_cores(cores, QOS_EXPLAIN_MAX_CORES);
+    if (ncores > 0)
+    {
+        StringInfoData buf;
+        int i;
+
+        initStringInfo(&buf);
+        for (i = 0; i < ncores; i++)
+            appendStringInfo(&buf, "%s%d", i > 0 ? "," : "", cores[i]);
+        ExplainPropertyText("Assigned Cores", buf.data, es);
+        pfree(buf.data);
+    }
+
+    if (es->format == EXPLAIN_FORMAT_TEXT)
+        es->indent--;
+    ExplainCloseGroup("QoS", "QoS", true, es);
+}
+
+/*
+ * Gather/Gather Merge nodes whose workers QoS reduced: show the original count
+ */
+static void
+qos_explain_per_node(PlanState *planstate, List *ancestors,
+                     const char *relationship, const char *plan_name,
+                     ExplainState *es)
+{
+    const QoSPlanAdjustment *adjustment;
+    Plan *plan = planstate->plan;
+    int i;
+
+    if (prev_explain_per_node_hook)
+        prev_explain_per_node_hook(planstate, ancestors, relationship, plan_name, es);
+
+    if (!qos_explain_enabled(es) || (!IsA(plan, Gather) && !IsA(plan, GatherMerge)))
+        return;
+
+    adjustment = qos_last_plan_adjustment();
+    if (adjustment->stmt != planstate->state->es_plannedstmt)
+        return;
+
+    for (i = 0; i < adjustment->ngathers; i++)
+    {
+        if (adjustment->plan_node_ids[i] == plan->plan_node_id)
+        {
+            ExplainPropertyInteger("QoS Workers Before Limit", NULL,
+                                   adjustment->original_workers[i], es);
+            break;
+        }
+    }
+}
+#endif /* PG_VERSION_NUM >= 180000 */
+
+/*
+ * Register EXPLAIN (QOS) and the explain hooks (PG18+)
+ */
+void
+qos_register_explain_hooks(void)
+{
+#if PG_VERSION_NUM >= 180000
+    qos_explain_extension_id = GetExplainExtensionId("qos");
+    RegisterExtensionExplainOption("qos", qos_explain_qos_handler);
+
+    prev_explain_per_plan_hook = explain_per_plan_hook;
+    explain_per_plan_hook = qos_explain_per_plan;
+    prev_explain_per_node_hook = explain_per_node_hook;
+    explain_per_node_hook = qos_explain_per_node;
+#endif
+}
+
+void
+qos_unregister_explain_hooks(void)
+{
+#if PG_VERSION_NUM >= 180000
+    explain_per_plan_hook = prev_explain_per_plan_hook;
+    explain_per_node_hook = prev_explain_per_node_hook;
+#endif
+}
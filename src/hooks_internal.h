@@ -22,6 +22,7 @@
 #include "nodes/plannodes.h"
 #include "optimizer/planner.h"
 #include "qos.h"
+#include "stats.h"
 
 /* Cache management */
 extern QoSLimits qos_get_cached_limits(void);
@@ -31,6 +32,8 @@ extern void qos_init_cache(void);
 /* Statement tracking functions (hooks_statement.c) */
 extern void qos_track_statement_start(CmdType operation);
 extern void qos_track_statement_end(void);
+extern bool qos_statement_is_tracked(void);
+extern void qos_track_query_start(int64 query_id);
 
 /* Transaction tracking functions (hooks_transaction.c) */
 extern void qos_track_transaction_start(void);
@@ -43,11 +46,45 @@ extern int qos_get_backend_slot(bool allocate_if_missing);
 extern void qos_reset_backend_slot(void);
 #endif
 
+/* This backend's status slot, or NULL (implemented in hooks.c) */
+extern QoSBackendStatus *qos_my_backend_status(bool allocate_if_missing);
+
+/* Report a violation allowed by qos.enforcement = shadow (implemented in hooks.c) */
+extern void qos_log_shadow_violation(QoSEventAction action, QoSEventLimit limit,
+                                     int64 current, int64 limit_value);
+
+/* Time spent in the admission that gave this backend its statement slot (hooks.c) */
+extern int64 qos_last_admission_us(void);
+
+/*
+ * Parallel worker reductions applied to the last planned statement
+ * (hooks_resource.c), reported by EXPLAIN (QOS)
+ */
+#define QOS_MAX_ADJUSTED_GATHERS 16
+typedef struct QoSPlanAdjustment
+{
+    const PlannedStmt *stmt;    /* Plan this record belongs to (NULL if none) */
+    int     planned_workers;    /* Gather/Gather Merge workers before the cap */
+    int     granted_workers;    /* ... and after it */
+    int     ngathers;           /* Reduced nodes recorded below */
+    int     plan_node_ids[QOS_MAX_ADJUSTED_GATHERS];
+    int     original_workers[QOS_MAX_ADJUSTED_GATHERS];
+} QoSPlanAdjustment;
+
+extern const QoSPlanAdjustment *qos_last_plan_adjustment(void);
+extern bool qos_plan_was_throttled(const PlannedStmt *stmt);
+extern int qos_assigned_cores(int *cores, int max_cores);
+
+/* EXPLAIN (QOS) option and hooks (hooks_explain.c, PG18+) */
+extern void qos_register_explain_hooks(void);
+extern void qos_unregister_explain_hooks(void);
+
 /* Resource enforcement functions (hooks_resource.c) */
 extern void qos_enforce_cpu_limit(void);
 extern void qos_enforce_work_mem_limit(VariableSetStmt *stmt);
 extern PlannedStmt *qos_planner_hook(Query *parse, const char *query_string,
 									 int cursorOptions, ParamListInfo boundParams,
-									 planner_hook_type prev_hook);
+									 planner_hook_type prev_hook,
+									 QoSOverheadTimer *overhead);
 
 #endif /* QOS_HOOKS_INTERNAL_H */
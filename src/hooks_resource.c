@@ -15,14 +15,21 @@
 
 #include "postgres.h"
 #include "qos.h"
+#include "admission.h"
 #include "hooks_internal.h"
+#include "stats.h"
+#include "events.h"
+#include "queries.h"
 #include "miscadmin.h"
 #include "nodes/parsenodes.h"
 #include "nodes/plannodes.h"
 #include "nodes/value.h"
 #include "optimizer/planner.h"
+#include "portability/instr_time.h"
 #include "storage/lwlock.h"
 #include "utils/guc.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
 #include <strings.h>
 #include <unistd.h>
 
@@ -37,7 +44,12 @@
 #endif
 
 /* Forward declarations */
-static void qos_adjust_parallel_workers(Plan *plan, int max_workers);
+static bool qos_adjust_parallel_workers(Plan *plan, int max_workers, bool apply);
+static int qos_count_parallel_workers(PlannedStmt *stmt);
+static int qos_count_plan_workers(Plan *plan);
+static void qos_note_gather_reduction(Plan *plan, int original_workers);
+static void qos_count_tenant_event(int cmd_index, bool work_mem_cap, bool cpu_pinning,
+                                   bool shadow);
 #ifdef __linux__
 static int qos_select_least_busy_cores(int *selected_cores, int requested_cores, int total_cores);
 static long qos_measure_cpu_cycles(int cpu);
@@ -49,29 +61,140 @@ static int qos_get_or_assign_cores(Oid database_oid, Oid role_oid, int requested
 static bool work_mem_enforced = false;
 static int work_mem_last_epoch = -1;
 
+#ifdef __linux__
+/* Per-backend: CPU set last applied, to count only actual pinning changes */
+static cpu_set_t applied_cpuset;
+static bool applied_cpuset_valid = false;
+#endif
+
+/* Worker reductions in the last plan, for EXPLAIN (QOS) */
+static QoSPlanAdjustment last_adjustment;
+
+const QoSPlanAdjustment *
+qos_last_plan_adjustment(void)
+{
+    return &last_adjustment;
+}
+
+/*
+ * Were the parallel workers of this plan reduced? Only the last planned
+ * statement is known; for any other plan this returns false.
+ */
+bool
+qos_plan_was_throttled(const PlannedStmt *stmt)
+{
+    return stmt != NULL && last_adjustment.stmt == stmt &&
+           last_adjustment.granted_workers < last_adjustment.planned_workers;
+}
+
+/*
+ * CPU cores this backend is pinned to by cpu_core_limit; returns the number
+ * stored in cores (0 if not pinned)
+ */
+int
+qos_assigned_cores(int *cores, int max_cores)
+{
+    int n = 0;
+#ifdef __linux__
+    int cpu;
+
+    if (!applied_cpuset_valid)
+        return 0;
+
+    for (cpu = 0; cpu < CPU_SETSIZE && n < max_cores; cpu++)
+    {
+        if (CPU_ISSET(cpu, &applied_cpuset))
+            cores[n++] = cpu;
+    }
+#endif
+    return n;
+}
+
+/*
+ * Bump a tenant counter for the current role+database (lock-free).
+ * cmd_index >= 0 counts a throttled (parallel-reduced) plan of that type.
+ * With shadow set, throttling and work_mem caps go to the shadow counters.
+ */
+static void
+qos_count_tenant_event(int cmd_index, bool work_mem_cap, bool cpu_pinning,
+                       bool shadow)
+{
+    QoSTenantEntry *tenant;
+
+    tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+    if (!tenant)
+        return;
+
+    if (shadow)
+    {
+        if (cmd_index >= 0)
+            qos_stats_inc(tenant->stats.shadow_throttled);
+        if (work_mem_cap)
+            qos_stats_inc(tenant->stats.shadow_work_mem_caps);
+        return;
+    }
+
+    if (cmd_index >= 0)
+        qos_stats_inc(tenant->stats.throttled[cmd_index]);
+    if (work_mem_cap)
+        qos_stats_inc(tenant->stats.work_mem_caps);
+    if (cpu_pinning)
+        qos_stats_inc(tenant->stats.cpu_pinnings);
+}
+
 /*
  * Planner hook wrapper - adjust parallel workers based on CPU limits
  * Called from main hooks.c planner hook
  */
 PlannedStmt *
 qos_planner_hook(Query *parse, const char *query_string, int cursorOptions, 
-                 ParamListInfo boundParams, planner_hook_type prev_hook)
+                 ParamListInfo boundParams, planner_hook_type prev_hook,
+                 QoSOverheadTimer *overhead)
 {
     PlannedStmt *result;
     QoSLimits limits;
     int new_max_workers = 0;
+    bool reduced = false;
+    bool shadow;
+    int planned_workers = 0;
     ListCell *lc;
+    instr_time plan_start;
+    instr_time plan_duration;
     
+    qos_overhead_pause(overhead);
+    INSTR_TIME_SET_CURRENT(plan_start);
+
     /* Call previous planner hook or standard planner first */
     if (prev_hook)
         result = prev_hook(parse, query_string, cursorOptions, boundParams);
     else
         result = standard_planner(parse, query_string, cursorOptions, boundParams);
+
+    qos_overhead_resume(overhead);
+
+    if (qos_enabled)
+    {
+        INSTR_TIME_SET_CURRENT(plan_duration);
+        INSTR_TIME_SUBTRACT(plan_duration, plan_start);
+        qos_stats_record_latency(QOS_LATENCY_PLANNING,
+                                 (uint64) INSTR_TIME_GET_MICROSEC(plan_duration));
+    }
     
+    /* Forget the previous plan even when QoS is off for this one */
+    last_adjustment.stmt = NULL;
+
     /* Apply QoS CPU limits to the planned statement */
     if (qos_enabled && result != NULL)
     {
+        QoSBackendStatus *status;
+
         limits = qos_get_cached_limits();
+        shadow = (limits.enforcement_mode == QOS_ENFORCEMENT_SHADOW);
+        planned_workers = qos_count_parallel_workers(result);
+
+        memset(&last_adjustment, 0, sizeof(last_adjustment));
+        last_adjustment.stmt = result;
+        last_adjustment.planned_workers = planned_workers;
         
         if (limits.cpu_core_limit > 0)
         {
@@ -81,7 +204,7 @@ qos_planner_hook(Query *parse, const char *query_string, int cursorOptions,
             /* Limit parallel workers in the main plan */
             if (result->parallelModeNeeded && result->planTree != NULL)
             {
-                qos_adjust_parallel_workers(result->planTree, new_max_workers);
+                reduced |= qos_adjust_parallel_workers(result->planTree, new_max_workers, !shadow);
                 
                 elog(DEBUG2, "qos: adjusted parallel workers in plan (max: %d, cpu_core_limit=%d)",
                      new_max_workers, limits.cpu_core_limit);
@@ -92,22 +215,108 @@ qos_planner_hook(Query *parse, const char *query_string, int cursorOptions,
             {
                 Plan *subplan = (Plan *) lfirst(lc);
                 if (subplan != NULL)
-                    qos_adjust_parallel_workers(subplan, new_max_workers);
+                    reduced |= qos_adjust_parallel_workers(subplan, new_max_workers, !shadow);
+            }
+
+            if (reduced && qos_stats_cmd_index(result->commandType) >= 0)
+                qos_count_tenant_event(qos_stats_cmd_index(result->commandType),
+                                       false, false, shadow);
+
+            if (reduced && shadow)
+            {
+                qos_log_shadow_violation(QOS_EVENT_THROTTLE, QOS_LIMIT_CPU_CORE,
+                                         planned_workers, new_max_workers);
+                reduced = false;    /* plan left untouched */
+            }
+            else if (reduced)
+            {
+                QoSQueryEntry *query = qos_query_entry((int64) result->queryId, true);
+
+                if (query)
+                    qos_stats_inc(query->throttled);
+                qos_event_record(QOS_EVENT_THROTTLE, QOS_LIMIT_CPU_CORE,
+                                 planned_workers, new_max_workers, false);
             }
         }
+
+        last_adjustment.granted_workers =
+            reduced ? qos_count_parallel_workers(result) : planned_workers;
+
+        /* Publish planned vs granted workers for qos_activity */
+        status = qos_my_backend_status(false);
+        if (status)
+        {
+            status->parallel_workers_planned = planned_workers;
+            status->parallel_workers_granted =
+                reduced ? qos_count_parallel_workers(result) : planned_workers;
+        }
     }
     
     return result;
 }
 
 /*
- * Recursively adjust parallel worker count in plan tree
+ * Total Gather/Gather Merge workers in a planned statement (0 if serial)
  */
-static void
-qos_adjust_parallel_workers(Plan *plan, int max_workers)
+static int
+qos_count_parallel_workers(PlannedStmt *stmt)
+{
+    int workers = 0;
+    ListCell *lc;
+
+    if (!stmt->parallelModeNeeded)
+        return 0;
+
+    workers += qos_count_plan_workers(stmt->planTree);
+    foreach(lc, stmt->subplans)
+        workers += qos_count_plan_workers((Plan *) lfirst(lc));
+
+    return workers;
+}
+
+static int
+qos_count_plan_workers(Plan *plan)
 {
+    int workers = 0;
+
     if (plan == NULL)
+        return 0;
+
+    if (IsA(plan, Gather))
+        workers = ((Gather *) plan)->num_workers;
+    else if (IsA(plan, GatherMerge))
+        workers = ((GatherMerge *) plan)->num_workers;
+
+    return workers + qos_count_plan_workers(plan->lefttree) +
+           qos_count_plan_workers(plan->righttree);
+}
+
+/*
+ * Remember a Gather/Gather Merge node's worker count before the cap
+ */
+static void
+qos_note_gather_reduction(Plan *plan, int original_workers)
+{
+    if (last_adjustment.ngathers >= QOS_MAX_ADJUSTED_GATHERS)
         return;
+
+    last_adjustment.plan_node_ids[last_adjustment.ngathers] = plan->plan_node_id;
+    last_adjustment.original_workers[last_adjustment.ngathers] = original_workers;
+    last_adjustment.ngathers++;
+}
+
+/*
+ * Recursively adjust parallel worker count in plan tree
+ * Returns true if any Gather/Gather Merge node exceeds max_workers; the
+ * nodes are only reduced when apply is set (false in shadow mode)
+ */
+static bool
+qos_adjust_parallel_workers(Plan *plan, int max_workers, bool apply)
+{
+    bool reduced = false;
+
+    if (plan == NULL)
+        return false;
     
     /* Adjust workers for Gather nodes */
     if (IsA(plan, Gather))
@@ -115,9 +324,14 @@ qos_adjust_parallel_workers(Plan *plan, int max_workers)
         Gather *gather = (Gather *) plan;
         if (gather->num_workers > max_workers)
         {
-            elog(DEBUG3, "qos: limiting Gather workers from %d to %d",
-                 gather->num_workers, max_workers);
-            gather->num_workers = max_workers;
+            elog(DEBUG3, "qos: limiting Gather workers from %d to %d%s",
+                 gather->num_workers, max_workers, apply ? "" : " (shadow)");
+            if (apply)
+            {
+                qos_note_gather_reduction(plan, gather->num_workers);
+                gather->num_workers = max_workers;
+            }
+            reduced = true;
         }
     }
     /* Adjust workers for Gather Merge nodes */
@@ -126,15 +340,22 @@ qos_adjust_parallel_workers(Plan *plan, int max_workers)
         GatherMerge *gather_merge = (GatherMerge *) plan;
         if (gather_merge->num_workers > max_workers)
         {
-            elog(DEBUG3, "qos: limiting Gather Merge workers from %d to %d",
-                 gather_merge->num_workers, max_workers);
-            gather_merge->num_workers = max_workers;
+            elog(DEBUG3, "qos: limiting Gather Merge workers from %d to %d%s",
+                 gather_merge->num_workers, max_workers, apply ? "" : " (shadow)");
+            if (apply)
+            {
+                qos_note_gather_reduction(plan, gather_merge->num_workers);
+                gather_merge->num_workers = max_workers;
+            }
+            reduced = true;
         }
     }
     
     /* Recursively process child plans */
-    qos_adjust_parallel_workers(plan->lefttree, max_workers);
-    qos_adjust_parallel_workers(plan->righttree, max_workers);
+    reduced |= qos_adjust_parallel_workers(plan->lefttree, max_workers, apply);
+    reduced |= qos_adjust_parallel_workers(plan->righttree, max_workers, apply);
+
+    return reduced;
 }
 
 #ifdef __linux__
@@ -171,7 +392,9 @@ qos_measure_cpu_cycles(int cpu)
     ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
 
     CHECK_FOR_INTERRUPTS();
-    usleep(100); /* Sample for 100us */
+    pgstat_report_wait_start(qos_wait_event(QOS_WAIT_CPU_SAMPLE));
+    pg_usleep(100); /* Sample for 100us */
+    pgstat_report_wait_end();
     
     ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
     
@@ -191,39 +414,44 @@ qos_measure_cpu_cycles(int cpu)
 static int
 qos_select_least_busy_cores(int *selected_cores, int requested_cores, int total_cores)
 {
-    long *cpu_cycles;
-    int *sorted_indices;
-    int i, j, temp_idx;
-    int valid_count = 0;
+    int64_t *cpu_cycles;
+    int *order;
+    int i;
+    int num_selected;
     
     if (requested_cores <= 0 || total_cores <= 0)
         return 0;
     
-    if (requested_cores > total_cores)
-        requested_cores = total_cores;
-    
-    cpu_cycles = (long *) palloc(sizeof(long) * total_cores);
-    sorted_indices = (int *) palloc(sizeof(int) * total_cores);
+    cpu_cycles = (int64_t *) palloc(sizeof(int64_t) * total_cores);
+    order = (int *) palloc(sizeof(int) * total_cores);
     
     /* Measure cycles for each CPU */
     for (i = 0; i < total_cores; i++)
     {
         cpu_cycles[i] = qos_measure_cpu_cycles(i);
-        sorted_indices[i] = i;
         
-        if (cpu_cycles[i] >= 0)
-            valid_count++;
+        /* Keep the sample for qos_cpu_map */
+        if (cpu_cycles[i] >= 0 && qos_shared_state && i < QOS_MAX_CPUS)
+        {
+            pg_atomic_write_u64(&qos_shared_state->cpu_samples[i].cycles,
+                                (uint64) cpu_cycles[i]);
+            pg_atomic_write_u64(&qos_shared_state->cpu_samples[i].sample_time,
+                                (uint64) GetCurrentTimestamp());
+        }
     }
     
+    num_selected = qos_adm_select_cores(cpu_cycles, total_cores, requested_cores,
+                                        order, selected_cores);
+    
     /* If perf measurements failed, fallback to simple round-robin */
-    if (valid_count == 0)
+    if (num_selected == 0)
     {
         int start_core;
         
         /* Use shared memory counter for true round-robin across all backends */
         if (qos_shared_state)
         {
-            LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+            qos_lock_acquire(LW_EXCLUSIVE);
             start_core = qos_shared_state->next_cpu_core;
             qos_shared_state->next_cpu_core = (start_core + requested_cores) % total_cores;
             LWLockRelease(qos_shared_state->lock);
@@ -238,52 +466,19 @@ qos_select_least_busy_cores(int *selected_cores, int requested_cores, int total_
             elog(DEBUG1, "qos: no shared state, defaulting to core 0");
         }
         
-        for (i = 0; i < requested_cores; i++)
-        {
-            selected_cores[i] = (start_core + i) % total_cores;
-        }
-        
-        pfree(cpu_cycles);
-        pfree(sorted_indices);
-        return requested_cores;
-    }
-    
-    /* Sort CPUs by cycle count (ascending = less busy first) */
-    for (i = 0; i < requested_cores; i++)
-    {
-        int min_idx = i;
-        for (j = i + 1; j < total_cores; j++)
-        {
-            /* Skip CPUs where measurement failed */
-            if (cpu_cycles[sorted_indices[j]] < 0)
-                continue;
-            if (cpu_cycles[sorted_indices[min_idx]] < 0 || 
-                cpu_cycles[sorted_indices[j]] < cpu_cycles[sorted_indices[min_idx]])
-            {
-                min_idx = j;
-            }
-        }
-        if (min_idx != i)
-        {
-            temp_idx = sorted_indices[i];
-            sorted_indices[i] = sorted_indices[min_idx];
-            sorted_indices[min_idx] = temp_idx;
-        }
+        num_selected = qos_adm_round_robin_cores(start_core, total_cores, requested_cores,
+                                                 selected_cores);
     }
-    
-    /* Select the least busy N cores */
-    for (i = 0; i < requested_cores; i++)
+    else
     {
-        selected_cores[i] = sorted_indices[i];
+        elog(DEBUG1, "qos: selected %d cores using perf measurements (pid=%d)", 
+             num_selected, (int)getpid());
     }
     
-    elog(DEBUG1, "qos: selected %d cores using perf measurements (pid=%d)", 
-         requested_cores, (int)getpid());
-    
     pfree(cpu_cycles);
-    pfree(sorted_indices);
+    pfree(order);
     
-    return requested_cores;
+    return num_selected;
 }
 
 /*
@@ -306,7 +501,7 @@ qos_get_or_assign_cores(Oid database_oid, Oid role_oid, int requested_cores,
     if (!qos_shared_state || requested_cores <= 0)
         return 0;
     
-    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+    qos_lock_acquire(LW_EXCLUSIVE);
     
     /* Search for existing entry */
     for (i = 0; i < MAX_AFFINITY_ENTRIES; i++)
@@ -344,7 +539,7 @@ qos_get_or_assign_cores(Oid database_oid, Oid role_oid, int requested_cores,
         return 0;
     
     /* Store the assignment in shared memory */
-    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+    qos_lock_acquire(LW_EXCLUSIVE);
     
     /* Re-check if another backend added this entry while we were selecting cores */
     for (i = 0; i < MAX_AFFINITY_ENTRIES; i++)
@@ -423,6 +618,14 @@ qos_enforce_cpu_limit(void)
     
     if (limits.cpu_core_limit <= 0)
         return;
+
+    /* Shadow mode: parallel workers are still checked by the planner hook */
+    if (limits.enforcement_mode == QOS_ENFORCEMENT_SHADOW)
+    {
+        elog(DEBUG3, "qos: shadow mode, not pinning backend to %d core(s)",
+             limits.cpu_core_limit);
+        return;
+    }
     
     /* 
      * CPU Affinity - Total CPU usage restriction (Linux only)
@@ -469,6 +672,13 @@ qos_enforce_cpu_limit(void)
             
             if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) == 0)
             {
+                if (!applied_cpuset_valid || !CPU_EQUAL(&cpuset, &applied_cpuset))
+                {
+                    applied_cpuset = cpuset;
+                    applied_cpuset_valid = true;
+                    qos_count_tenant_event(-1, false, true, false);
+                }
+
                 elog(DEBUG3, "qos: CPU affinity set for db=%u role=%u pid=%d - using %d core(s): core %d%s",
                      MyDatabaseId, GetUserId(), (int)getpid(), num_assigned,
                      assigned_cores[0], num_assigned > 1 ? " (+ others)" : "");
@@ -549,7 +759,17 @@ qos_enforce_work_mem_limit(VariableSetStmt *stmt)
                  new_work_mem_bytes, limits.work_mem_limit, limits.work_mem_error_level);
             
             /* Check if new value exceeds limit */
-            if (new_work_mem_bytes > limits.work_mem_limit)
+            if (new_work_mem_bytes > limits.work_mem_limit &&
+                limits.enforcement_mode == QOS_ENFORCEMENT_SHADOW)
+            {
+                qos_count_tenant_event(-1, true, false, true);
+                qos_log_shadow_violation(limits.work_mem_error_level == QOS_WORK_MEM_ERROR_ERROR
+                                         ? QOS_EVENT_REJECT : QOS_EVENT_CAP,
+                                         QOS_LIMIT_WORK_MEM,
+                                         new_work_mem_bytes / 1024,
+                                         limits.work_mem_limit / 1024);
+            }
+            else if (new_work_mem_bytes > limits.work_mem_limit)
             {
                 int elevel = (limits.work_mem_error_level == QOS_WORK_MEM_ERROR_ERROR)
                               ? ERROR
@@ -561,12 +781,10 @@ qos_enforce_work_mem_limit(VariableSetStmt *stmt)
                     work_mem = new_work_mem_kb;
                 }
 
-                if (qos_shared_state)
-                {
-                    LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
-                    qos_shared_state->stats.work_mem_violations++;
-                    LWLockRelease(qos_shared_state->lock);
-                }
+                qos_count_tenant_event(-1, true, false, false);
+                qos_event_record(elevel == ERROR ? QOS_EVENT_REJECT : QOS_EVENT_CAP,
+                                 QOS_LIMIT_WORK_MEM, new_work_mem_bytes / 1024,
+                                 limits.work_mem_limit / 1024, false);
                 
                 ereport(elevel,
                         (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
@@ -608,8 +826,16 @@ qos_enforce_work_mem_limit(VariableSetStmt *stmt)
         current_work_mem_kb = work_mem;
         current_work_mem_bytes = (int64)current_work_mem_kb * 1024L;
         
-        /* If current work_mem exceeds limit, cap it */
-        if (current_work_mem_bytes > limits.work_mem_limit)
+        /* If current work_mem exceeds limit, cap it (shadow mode only reports) */
+        if (current_work_mem_bytes > limits.work_mem_limit &&
+            limits.enforcement_mode == QOS_ENFORCEMENT_SHADOW)
+        {
+            qos_count_tenant_event(-1, true, false, true);
+            qos_log_shadow_violation(QOS_EVENT_CAP, QOS_LIMIT_WORK_MEM,
+                                     current_work_mem_kb,
+                                     limits.work_mem_limit / 1024);
+        }
+        else if (current_work_mem_bytes > limits.work_mem_limit)
         {
             int new_work_mem_kb = (int)(limits.work_mem_limit / 1024L);
             
@@ -619,12 +845,9 @@ qos_enforce_work_mem_limit(VariableSetStmt *stmt)
             elog(LOG, "qos: work_mem enforced at %d KB (was %d KB) for db=%u role=%u",
                  new_work_mem_kb, current_work_mem_kb, MyDatabaseId, GetUserId());
             
-            if (qos_shared_state)
-            {
-                LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
-                qos_shared_state->stats.work_mem_violations++;
-                LWLockRelease(qos_shared_state->lock);
-            }
+            qos_count_tenant_event(-1, true, false, false);
+            qos_event_record(QOS_EVENT_CAP, QOS_LIMIT_WORK_MEM, current_work_mem_kb,
+                             limits.work_mem_limit / 1024, false);
         }
     }
 }
@@ -2,7 +2,8 @@
  * hooks_statement.c - Statement-level QoS tracking and enforcement
  *
  * This file implements concurrent statement tracking for SELECT, UPDATE,
- * DELETE, and INSERT operations.
+ * DELETE, and INSERT operations, and the per-queryId limits set with
+ * qos_set_query_limit().
  *
  * Author:  M.Atif Ceylan
  * Company: AppstoniA OÜ
@@ -16,16 +17,28 @@
 
 #include "postgres.h"
 #include "qos.h"
+#include "admission.h"
 #include "hooks_internal.h"
+#include "stats.h"
+#include "events.h"
+#include "queries.h"
 #include "storage/lwlock.h"
 #include "nodes/nodes.h"
 #include "miscadmin.h"
+#include "access/xact.h"
 #include "storage/proc.h"
 
 /* Per-backend statement tracking */
 static CmdType current_statement_type = CMD_UNKNOWN;
 static bool statement_tracked = false;
 
+/* Tenant the statement was admitted under (a procedure may SET ROLE) */
+static Oid tracked_role_oid = InvalidOid;
+static Oid tracked_database_oid = InvalidOid;
+
+/* Query entry whose concurrency slot this backend holds, if any */
+static QoSQueryEntry *query_slot = NULL;
+
 /*
  * Track statement start - for SELECT, UPDATE, DELETE, INSERT concurrency limits
  */
@@ -33,9 +46,12 @@ void
 qos_track_statement_start(CmdType operation)
 {
     QoSLimits limits;
+    QoSTenantEntry *tenant;
     int count = 0;
     int i;
     int limit_val = -1;
+    QoSAdmDecision decision;
+    bool shadow_violation = false;
 #ifndef MyBackendId
     int my_slot = -1;
 #endif
@@ -60,7 +76,10 @@ qos_track_statement_start(CmdType operation)
 #ifndef MyBackendId
     my_slot = qos_get_backend_slot(true);
 #endif
-        LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+        /* Resolve the stats entry before locking; counters are atomics */
+        tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+
+        qos_lock_acquire(LW_EXCLUSIVE);
         
         /* Scan active backends to count current usage */
         for (i = 0; i < qos_shared_state->max_backends; i++)
@@ -87,21 +106,22 @@ qos_track_statement_start(CmdType operation)
             }
         }
         
-        /* Check limit */
-        if (limit_val > 0 && count >= limit_val)
+        /* Check limit (shadow mode admits anyway and reports below) */
+        decision = qos_adm_decide(count, limit_val, limits.enforcement_mode);
+        if (decision == QOS_ADM_SHADOW_ADMIT)
         {
-            /* Update stats */
-            switch (operation)
-            {
-                case CMD_SELECT: qos_shared_state->stats.concurrent_select_violations++; break;
-                case CMD_UPDATE: qos_shared_state->stats.concurrent_update_violations++; break;
-                case CMD_DELETE: qos_shared_state->stats.concurrent_delete_violations++; break;
-                case CMD_INSERT: qos_shared_state->stats.concurrent_insert_violations++; break;
-                default: break;
-            }
-            qos_shared_state->stats.rejected_queries++;
-            
+            shadow_violation = true;
+        }
+        else if (decision == QOS_ADM_REJECT)
+        {
+            qos_saturation_update(tenant, qos_stats_cmd_index(operation), count, limit_val);
             LWLockRelease(qos_shared_state->lock);
+
+            /* Update stats */
+            if (tenant)
+                qos_stats_inc(tenant->stats.rejected[qos_stats_cmd_index(operation)]);
+            qos_event_record(QOS_EVENT_REJECT, qos_event_limit_for_cmd(operation),
+                             count, limit_val, false);
             
             ereport(ERROR,
                     (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
@@ -120,33 +140,118 @@ qos_track_statement_start(CmdType operation)
             qos_shared_state->backend_status[my_slot].role_oid = GetUserId();
             qos_shared_state->backend_status[my_slot].database_oid = MyDatabaseId;
             qos_shared_state->backend_status[my_slot].cmd_type = operation;
+            qos_shared_state->backend_status[my_slot].statement_start = GetCurrentStatementStartTimestamp();
+            qos_shared_state->backend_status[my_slot].work_mem_kb = work_mem;
         }
     #else
         qos_shared_state->backend_status[MyBackendId - 1].pid = MyProcPid;
         qos_shared_state->backend_status[MyBackendId - 1].role_oid = GetUserId();
         qos_shared_state->backend_status[MyBackendId - 1].database_oid = MyDatabaseId;
         qos_shared_state->backend_status[MyBackendId - 1].cmd_type = operation;
+        qos_shared_state->backend_status[MyBackendId - 1].statement_start = GetCurrentStatementStartTimestamp();
+        qos_shared_state->backend_status[MyBackendId - 1].work_mem_kb = work_mem;
     #endif
         /* Preserve in_transaction state */
+
+        qos_saturation_update(tenant, qos_stats_cmd_index(operation), count + 1, limit_val);
         
         LWLockRelease(qos_shared_state->lock);
+
+        if (tenant)
+            qos_stats_inc(tenant->stats.admitted[qos_stats_cmd_index(operation)]);
+
+        if (shadow_violation)
+        {
+            if (tenant)
+                qos_stats_inc(tenant->stats.shadow_rejected[qos_stats_cmd_index(operation)]);
+            qos_log_shadow_violation(QOS_EVENT_REJECT, qos_event_limit_for_cmd(operation),
+                                     count, limit_val);
+        }
         
         /* Only set tracking flags after successful registration */
         current_statement_type = operation;
         statement_tracked = true;
+        tracked_role_oid = GetUserId();
+        tracked_database_oid = MyDatabaseId;
     }
 }
 
+/*
+ * Track query start - per-queryId concurrency (qos_set_query_limit)
+ *
+ * Called once the statement slot is held. The slot is claimed with an
+ * atomic increment and given back if it went over the limit, so no lock
+ * is taken once the queryId's entry is cached.
+ */
+void
+qos_track_query_start(int64 query_id)
+{
+    QoSQueryEntry *entry;
+    QoSLimits limits;
+    QoSAdmDecision decision;
+    uint32 active;
+    int limit_val;
+
+    if (!qos_enabled || query_slot || query_id == 0)
+        return;
+
+    entry = qos_query_entry(query_id, true);
+    if (!entry)
+        return;
+
+    active = pg_atomic_add_fetch_u32(&entry->active, 1);
+    qos_query_note_active(entry, active);
+    limit_val = entry->max_concurrent;
+
+    if (limit_val > 0 && active > (uint32) limit_val)
+    {
+        limits = qos_get_cached_limits();
+        decision = qos_adm_decide((int) active - 1, limit_val, limits.enforcement_mode);
+
+        if (decision == QOS_ADM_SHADOW_ADMIT)
+        {
+            qos_stats_inc(entry->shadow_rejected);
+            qos_log_shadow_violation(QOS_EVENT_REJECT, QOS_LIMIT_QUERY_MAX_CONCURRENT,
+                                     active - 1, limit_val);
+        }
+        else if (decision == QOS_ADM_REJECT)
+        {
+            pg_atomic_sub_fetch_u32(&entry->active, 1);
+            qos_stats_inc(entry->rejected);
+            qos_event_record(QOS_EVENT_REJECT, QOS_LIMIT_QUERY_MAX_CONCURRENT,
+                             active - 1, limit_val, false);
+
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("qos: maximum concurrent executions of query " INT64_FORMAT " exceeded",
+                            query_id),
+                     errdetail("Current: %u, Maximum: %d", active - 1, limit_val),
+                     errhint("Wait for other executions of this query to complete")));
+        }
+    }
+
+    query_slot = entry;
+}
+
 /*
  * Track statement end - decrement statement-specific counters
  */
 void
 qos_track_statement_end(void)
 {
+    QoSTenantEntry *tenant;
 #ifndef MyBackendId
     int my_slot = -1;
 #endif
-    if (!qos_enabled || !statement_tracked)
+    /* Give back the query slot even if qos.enabled was turned off meanwhile */
+    if (query_slot)
+    {
+        pg_atomic_sub_fetch_u32(&query_slot->active, 1);
+        query_slot = NULL;
+    }
+
+    /* Likewise the statement slot, which CALL/DO hold across transactions */
+    if (!statement_tracked)
         return;
     
     if (qos_shared_state)
@@ -154,7 +259,9 @@ qos_track_statement_end(void)
 #ifndef MyBackendId
     my_slot = qos_get_backend_slot(false);
 #endif
-        LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+        tenant = qos_stats_tenant_entry(tracked_role_oid, tracked_database_oid);
+
+        qos_lock_acquire(LW_EXCLUSIVE);
         
         /* Clear my command type */
 #ifndef MyBackendId
@@ -164,6 +271,8 @@ qos_track_statement_end(void)
         if (qos_shared_state->backend_status[MyBackendId - 1].pid == MyProcPid)
             qos_shared_state->backend_status[MyBackendId - 1].cmd_type = CMD_UNKNOWN;
 #endif
+
+        qos_saturation_release(tenant, qos_stats_cmd_index(current_statement_type));
         
         LWLockRelease(qos_shared_state->lock);
     }
@@ -171,3 +280,12 @@ qos_track_statement_end(void)
     statement_tracked = false;
     current_statement_type = CMD_UNKNOWN;
 }
+
+/*
+ * Is a statement slot currently held by this backend?
+ */
+bool
+qos_statement_is_tracked(void)
+{
+    return statement_tracked;
+}
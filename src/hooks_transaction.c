@@ -15,14 +15,106 @@
 
 #include "postgres.h"
 #include "qos.h"
+#include "admission.h"
 #include "hooks_internal.h"
+#include "stats.h"
+#include "events.h"
 #include "storage/lwlock.h"
 #include "miscadmin.h"
 #include "storage/proc.h"
+#include "storage/procarray.h"
+#include "utils/timestamp.h"
+#include <signal.h>
+#include <errno.h>
 
 /* Per-backend transaction tracking */
 static bool transaction_tracked = false;
 
+/* Tenant the transaction was admitted under (SET ROLE may change the user) */
+static Oid tracked_role_oid = InvalidOid;
+static Oid tracked_database_oid = InvalidOid;
+
+/*
+ * Under qos.idle_tx_slot_policy = terminate_after, find this tenant's
+ * transaction that has been idle in its block for the longest time, at
+ * least qos.idle_tx_timeout, and take its slot: it stops being counted
+ * right away, and the session is terminated once the caller has released
+ * the lock (qos_terminate_idle_transaction). At most one per rejected
+ * transaction. Caller holds qos_shared_state->lock exclusively.
+ *
+ * Sessions of a superuser (after SET ROLE too) are never picked, as with
+ * pg_terminate_backend(). The victim is moved from idle to terminating
+ * with compare-and-swap; if it started a statement meanwhile it keeps its
+ * slot, and once terminating it exits before running another statement.
+ */
+static bool
+qos_reclaim_idle_transaction(pid_t *victim_pid, int64 *victim_idle_ms)
+{
+    TimestampTz cutoff;
+    QoSBackendStatus *victim = NULL;
+    uint32 state;
+    int i;
+
+    cutoff = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), -qos_idle_tx_timeout);
+
+    for (i = 0; i < qos_shared_state->max_backends; i++)
+    {
+        QoSBackendStatus *status = &qos_shared_state->backend_status[i];
+
+        if (status->pid == 0 || status->pid == MyProcPid || !status->in_transaction)
+            continue;
+        if (status->role_oid != GetUserId() || status->database_oid != MyDatabaseId)
+            continue;
+        if (status->session_superuser ||
+            pg_atomic_read_u32(&status->idle_tx_state) != QOS_IDLE_STATE_IDLE)
+            continue;
+        pg_read_barrier();
+        if (status->idle_tx_since == 0 || status->idle_tx_since > cutoff)
+            continue;
+
+        if (victim == NULL || status->idle_tx_since < victim->idle_tx_since)
+            victim = status;
+    }
+
+    if (victim == NULL)
+        return false;
+
+    state = QOS_IDLE_STATE_IDLE;
+    if (!pg_atomic_compare_exchange_u32(&victim->idle_tx_state, &state,
+                                        QOS_IDLE_STATE_TERMINATING))
+        return false;
+
+    *victim_pid = victim->pid;
+    *victim_idle_ms = (GetCurrentTimestamp() - victim->idle_tx_since) / 1000;
+    victim->in_transaction = false;
+
+    return true;
+}
+
+/*
+ * Terminate a session whose slot qos_reclaim_idle_transaction() took, as
+ * pg_terminate_backend() would (no-op if pid is 0). The victim can no longer
+ * start a statement, so it is still idle or already on its way out.
+ */
+static void
+qos_terminate_idle_transaction(pid_t pid, int64 idle_ms)
+{
+    if (pid == 0 || BackendPidGetProc(pid) == NULL)
+        return;
+
+    ereport(LOG,
+            (errmsg("qos: terminating backend %d, idle in transaction for " INT64_FORMAT " ms",
+                    (int) pid, idle_ms),
+             errdetail("qos.idle_tx_slot_policy = terminate_after, max_concurrent_tx reached.")));
+    /* The event names the victim; it belongs to the same tenant as we do */
+    qos_event_record_backend(QOS_EVENT_TERMINATE, QOS_LIMIT_MAX_CONCURRENT_TX,
+                             (int) pid, GetUserId(), MyDatabaseId, 0,
+                             idle_ms, qos_idle_tx_timeout, false);
+
+    if (kill(pid, SIGTERM) != 0 && errno != ESRCH)
+        elog(WARNING, "qos: could not send signal to process %d: %m", (int) pid);
+}
+
 /*
  * Track transaction start
  */
@@ -30,8 +122,14 @@ void
 qos_track_transaction_start(void)
 {
     QoSLimits limits;
+    QoSTenantEntry *tenant;
     int count = 0;
     int i;
+    QoSAdmDecision decision;
+    bool shadow_violation = false;
+    pid_t victim_pid = 0;
+    int64 victim_idle_ms = 0;
+    bool session_superuser;
 #ifndef MyBackendId
     int my_slot = -1;
 #endif
@@ -47,7 +145,13 @@ qos_track_transaction_start(void)
 #ifndef MyBackendId
     my_slot = qos_get_backend_slot(true);
 #endif
-        LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+        /* Resolve the stats entry before locking; counters are atomics */
+        tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+
+        /* Never picked by terminate_after (catalog lookup, so not under the lock) */
+        session_superuser = superuser_arg(GetSessionUserId());
+
+        qos_lock_acquire(LW_EXCLUSIVE);
         
         /* Scan active backends to count current usage */
         for (i = 0; i < qos_shared_state->max_backends; i++)
@@ -71,15 +175,37 @@ qos_track_transaction_start(void)
                 qos_shared_state->backend_status[i].database_oid == MyDatabaseId &&
                 qos_shared_state->backend_status[i].in_transaction)
             {
+                /* Idle in a transaction block: not counted under "exclude" */
+                if (qos_idle_tx_slot_policy == QOS_IDLE_TX_EXCLUDE &&
+                    qos_shared_state->backend_status[i].idle_tx_since != 0)
+                    continue;
                 count++;
             }
         }
         
-        if (count >= limits.max_concurrent_tx)
+        decision = qos_adm_decide(count, limits.max_concurrent_tx, limits.enforcement_mode);
+
+        /* "terminate_after": take the slot of the longest idle transaction instead */
+        if (decision == QOS_ADM_REJECT &&
+            qos_idle_tx_slot_policy == QOS_IDLE_TX_TERMINATE_AFTER &&
+            qos_reclaim_idle_transaction(&victim_pid, &victim_idle_ms))
+        {
+            count--;
+            decision = qos_adm_decide(count, limits.max_concurrent_tx, limits.enforcement_mode);
+        }
+        if (decision == QOS_ADM_SHADOW_ADMIT)
         {
-            qos_shared_state->stats.concurrent_tx_violations++;
-            qos_shared_state->stats.rejected_queries++;
+            shadow_violation = true;
+        }
+        else if (decision == QOS_ADM_REJECT)
+        {
+            qos_saturation_update(tenant, QOS_SATURATION_TX, count, limits.max_concurrent_tx);
             LWLockRelease(qos_shared_state->lock);
+            qos_terminate_idle_transaction(victim_pid, victim_idle_ms);
+            if (tenant)
+                qos_stats_inc(tenant->stats.tx_rejected);
+            qos_event_record(QOS_EVENT_REJECT, QOS_LIMIT_MAX_CONCURRENT_TX,
+                             count, limits.max_concurrent_tx, false);
             
             ereport(ERROR,
                     (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
@@ -95,31 +221,55 @@ qos_track_transaction_start(void)
             qos_shared_state->backend_status[my_slot].role_oid = GetUserId();
             qos_shared_state->backend_status[my_slot].database_oid = MyDatabaseId;
             qos_shared_state->backend_status[my_slot].in_transaction = true;
+            qos_shared_state->backend_status[my_slot].session_superuser = session_superuser;
         }
     #else
         qos_shared_state->backend_status[MyBackendId - 1].pid = MyProcPid;
         qos_shared_state->backend_status[MyBackendId - 1].role_oid = GetUserId();
         qos_shared_state->backend_status[MyBackendId - 1].database_oid = MyDatabaseId;
         qos_shared_state->backend_status[MyBackendId - 1].in_transaction = true;
+        qos_shared_state->backend_status[MyBackendId - 1].session_superuser = session_superuser;
     #endif
+
+        qos_saturation_update(tenant, QOS_SATURATION_TX, count + 1, limits.max_concurrent_tx);
         
         LWLockRelease(qos_shared_state->lock);
+
+        qos_terminate_idle_transaction(victim_pid, victim_idle_ms);
+
+        if (tenant)
+            qos_stats_inc(tenant->stats.tx_admitted);
+
+        if (shadow_violation)
+        {
+            if (tenant)
+                qos_stats_inc(tenant->stats.shadow_tx_rejected);
+            qos_log_shadow_violation(QOS_EVENT_REJECT, QOS_LIMIT_MAX_CONCURRENT_TX,
+                                     count, limits.max_concurrent_tx);
+        }
         
         /* Only set tracking flag after successful increment */
         transaction_tracked = true;
+        tracked_role_oid = GetUserId();
+        tracked_database_oid = MyDatabaseId;
     }
 }
 
 /*
- * Track transaction end
+ * Track transaction end, from qos_xact_callback at commit, prepare or abort
  */
 void
 qos_track_transaction_end(void)
 {
+    QoSTenantEntry *tenant;
 #ifndef MyBackendId
     int my_slot = -1;
 #endif
-    if (!qos_enabled || !transaction_tracked)
+    /*
+     * Give back the slot even if qos.enabled was turned off meanwhile: it is
+     * held across client round-trips, so a reload can land before COMMIT.
+     */
+    if (!transaction_tracked)
         return;
     
     if (qos_shared_state)
@@ -127,7 +277,9 @@ qos_track_transaction_end(void)
 #ifndef MyBackendId
     my_slot = qos_get_backend_slot(false);
 #endif
-        LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
+        tenant = qos_stats_tenant_entry(tracked_role_oid, tracked_database_oid);
+
+        qos_lock_acquire(LW_EXCLUSIVE);
         
         /* Clear my transaction flag */
         if (
@@ -140,10 +292,18 @@ qos_track_transaction_end(void)
         {
     #ifndef MyBackendId
             qos_shared_state->backend_status[my_slot].in_transaction = false;
+            qos_shared_state->backend_status[my_slot].idle_tx_since = 0;
+            pg_atomic_write_u32(&qos_shared_state->backend_status[my_slot].idle_tx_state,
+                                QOS_IDLE_STATE_BUSY);
     #else
             qos_shared_state->backend_status[MyBackendId - 1].in_transaction = false;
+            qos_shared_state->backend_status[MyBackendId - 1].idle_tx_since = 0;
+            pg_atomic_write_u32(&qos_shared_state->backend_status[MyBackendId - 1].idle_tx_state,
+                                QOS_IDLE_STATE_BUSY);
     #endif
         }
+
+        qos_saturation_release(tenant, QOS_SATURATION_TX);
         
         LWLockRelease(qos_shared_state->lock);
     }
@@ -0,0 +1,253 @@
+/*
+ * hwcounters.c - Per-tenant and per-query hardware performance counters
+ *
+ * When qos.track_hw_counters is on, each backend opens one perf event
+ * group on itself (cycles, instructions, last-level cache misses and task
+ * clock) the first time it is needed and keeps it open. The executor hooks
+ * read the group around top-level ExecutorRun/ExecutorFinish calls and the
+ * deltas are charged to the tenant and to the statement's queryId.
+ *
+ * Only user-space events of the backend itself are counted, which works
+ * with the default kernel.perf_event_paranoid = 2. Parallel workers are
+ * separate processes and are not included.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "hwcounters.h"
+#include "queries.h"
+#include "stats.h"
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
+#include <unistd.h>
+
+#define QOS_HW_COUNTERS_COLS 6
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+
+/* Per-backend perf event group; hw_fds[0] is the group leader */
+static int hw_fds[QOS_HW_COUNT] = {-1, -1, -1, -1};
+static bool hw_opened = false;
+static bool hw_unavailable = false;
+
+static bool qos_hw_counters_open(void);
+#endif
+
+PG_FUNCTION_INFO_V1(qos_get_hw_counters);
+
+#ifdef __linux__
+/*
+ * Open the counter group on this backend; on failure, give up for the
+ * rest of the session
+ */
+static bool
+qos_hw_counters_open(void)
+{
+    static const struct
+    {
+        uint32      type;
+        uint64      config;
+    } events[QOS_HW_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+    };
+    int i;
+
+    for (i = 0; i < QOS_HW_COUNT; i++)
+    {
+        struct perf_event_attr pe;
+
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.type = events[i].type;
+        pe.size = sizeof(struct perf_event_attr);
+        pe.config = events[i].config;
+        pe.disabled = (i == 0) ? 1 : 0;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_GROUP |
+                         PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        /* pid 0, cpu -1: this process on any CPU */
+        hw_fds[i] = syscall(__NR_perf_event_open, &pe, 0, -1,
+                            (i == 0) ? -1 : hw_fds[0], PERF_FLAG_FD_CLOEXEC);
+        if (hw_fds[i] == -1)
+        {
+            int save_errno = errno;
+
+            while (--i >= 0)
+            {
+                close(hw_fds[i]);
+                hw_fds[i] = -1;
+            }
+            hw_unavailable = true;
+
+            errno = save_errno;
+            ereport(LOG,
+                    (errmsg("qos: hardware counters unavailable in this backend: %m"),
+                     errhint("Check kernel.perf_event_paranoid and that the server can use perf events.")));
+            return false;
+        }
+    }
+
+    ioctl(hw_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(hw_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    hw_opened = true;
+
+    elog(DEBUG1, "qos: hardware counters opened (pid=%d)", MyProcPid);
+    return true;
+}
+#endif /* __linux__ */
+
+/*
+ * Read this backend's counter group
+ */
+bool
+qos_hw_counters_read(QoSHwSample *sample)
+{
+#ifdef __linux__
+    struct
+    {
+        uint64      nr;
+        uint64      time_enabled;
+        uint64      time_running;
+        uint64      values[QOS_HW_COUNT];
+    } data;
+    int i;
+
+    if (!qos_track_hw_counters || hw_unavailable)
+        return false;
+
+    if (!hw_opened && !qos_hw_counters_open())
+        return false;
+
+    if (read(hw_fds[0], &data, sizeof(data)) != sizeof(data) || data.nr != QOS_HW_COUNT)
+        return false;
+
+    sample->time_enabled = data.time_enabled;
+    sample->time_running = data.time_running;
+    for (i = 0; i < QOS_HW_COUNT; i++)
+        sample->values[i] = data.values[i];
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Charge the counts since start to the current tenant and to query_id
+ */
+void
+qos_hw_counters_record(const QoSHwSample *start, int64 query_id)
+{
+    QoSHwSample end;
+    uint64 delta[QOS_HW_COUNT];
+    uint64 enabled;
+    uint64 running;
+    QoSTenantEntry *tenant;
+    QoSQueryEntry *query;
+    int i;
+
+    if (!qos_hw_counters_read(&end))
+        return;
+
+    enabled = end.time_enabled - start->time_enabled;
+    running = end.time_running - start->time_running;
+
+    for (i = 0; i < QOS_HW_COUNT; i++)
+    {
+        delta[i] = end.values[i] - start->values[i];
+
+        /* Scale up if the PMU was shared with other events (multiplexing) */
+        if (running > 0 && running < enabled)
+            delta[i] = (uint64) ((double) delta[i] * ((double) enabled / (double) running));
+    }
+
+    tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+    if (tenant)
+    {
+        qos_stats_add(tenant->hw.cycles, delta[QOS_HW_CYCLES]);
+        qos_stats_add(tenant->hw.instructions, delta[QOS_HW_INSTRUCTIONS]);
+        qos_stats_add(tenant->hw.llc_misses, delta[QOS_HW_LLC_MISSES]);
+        qos_stats_add(tenant->hw.task_clock_ns, delta[QOS_HW_TASK_CLOCK]);
+    }
+
+    query = qos_query_entry(query_id, true);
+    if (query)
+    {
+        qos_stats_add(query->hw.cycles, delta[QOS_HW_CYCLES]);
+        qos_stats_add(query->hw.instructions, delta[QOS_HW_INSTRUCTIONS]);
+        qos_stats_add(query->hw.llc_misses, delta[QOS_HW_LLC_MISSES]);
+        qos_stats_add(query->hw.task_clock_ns, delta[QOS_HW_TASK_CLOCK]);
+    }
+}
+
+/*
+ * qos_get_hw_counters() - hardware counter totals per tenant
+ */
+Datum
+qos_get_hw_counters(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        Datum values[QOS_HW_COUNTERS_COLS];
+        bool nulls[QOS_HW_COUNTERS_COLS];
+
+        if (!entry->in_use || qos_stats_read(entry->hw.task_clock_ns) == 0)
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        if (i == qos_tenant_table->max_tenants)
+        {
+            /* Overflow entry has no owner */
+            nulls[0] = true;
+            nulls[1] = true;
+        }
+        else
+        {
+            values[0] = ObjectIdGetDatum(entry->role_oid);
+            values[1] = ObjectIdGetDatum(entry->database_oid);
+        }
+
+        values[2] = Int64GetDatum((int64) qos_stats_read(entry->hw.cycles));
+        values[3] = Int64GetDatum((int64) qos_stats_read(entry->hw.instructions));
+        values[4] = Int64GetDatum((int64) qos_stats_read(entry->hw.llc_misses));
+        values[5] = Int64GetDatum((int64) qos_stats_read(entry->hw.task_clock_ns));
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
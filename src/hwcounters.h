@@ -0,0 +1,49 @@
+/*
+ * hwcounters.h - PostgreSQL Quality of Service (QoS) Extension HW Counters
+ *
+ * This header file contains the declarations for per-backend hardware
+ * performance counters (Linux perf_event_open on the backend itself).
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_HWCOUNTERS_H
+#define QOS_HWCOUNTERS_H
+
+#include "postgres.h"
+#include "qos.h"
+
+typedef enum QoSHwCounter
+{
+    QOS_HW_CYCLES = 0,
+    QOS_HW_INSTRUCTIONS,
+    QOS_HW_LLC_MISSES,
+    QOS_HW_TASK_CLOCK,
+    QOS_HW_COUNT
+} QoSHwCounter;
+
+/* One reading of the counter group */
+typedef struct QoSHwSample
+{
+    uint64      values[QOS_HW_COUNT];
+    uint64      time_enabled;   /* For scaling when the PMU was multiplexed */
+    uint64      time_running;
+} QoSHwSample;
+
+/*
+ * Read this backend's counters, opening them on first use. Returns false
+ * when qos.track_hw_counters is off or perf events are unavailable.
+ */
+extern bool qos_hw_counters_read(QoSHwSample *sample);
+
+/* Charge the counts since start to the current tenant and to query_id */
+extern void qos_hw_counters_record(const QoSHwSample *start, int64 query_id);
+
+#endif /* QOS_HWCOUNTERS_H */
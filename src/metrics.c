@@ -0,0 +1,473 @@
+/*
+ * metrics.c - Prometheus exposition of QoS statistics
+ *
+ * This file implements qos_metrics(), which renders every per-tenant
+ * counter, gauge and latency histogram in the Prometheus text format.
+ * Shared memory is read once into a local snapshot under a shared lock;
+ * name lookups and formatting happen after the lock is released.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "qos.h"
+#include "stats.h"
+#include "miscadmin.h"
+#include "commands/dbcommands.h"
+#include "lib/stringinfo.h"
+#include "storage/lwlock.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+/* Hash key for mapping backends onto snapshot tenants */
+typedef struct QoSMetricsKey
+{
+    Oid     role_oid;
+    Oid     database_oid;
+} QoSMetricsKey;
+
+/* One tenant in the local snapshot */
+typedef struct QoSMetricsTenant
+{
+    QoSMetricsKey key;              /* Hash key, must be first */
+    QoSTenantEntry *entry;          /* Copied entry in the snapshot */
+    char   *labels;                 /* Preformatted role="..",database=".." */
+    int     active[QOS_CMD_COUNT];  /* Backends running a statement */
+    int     active_tx;              /* Backends holding a transaction slot */
+    int     assigned_cores;         /* Cores in the tenant's affinity entry */
+} QoSMetricsTenant;
+
+PG_FUNCTION_INFO_V1(qos_metrics);
+
+static const char *const qos_cmd_labels[QOS_CMD_COUNT] = {
+    "select", "update", "delete", "insert"
+};
+
+static const char *const qos_saturation_labels[QOS_SATURATION_COUNT] = {
+    "select", "update", "delete", "insert", "transaction"
+};
+
+static void
+qos_metrics_append_label_value(StringInfo buf, const char *value)
+{
+    const char *p;
+
+    for (p = value; *p != '\0'; p++)
+    {
+        if (*p == '\\' || *p == '"')
+        {
+            appendStringInfoChar(buf, '\\');
+            appendStringInfoChar(buf, *p);
+        }
+        else if (*p == '\n')
+            appendStringInfoString(buf, "\\n");
+        else
+            appendStringInfoChar(buf, *p);
+    }
+}
+
+static char *
+qos_metrics_tenant_labels(Oid role_oid, Oid database_oid, bool overflow)
+{
+    StringInfoData buf;
+    char *rolname = NULL;
+    char *datname = NULL;
+    char oidbuf[16];
+
+    if (!overflow)
+    {
+        rolname = GetUserNameFromId(role_oid, true);
+        datname = get_database_name(database_oid);
+    }
+
+    initStringInfo(&buf);
+    appendStringInfoString(&buf, "role=\"");
+    if (overflow)
+        appendStringInfoString(&buf, "overflow");
+    else if (rolname)
+        qos_metrics_append_label_value(&buf, rolname);
+    else
+    {
+        snprintf(oidbuf, sizeof(oidbuf), "%u", role_oid);
+        appendStringInfoString(&buf, oidbuf);
+    }
+
+    appendStringInfoString(&buf, "\",database=\"");
+    if (overflow)
+        appendStringInfoString(&buf, "overflow");
+    else if (datname)
+        qos_metrics_append_label_value(&buf, datname);
+    else
+    {
+        snprintf(oidbuf, sizeof(oidbuf), "%u", database_oid);
+        appendStringInfoString(&buf, oidbuf);
+    }
+    appendStringInfoChar(&buf, '"');
+
+    return buf.data;
+}
+
+static void
+qos_metrics_header(StringInfo buf, const char *name, const char *type, const char *help)
+{
+    appendStringInfo(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Emit one per-command counter family (admitted/rejected/throttled)
+ */
+static void
+qos_metrics_cmd_counter(StringInfo buf, QoSMetricsTenant **tenants, int ntenants,
+                        const char *name, const char *help, size_t field_offset)
+{
+    int i;
+    int cmd;
+
+    qos_metrics_header(buf, name, "counter", help);
+    for (i = 0; i < ntenants; i++)
+    {
+        pg_atomic_uint64 *counters =
+            (pg_atomic_uint64 *) ((char *) &tenants[i]->entry->stats + field_offset);
+
+        for (cmd = 0; cmd < QOS_CMD_COUNT; cmd++)
+            appendStringInfo(buf, "%s{%s,command=\"%s\"} " UINT64_FORMAT "\n",
+                             name, tenants[i]->labels, qos_cmd_labels[cmd],
+                             qos_stats_read(counters[cmd]));
+    }
+}
+
+/*
+ * Emit one scalar per-tenant counter family
+ */
+static void
+qos_metrics_tenant_counter(StringInfo buf, QoSMetricsTenant **tenants, int ntenants,
+                           const char *name, const char *help, size_t field_offset)
+{
+    int i;
+
+    qos_metrics_header(buf, name, "counter", help);
+    for (i = 0; i < ntenants; i++)
+    {
+        pg_atomic_uint64 *counter =
+            (pg_atomic_uint64 *) ((char *) &tenants[i]->entry->stats + field_offset);
+
+        appendStringInfo(buf, "%s{%s} " UINT64_FORMAT "\n",
+                         name, tenants[i]->labels, qos_stats_read(*counter));
+    }
+}
+
+/*
+ * Emit one saturation family (slot label per max_concurrent_* limit);
+ * microsecond counters are scaled to seconds
+ */
+static void
+qos_metrics_saturation(StringInfo buf, QoSMetricsTenant **tenants, int ntenants,
+                       const char *name, const char *type, const char *help,
+                       size_t field_offset, bool to_seconds)
+{
+    int i;
+    int slot;
+
+    qos_metrics_header(buf, name, type, help);
+    for (i = 0; i < ntenants; i++)
+    {
+        pg_atomic_uint64 *counters =
+            (pg_atomic_uint64 *) ((char *) &tenants[i]->entry->saturation + field_offset);
+
+        for (slot = 0; slot < QOS_SATURATION_COUNT; slot++)
+        {
+            if (to_seconds)
+                appendStringInfo(buf, "%s{%s,slot=\"%s\"} %.6f\n",
+                                 name, tenants[i]->labels, qos_saturation_labels[slot],
+                                 (double) qos_stats_read(counters[slot]) / 1000000.0);
+            else
+                appendStringInfo(buf, "%s{%s,slot=\"%s\"} " UINT64_FORMAT "\n",
+                                 name, tenants[i]->labels, qos_saturation_labels[slot],
+                                 qos_stats_read(counters[slot]));
+        }
+    }
+}
+
+/*
+ * Emit latency histograms. Buckets are folded to power-of-two boundaries
+ * and cut after the highest non-empty one to keep the output compact.
+ */
+static void
+qos_metrics_latency(StringInfo buf, QoSMetricsTenant **tenants, int ntenants)
+{
+    const char *name = "qos_latency_seconds";
+    int i;
+    int kind;
+
+    qos_metrics_header(buf, name, "histogram",
+                       "QoS admission, planning and executor latency");
+
+    for (i = 0; i < ntenants; i++)
+    {
+        for (kind = 0; kind < QOS_LATENCY_COUNT; kind++)
+        {
+            QoSHistogram *hist = &tenants[i]->entry->latency[kind];
+            uint64 buckets[QOS_HIST_BUCKETS];
+            uint64 cumulative = 0;
+            int last = -1;
+            int b;
+
+            for (b = 0; b < QOS_HIST_BUCKETS; b++)
+            {
+                buckets[b] = qos_stats_read(hist->buckets[b]);
+                if (buckets[b] > 0)
+                    last = b;
+            }
+
+            if (last < 0)
+                continue;
+
+            for (b = 0; b <= last; b++)
+            {
+                uint64 lower;
+                uint64 upper;
+
+                cumulative += buckets[b];
+                if (b % QOS_HIST_SUB_BUCKETS != QOS_HIST_SUB_BUCKETS - 1 && b != last)
+                    continue;
+
+                /* Round the partial last group up to its power-of-two boundary */
+                qos_hist_bucket_bounds(b - (b % QOS_HIST_SUB_BUCKETS) +
+                                       QOS_HIST_SUB_BUCKETS - 1, &lower, &upper);
+                appendStringInfo(buf, "%s_bucket{%s,kind=\"%s\",le=\"%.6f\"} " UINT64_FORMAT "\n",
+                                 name, tenants[i]->labels,
+                                 qos_latency_kind_name((QoSLatencyKind) kind),
+                                 (double) upper / 1000000.0, cumulative);
+            }
+
+            appendStringInfo(buf, "%s_bucket{%s,kind=\"%s\",le=\"+Inf\"} " UINT64_FORMAT "\n",
+                             name, tenants[i]->labels,
+                             qos_latency_kind_name((QoSLatencyKind) kind), cumulative);
+            appendStringInfo(buf, "%s_sum{%s,kind=\"%s\"} %.6f\n",
+                             name, tenants[i]->labels,
+                             qos_latency_kind_name((QoSLatencyKind) kind),
+                             (double) qos_stats_read(hist->sum) / 1000000.0);
+            appendStringInfo(buf, "%s_count{%s,kind=\"%s\"} " UINT64_FORMAT "\n",
+                             name, tenants[i]->labels,
+                             qos_latency_kind_name((QoSLatencyKind) kind), cumulative);
+        }
+    }
+}
+
+/*
+ * qos_metrics() - all QoS metrics in Prometheus text exposition format
+ */
+Datum
+qos_metrics(PG_FUNCTION_ARGS)
+{
+    StringInfoData buf;
+    QoSTenantEntry *entries;
+    QoSBackendStatus *backends;
+    QoSAffinityEntry *affinity;
+    QoSMetricsTenant **tenants;
+    QoSMetricsTenant *overflow = NULL;
+    HTAB *tenant_hash;
+    HASHCTL ctl;
+    int max_tenants;
+    int num_tenants;
+    int max_backends;
+    int ntenants = 0;
+    int tracked_backends = 0;
+    int i;
+    int cmd;
+
+    initStringInfo(&buf);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        PG_RETURN_TEXT_P(cstring_to_text(buf.data));
+
+    max_tenants = qos_tenant_table->max_tenants;
+    max_backends = qos_shared_state->max_backends;
+    entries = palloc(mul_size(max_tenants + 1, sizeof(QoSTenantEntry)));
+    backends = palloc(mul_size(max_backends, sizeof(QoSBackendStatus)));
+    affinity = palloc(sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+
+    /* Single pass over shared memory */
+    qos_lock_acquire(LW_SHARED);
+    num_tenants = qos_tenant_table->num_tenants;
+    memcpy(entries, qos_tenant_table->entries, mul_size(num_tenants, sizeof(QoSTenantEntry)));
+    memcpy(&entries[max_tenants], &qos_tenant_table->entries[max_tenants], sizeof(QoSTenantEntry));
+    memcpy(backends, qos_shared_state->backend_status,
+           mul_size(max_backends, sizeof(QoSBackendStatus)));
+    memcpy(affinity, qos_shared_state->affinity_entries,
+           sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+    LWLockRelease(qos_shared_state->lock);
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(QoSMetricsKey);
+    ctl.entrysize = sizeof(QoSMetricsTenant);
+    ctl.hcxt = CurrentMemoryContext;
+    tenant_hash = hash_create("qos metrics tenants", num_tenants + 1, &ctl,
+                              HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    tenants = palloc(sizeof(QoSMetricsTenant *) * (num_tenants + 1));
+
+    for (i = 0; i < num_tenants; i++)
+    {
+        QoSMetricsKey key;
+        QoSMetricsTenant *tenant;
+        bool found;
+
+        key.role_oid = entries[i].role_oid;
+        key.database_oid = entries[i].database_oid;
+        tenant = hash_search(tenant_hash, &key, HASH_ENTER, &found);
+        if (found)
+            continue;
+
+        memset((char *) tenant + sizeof(QoSMetricsKey), 0,
+               sizeof(QoSMetricsTenant) - sizeof(QoSMetricsKey));
+        tenant->entry = &entries[i];
+        tenant->labels = qos_metrics_tenant_labels(key.role_oid, key.database_oid, false);
+        tenants[ntenants++] = tenant;
+    }
+
+    if (entries[max_tenants].in_use)
+    {
+        overflow = palloc0(sizeof(QoSMetricsTenant));
+        overflow->entry = &entries[max_tenants];
+        overflow->labels = qos_metrics_tenant_labels(InvalidOid, InvalidOid, true);
+        tenants[ntenants++] = overflow;
+    }
+
+    /* Gauges derived from backend_status[] and affinity_entries[] */
+    for (i = 0; i < max_backends; i++)
+    {
+        QoSMetricsKey key;
+        QoSMetricsTenant *tenant;
+        int idx;
+
+        if (backends[i].pid == 0)
+            continue;
+        tracked_backends++;
+
+        key.role_oid = backends[i].role_oid;
+        key.database_oid = backends[i].database_oid;
+        tenant = hash_search(tenant_hash, &key, HASH_FIND, NULL);
+        if (!tenant)
+            tenant = overflow;
+        if (!tenant)
+            continue;
+
+        idx = qos_stats_cmd_index(backends[i].cmd_type);
+        if (idx >= 0)
+            tenant->active[idx]++;
+        if (backends[i].in_transaction)
+            tenant->active_tx++;
+    }
+
+    for (i = 0; i < MAX_AFFINITY_ENTRIES; i++)
+    {
+        QoSMetricsKey key;
+        QoSMetricsTenant *tenant;
+
+        if (affinity[i].num_cores <= 0)
+            continue;
+
+        key.role_oid = affinity[i].role_oid;
+        key.database_oid = affinity[i].database_oid;
+        tenant = hash_search(tenant_hash, &key, HASH_FIND, NULL);
+        if (tenant)
+            tenant->assigned_cores = affinity[i].num_cores;
+    }
+
+    /* Counters */
+    qos_metrics_cmd_counter(&buf, tenants, ntenants, "qos_statements_admitted_total",
+                            "Statements admitted past QoS concurrency checks",
+                            offsetof(QoSStats, admitted));
+    qos_metrics_cmd_counter(&buf, tenants, ntenants, "qos_statements_rejected_total",
+                            "Statements rejected by qos.max_concurrent_*",
+                            offsetof(QoSStats, rejected));
+    qos_metrics_cmd_counter(&buf, tenants, ntenants, "qos_statements_throttled_total",
+                            "Plans whose parallel workers were reduced by qos.cpu_core_limit",
+                            offsetof(QoSStats, throttled));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_transactions_admitted_total",
+                               "Transactions admitted under qos.max_concurrent_tx",
+                               offsetof(QoSStats, tx_admitted));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_transactions_rejected_total",
+                               "Transactions rejected by qos.max_concurrent_tx",
+                               offsetof(QoSStats, tx_rejected));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_work_mem_caps_total",
+                               "work_mem values capped or rejected by qos.work_mem_limit",
+                               offsetof(QoSStats, work_mem_caps));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_cpu_pinnings_total",
+                               "Backend CPU affinity changes",
+                               offsetof(QoSStats, cpu_pinnings));
+    qos_metrics_cmd_counter(&buf, tenants, ntenants, "qos_statements_shadow_rejected_total",
+                            "Statements qos.max_concurrent_* would have rejected (shadow mode)",
+                            offsetof(QoSStats, shadow_rejected));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_transactions_shadow_rejected_total",
+                               "Transactions qos.max_concurrent_tx would have rejected (shadow mode)",
+                               offsetof(QoSStats, shadow_tx_rejected));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_statements_shadow_throttled_total",
+                               "Plans whose parallel workers would have been reduced (shadow mode)",
+                               offsetof(QoSStats, shadow_throttled));
+    qos_metrics_tenant_counter(&buf, tenants, ntenants, "qos_work_mem_shadow_caps_total",
+                               "work_mem values qos.work_mem_limit would have capped (shadow mode)",
+                               offsetof(QoSStats, shadow_work_mem_caps));
+
+    /* Saturation */
+    qos_metrics_saturation(&buf, tenants, ntenants, "qos_concurrency_peak", "gauge",
+                           "Highest concurrent statements or transactions since reset",
+                           offsetof(QoSSaturation, peak), false);
+    qos_metrics_saturation(&buf, tenants, ntenants, "qos_concurrency_observed_seconds_total", "counter",
+                           "Time covered by the QoS occupancy counters",
+                           offsetof(QoSSaturation, observed_us), true);
+    qos_metrics_saturation(&buf, tenants, ntenants, "qos_concurrency_occupancy_seconds_total", "counter",
+                           "Integral of concurrent statements or transactions over time",
+                           offsetof(QoSSaturation, occupancy_us), true);
+    qos_metrics_saturation(&buf, tenants, ntenants, "qos_concurrency_at_limit_seconds_total", "counter",
+                           "Time spent at or above qos.max_concurrent_*",
+                           offsetof(QoSSaturation, at_limit_us), true);
+
+    /* Gauges */
+    qos_metrics_header(&buf, "qos_active_statements", "gauge",
+                       "Statements currently holding a QoS slot");
+    for (i = 0; i < ntenants; i++)
+        for (cmd = 0; cmd < QOS_CMD_COUNT; cmd++)
+            appendStringInfo(&buf, "qos_active_statements{%s,command=\"%s\"} %d\n",
+                             tenants[i]->labels, qos_cmd_labels[cmd], tenants[i]->active[cmd]);
+
+    qos_metrics_header(&buf, "qos_active_transactions", "gauge",
+                       "Transactions currently holding a QoS slot");
+    for (i = 0; i < ntenants; i++)
+        appendStringInfo(&buf, "qos_active_transactions{%s} %d\n",
+                         tenants[i]->labels, tenants[i]->active_tx);
+
+    qos_metrics_header(&buf, "qos_assigned_cores", "gauge",
+                       "CPU cores assigned to the tenant by qos.cpu_core_limit");
+    for (i = 0; i < ntenants; i++)
+        appendStringInfo(&buf, "qos_assigned_cores{%s} %d\n",
+                         tenants[i]->labels, tenants[i]->assigned_cores);
+
+    qos_metrics_header(&buf, "qos_tenant_entries", "gauge",
+                       "Tenant statistics entries in use");
+    appendStringInfo(&buf, "qos_tenant_entries %d\n", num_tenants);
+    qos_metrics_header(&buf, "qos_tenant_entries_max", "gauge",
+                       "Tenant statistics capacity (qos.max_tenants)");
+    appendStringInfo(&buf, "qos_tenant_entries_max %d\n", max_tenants);
+    qos_metrics_header(&buf, "qos_backend_slots", "gauge",
+                       "Backend status slots in use");
+    appendStringInfo(&buf, "qos_backend_slots %d\n", tracked_backends);
+    qos_metrics_header(&buf, "qos_backend_slots_max", "gauge",
+                       "Backend status slot capacity");
+    appendStringInfo(&buf, "qos_backend_slots_max %d\n", max_backends);
+
+    /* Histograms */
+    qos_metrics_latency(&buf, tenants, ntenants);
+
+    hash_destroy(tenant_hash);
+
+    PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
@@ -19,6 +19,10 @@
 #include "fmgr.h"
 #include "qos.h"
 #include "hooks.h"
+#include "stats.h"
+#include "events.h"
+#include "queries.h"
+#include "history.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "storage/lwlock.h"
@@ -37,6 +41,7 @@
 #include "access/table.h"
 #include "utils/fmgroids.h"
 #include "utils/rel.h"
+#include "utils/wait_event.h"
 #include "catalog/indexing.h"
 #include <strings.h>
 #include <ctype.h>
@@ -51,6 +56,22 @@ QoSSharedState *qos_shared_state = NULL;
 
 /* GUC variables */
 bool qos_enabled = true;
+int qos_max_tenants = 256;
+bool qos_save_stats = true;
+bool qos_track_overhead = false;
+bool qos_track_hw_counters = false;
+int qos_max_queries = 1000;
+int qos_event_buffer_size = 1024;
+int qos_history_interval = 10;
+int qos_idle_tx_slot_policy = QOS_IDLE_TX_COUNT;
+int qos_idle_tx_timeout = 60000;
+
+static const struct config_enum_entry qos_idle_tx_slot_policy_options[] = {
+    {"count", QOS_IDLE_TX_COUNT, false},
+    {"exclude", QOS_IDLE_TX_EXCLUDE, false},
+    {"terminate_after", QOS_IDLE_TX_TERMINATE_AFTER, false},
+    {NULL, 0, false}
+};
 
 /* Hook save variables */
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
@@ -65,7 +86,18 @@ static const char *qos_valid_param_hint =
     "Valid parameters: qos.work_mem_limit, qos.cpu_core_limit, "
     "qos.max_concurrent_tx, qos.max_concurrent_select, "
     "qos.max_concurrent_update, qos.max_concurrent_delete, "
-    "qos.max_concurrent_insert, qos.work_mem_error_level";
+    "qos.max_concurrent_insert, qos.work_mem_error_level, qos.enforcement";
+
+/* Custom wait event names, indexed by QoSWaitEvent */
+static const char *const qos_wait_event_names[QOS_WAIT_EVENT_COUNT] = {
+    "QosCpuSample",
+    "QosHistoryMain"
+};
+
+#if PG_VERSION_NUM >= 170000
+/* Wait event IDs allocated on first use (per backend, shared registry) */
+static uint32 qos_wait_event_ids[QOS_WAIT_EVENT_COUNT];
+#endif
 
 static char *qos_trim_whitespace(char *str);
 static bool qos_parse_int32_value(const char *value_str, int *out,
@@ -76,6 +108,8 @@ static bool qos_parse_memory_value(const char *value_str, int64 *out,
                                    const char *param_name, bool strict);
 static bool qos_parse_work_mem_error_level(const char *value_str,
                                            const char *param_name, bool strict);
+static bool qos_parse_enforcement_mode(const char *value_str, int *out,
+                                       const char *param_name, bool strict);
 static bool qos_is_valid_qos_param_name_internal(const char *name);
 
 bool qos_is_valid_qos_param_name(const char *name);
@@ -83,32 +117,32 @@ bool qos_apply_qos_param_value(QoSLimits *limits, const char *name,
                                const char *value, bool strict);
 
 PG_FUNCTION_INFO_V1(qos_version);
-PG_FUNCTION_INFO_V1(qos_get_stats);
-PG_FUNCTION_INFO_V1(qos_reset_stats);
 
 Datum
 qos_version(PG_FUNCTION_ARGS)
 {
-    PG_RETURN_TEXT_P(cstring_to_text("PostgreSQL QoS Resource Governor 1.0"));
-}
-
-Datum
-qos_get_stats(PG_FUNCTION_ARGS)
-{
-    /* TODO: Return current QoS statistics */
-    PG_RETURN_TEXT_P(cstring_to_text("not implemented yet"));
+    PG_RETURN_TEXT_P(cstring_to_text("PostgreSQL QoS Resource Governor 1.1"));
 }
 
-Datum
-qos_reset_stats(PG_FUNCTION_ARGS)
+/*
+ * Wait event to report around a QoS sleep.
+ *
+ * PG17+ registers named custom wait events (shown as Extension/QosCpuSample
+ * etc. in pg_stat_activity); WaitEventExtensionNew() returns the same ID for
+ * the same name in every backend. Older versions report the generic
+ * Extension wait event.
+ */
+uint32
+qos_wait_event(QoSWaitEvent event)
 {
-    if (qos_shared_state)
-    {
-        LWLockAcquire(qos_shared_state->lock, LW_EXCLUSIVE);
-        memset(&qos_shared_state->stats, 0, sizeof(QoSStats));
-        LWLockRelease(qos_shared_state->lock);
-    }
-    PG_RETURN_VOID();
+#if PG_VERSION_NUM >= 170000
+    if (qos_wait_event_ids[event] == 0)
+        qos_wait_event_ids[event] = WaitEventExtensionNew(qos_wait_event_names[event]);
+    return qos_wait_event_ids[event];
+#else
+    (void) qos_wait_event_names;
+    return PG_WAIT_EXTENSION;
+#endif
 }
 
 /*
@@ -127,6 +161,10 @@ qos_shmem_request(void)
     size = add_size(size, mul_size(MaxBackends, sizeof(QoSBackendStatus)));
     
     RequestAddinShmemSpace(MAXALIGN(size));
+    RequestAddinShmemSpace(qos_stats_shmem_size());
+    RequestAddinShmemSpace(qos_events_shmem_size());
+    qos_queries_shmem_request();
+    qos_history_shmem_request();
     RequestNamedLWLockTranche("qos", 1);
 }
 
@@ -179,8 +217,31 @@ qos_shmem_startup(void)
             qos_shared_state->backend_status[i].database_oid = InvalidOid;
             qos_shared_state->backend_status[i].cmd_type = CMD_UNKNOWN;
             qos_shared_state->backend_status[i].in_transaction = false;
+            pg_atomic_init_u32(&qos_shared_state->backend_status[i].idle_tx_state,
+                               QOS_IDLE_STATE_BUSY);
+        }
+
+        for (i = 0; i < QOS_OVERHEAD_COUNT; i++)
+            qos_hist_init(&qos_shared_state->overhead[i]);
+
+        for (i = 0; i < QOS_MAX_CPUS; i++)
+        {
+            pg_atomic_init_u64(&qos_shared_state->cpu_samples[i].cycles, 0);
+            pg_atomic_init_u64(&qos_shared_state->cpu_samples[i].sample_time, 0);
         }
     }
+
+    /* Per-tenant statistics table */
+    qos_stats_shmem_init();
+
+    /* Recent enforcement events */
+    qos_events_shmem_init();
+
+    /* Per-queryId statistics */
+    qos_queries_shmem_init();
+
+    /* Statistics history (qos.history_interval) */
+    qos_history_shmem_init();
     
     LWLockRelease(AddinShmemInitLock);
 }
@@ -384,6 +445,33 @@ invalid:
     return false;
 }
 
+static bool
+qos_parse_enforcement_mode(const char *value_str, int *out,
+                           const char *param_name, bool strict)
+{
+    if (value_str == NULL || *value_str == '\0')
+        goto invalid;
+
+    if (pg_strcasecmp(value_str, "off") == 0)
+        *out = QOS_ENFORCEMENT_OFF;
+    else if (pg_strcasecmp(value_str, "shadow") == 0)
+        *out = QOS_ENFORCEMENT_SHADOW;
+    else if (pg_strcasecmp(value_str, "on") == 0)
+        *out = QOS_ENFORCEMENT_ON;
+    else
+        goto invalid;
+    return true;
+
+invalid:
+    if (strict)
+        ereport(ERROR,
+                (errmsg("qos: invalid value for %s: \"%s\"", param_name, value_str),
+                 errdetail("Expected \"off\", \"shadow\" or \"on\".")));
+    else
+        elog(DEBUG1, "qos: invalid value for %s: \"%s\" (ignored)", param_name, value_str);
+    return false;
+}
+
 static bool
 qos_is_valid_qos_param_name_internal(const char *name)
 {
@@ -406,8 +494,18 @@ qos_is_valid_qos_param_name_internal(const char *name)
         return true;
     if (strcmp(name, "qos.enabled") == 0)
         return true;
+    if (strcmp(name, "qos.track_overhead") == 0)
+        return true;
+    if (strcmp(name, "qos.track_hw_counters") == 0)
+        return true;
+    if (strcmp(name, "qos.idle_tx_slot_policy") == 0)
+        return true;
+    if (strcmp(name, "qos.idle_tx_timeout") == 0)
+        return true;
     if (strcmp(name, "qos.work_mem_error_level") == 0)
         return true;
+    if (strcmp(name, "qos.enforcement") == 0)
+        return true;
 
     return false;
 }
@@ -566,6 +664,19 @@ qos_apply_qos_param_value(QoSLimits *limits, const char *name,
         return true;
     }
 
+    if (strcmp(name, "qos.enforcement") == 0)
+    {
+        if (!qos_parse_enforcement_mode(trimmed_value, &parsed_int, name, strict))
+        {
+            pfree(value_copy);
+            return false;
+        }
+        if (limits)
+            limits->enforcement_mode = parsed_int;
+        pfree(value_copy);
+        return true;
+    }
+
     if (value_copy)
         pfree(value_copy);
     return false;
@@ -592,6 +703,7 @@ qos_get_role_limits(Oid roleId)
     limits.max_concurrent_delete = -1;
     limits.max_concurrent_insert = -1;
     limits.work_mem_error_level = -1;
+    limits.enforcement_mode = -1;
     
     /* Open pg_db_role_setting catalog */
     pg_db_role_setting_rel = table_open(DbRoleSettingRelationId, AccessShareLock);
@@ -656,6 +768,7 @@ qos_get_database_limits(Oid dbId)
     limits.max_concurrent_delete = -1;
     limits.max_concurrent_insert = -1;
     limits.work_mem_error_level = -1;
+    limits.enforcement_mode = -1;
     
     /* Open pg_db_role_setting catalog */
     pg_db_role_setting_rel = table_open(DbRoleSettingRelationId, AccessShareLock);
@@ -721,6 +834,7 @@ qos_get_role_db_limits(Oid roleId, Oid dbId)
     limits.max_concurrent_delete = -1;
     limits.max_concurrent_insert = -1;
     limits.work_mem_error_level = -1;
+    limits.enforcement_mode = -1;
     
     /* Skip if either OID is invalid */
     if (!OidIsValid(roleId) || !OidIsValid(dbId))
@@ -811,6 +925,100 @@ void _PG_init(void)
                             0,
                             NULL, NULL, NULL);
 
+    DefineCustomIntVariable("qos.max_tenants",
+                            "Maximum number of role/database pairs tracked in QoS statistics",
+                            NULL,
+                            &qos_max_tenants,
+                            256,
+                            1,
+                            65536,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("qos.event_buffer_size",
+                            "Number of recent enforcement events kept for qos_recent_events()",
+                            NULL,
+                            &qos_event_buffer_size,
+                            1024,
+                            16,
+                            1048576,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("qos.track_overhead",
+                            "Time the QoS hooks and lock waits (see qos_overhead())",
+                            NULL,
+                            &qos_track_overhead,
+                            false,
+                            PGC_SUSET,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("qos.track_hw_counters",
+                            "Count CPU cycles, instructions, LLC misses and task clock per tenant and queryId",
+                            NULL,
+                            &qos_track_hw_counters,
+                            false,
+                            PGC_SUSET,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("qos.max_queries",
+                            "Maximum number of queryIds tracked in QoS query statistics",
+                            NULL,
+                            &qos_max_queries,
+                            1000,
+                            100,
+                            100000,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("qos.history_interval",
+                            "Seconds between statistics history samples (0 disables the history worker)",
+                            NULL,
+                            &qos_history_interval,
+                            10,
+                            0,
+                            3600,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_S,
+                            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("qos.save_stats",
+                            "Save QoS statistics across server shutdowns",
+                            NULL,
+                            &qos_save_stats,
+                            true,
+                            PGC_SIGHUP,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomEnumVariable("qos.idle_tx_slot_policy",
+                             "How sessions idle in a transaction block count against max_concurrent_tx",
+                             "count keeps their slot, exclude does not count them, terminate_after "
+                             "terminates those idle longer than qos.idle_tx_timeout when a "
+                             "transaction of the same tenant would be rejected.",
+                             &qos_idle_tx_slot_policy,
+                             QOS_IDLE_TX_COUNT,
+                             qos_idle_tx_slot_policy_options,
+                             PGC_SIGHUP,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("qos.idle_tx_timeout",
+                            "Idle time after which qos.idle_tx_slot_policy = terminate_after may terminate a transaction",
+                            NULL,
+                            &qos_idle_tx_timeout,
+                            60000,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
     /* Register shmem hooks */
     prev_shmem_request_hook = shmem_request_hook;
     shmem_request_hook = qos_shmem_request;
@@ -821,6 +1029,9 @@ void _PG_init(void)
     /* Register execution hooks */
     qos_register_hooks();
 
+    /* Statistics history worker */
+    qos_history_register_worker();
+
     elog(INFO, "PostgreSQL QoS Resource Governor loaded");
 }
 
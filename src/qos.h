@@ -20,9 +20,11 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "port/atomics.h"
 #include "storage/lwlock.h"
 #include "storage/shmem.h"
 #include "nodes/nodes.h"
+#include "datatype/timestamp.h"
 
 /* QoS Limits Structure */
 typedef struct QoSLimits
@@ -37,6 +39,7 @@ typedef struct QoSLimits
     int     max_concurrent_delete; /* Max concurrent DELETE statements (-1 = no limit) */
     int     max_concurrent_insert; /* Max concurrent INSERT statements (-1 = no limit) */
     int     work_mem_error_level;  /* QoS work_mem violation severity (-1 = unset) */
+    int     enforcement_mode;      /* QoSEnforcementMode (-1 = unset, acts as "on") */
 } QoSLimits;
 
 typedef enum QoSWorkMemErrorLevel
@@ -45,21 +48,206 @@ typedef enum QoSWorkMemErrorLevel
     QOS_WORK_MEM_ERROR_ERROR = 1
 } QoSWorkMemErrorLevel;
 
-/* QoS Statistics */
+/*
+ * qos.enforcement: "shadow" runs every check but only counts and logs
+ * violations. Ordered so that the most restrictive setting is the largest.
+ */
+typedef enum QoSEnforcementMode
+{
+    QOS_ENFORCEMENT_OFF = 0,
+    QOS_ENFORCEMENT_SHADOW = 1,
+    QOS_ENFORCEMENT_ON = 2
+} QoSEnforcementMode;
+
+/*
+ * qos.idle_tx_slot_policy: whether transactions sitting idle in a
+ * transaction block count against max_concurrent_tx
+ */
+typedef enum QoSIdleTxPolicy
+{
+    QOS_IDLE_TX_COUNT = 0,          /* Idle transactions hold their slot */
+    QOS_IDLE_TX_EXCLUDE,            /* Idle transactions are not counted */
+    QOS_IDLE_TX_TERMINATE_AFTER     /* Counted, terminated after qos.idle_tx_timeout to admit others */
+} QoSIdleTxPolicy;
+
+/*
+ * QoSBackendStatus.idle_tx_state. A backend switches itself between busy
+ * and idle; terminate_after moves an idle one to terminating, after which
+ * it can only exit (see qos_set_idle_in_transaction).
+ */
+typedef enum QoSIdleTxState
+{
+    QOS_IDLE_STATE_BUSY = 0,
+    QOS_IDLE_STATE_IDLE,
+    QOS_IDLE_STATE_TERMINATING
+} QoSIdleTxState;
+
+/* Command types tracked per tenant (index into QoSStats arrays) */
+typedef enum QoSCmdIndex
+{
+    QOS_CMD_SELECT = 0,
+    QOS_CMD_UPDATE,
+    QOS_CMD_DELETE,
+    QOS_CMD_INSERT,
+    QOS_CMD_COUNT
+} QoSCmdIndex;
+
+/*
+ * QoS Statistics (kept per tenant, see QoSTenantEntry)
+ * Counters are atomics so hot paths never take the qos lock to update them.
+ */
 typedef struct QoSStats
 {
-    uint64  total_queries;
-    uint64  throttled_queries;
-    uint64  rejected_queries;
-    uint64  work_mem_violations;
-    uint64  cpu_violations;
-    uint64  concurrent_tx_violations;
-    uint64  concurrent_select_violations;
-    uint64  concurrent_update_violations;
-    uint64  concurrent_delete_violations;
-    uint64  concurrent_insert_violations;
+    pg_atomic_uint64 admitted[QOS_CMD_COUNT];  /* Statements admitted past concurrency checks */
+    pg_atomic_uint64 rejected[QOS_CMD_COUNT];  /* Statements rejected by max_concurrent_* */
+    pg_atomic_uint64 throttled[QOS_CMD_COUNT]; /* Plans whose parallel workers were reduced */
+    pg_atomic_uint64 tx_admitted;              /* Transactions admitted under max_concurrent_tx */
+    pg_atomic_uint64 tx_rejected;              /* Transactions rejected by max_concurrent_tx */
+    pg_atomic_uint64 work_mem_caps;            /* work_mem capped or rejected by work_mem_limit */
+    pg_atomic_uint64 cpu_pinnings;             /* Backend CPU affinity changes */
+
+    /* Violations let through by qos.enforcement = shadow */
+    pg_atomic_uint64 shadow_rejected[QOS_CMD_COUNT]; /* Would-be max_concurrent_* rejections */
+    pg_atomic_uint64 shadow_throttled;         /* Plans whose workers would have been reduced */
+    pg_atomic_uint64 shadow_tx_rejected;       /* Would-be max_concurrent_tx rejections */
+    pg_atomic_uint64 shadow_work_mem_caps;     /* Would-be work_mem caps or rejections */
 } QoSStats;
 
+/* Latency distributions tracked per tenant */
+typedef enum QoSLatencyKind
+{
+    QOS_LATENCY_ADMISSION = 0,  /* Concurrency admission checks (lock wait + scan) */
+    QOS_LATENCY_PLANNING,       /* Time inside the chained planner */
+    QOS_LATENCY_EXECUTOR,       /* Executor run time (queryDesc->totaltime) */
+    QOS_LATENCY_COUNT
+} QoSLatencyKind;
+
+/*
+ * Log-bucketed (HDR-style) histogram with fixed memory: values below
+ * QOS_HIST_SUB_BUCKETS get exact buckets, every higher power of two is split
+ * into QOS_HIST_SUB_BUCKETS linear sub-buckets (<= 25% error). Values of
+ * 2^QOS_HIST_VALUE_BITS and above share the last bucket. The unit is the
+ * caller's: latency histograms hold microseconds (~71 min range), overhead
+ * histograms nanoseconds (~4.3 s).
+ */
+#define QOS_HIST_SUB_BITS       2
+#define QOS_HIST_SUB_BUCKETS    (1 << QOS_HIST_SUB_BITS)
+#define QOS_HIST_VALUE_BITS     32
+#define QOS_HIST_BUCKETS        ((QOS_HIST_VALUE_BITS - QOS_HIST_SUB_BITS + 1) * QOS_HIST_SUB_BUCKETS)
+
+typedef struct QoSHistogram
+{
+    pg_atomic_uint64 count;                     /* Samples recorded */
+    pg_atomic_uint64 sum;                       /* Sum of samples (for the mean) */
+    pg_atomic_uint64 buckets[QOS_HIST_BUCKETS];
+} QoSHistogram;
+
+/*
+ * Per-tenant resource consumption for chargeback. Only top-level statements
+ * are accounted; their totals already include nested statements.
+ */
+typedef struct QoSUsage
+{
+    pg_atomic_uint64 statements;        /* Top-level executor runs completed */
+    pg_atomic_uint64 exec_time_us;      /* Executor wall time */
+    pg_atomic_uint64 cpu_user_us;       /* getrusage() user CPU in ExecutorRun/Finish */
+    pg_atomic_uint64 cpu_system_us;     /* getrusage() system CPU in ExecutorRun/Finish */
+    pg_atomic_uint64 blks_hit;          /* Shared + local buffer hits */
+    pg_atomic_uint64 blks_read;         /* Shared + local blocks read */
+    pg_atomic_uint64 wal_bytes;         /* WAL generated */
+    pg_atomic_uint64 temp_bytes;        /* Temp file bytes written */
+} QoSUsage;
+
+/* Hardware counters from self-monitoring perf events (qos.track_hw_counters) */
+typedef struct QoSHwCounters
+{
+    pg_atomic_uint64 cycles;            /* CPU cycles */
+    pg_atomic_uint64 instructions;      /* Instructions retired */
+    pg_atomic_uint64 llc_misses;        /* Last-level cache misses */
+    pg_atomic_uint64 task_clock_ns;     /* On-CPU time */
+} QoSHwCounters;
+
+/* Concurrency slots tracked for saturation: one per command type, then transactions */
+#define QOS_SATURATION_TX       QOS_CMD_COUNT
+#define QOS_SATURATION_COUNT    (QOS_CMD_COUNT + 1)
+
+/*
+ * Per-tenant saturation of the max_concurrent_* limits, integrated over time
+ * at every admission and release. avg concurrency = occupancy_us / observed_us.
+ */
+typedef struct QoSSaturation
+{
+    pg_atomic_uint64 peak[QOS_SATURATION_COUNT];         /* Highest concurrency seen */
+    pg_atomic_uint64 observed_us[QOS_SATURATION_COUNT];  /* Time covered by the figures below */
+    pg_atomic_uint64 occupancy_us[QOS_SATURATION_COUNT]; /* Integral of concurrency over time */
+    pg_atomic_uint64 at_limit_us[QOS_SATURATION_COUNT];  /* Time with concurrency >= the limit */
+} QoSSaturation;
+
+/* Level since the last admission/release (protected by qos_shared_state->lock) */
+typedef struct QoSSaturationState
+{
+    TimestampTz last_change;    /* 0 until the first admission since startup/reset */
+    int     active;             /* Concurrency since last_change */
+    int     limit;              /* Limit in force at last_change (-1 = none) */
+} QoSSaturationState;
+
+/*
+ * Per-tenant (role + database) statistics entry.
+ * Every member from "stats" to the end must be a pg_atomic_uint64 (or a
+ * struct/array of them): init, reset and the stats file treat that region
+ * as one flat counter array.
+ */
+typedef struct QoSTenantEntry
+{
+    Oid     role_oid;       /* InvalidOid for the overflow entry */
+    Oid     database_oid;   /* InvalidOid for the overflow entry */
+    bool    in_use;         /* Entry has been claimed since startup/reset */
+    QoSSaturationState saturation_state[QOS_SATURATION_COUNT]; /* Not saved to the stats file */
+    QoSStats stats;
+    QoSHistogram latency[QOS_LATENCY_COUNT];
+    QoSUsage usage;
+    QoSHwCounters hw;
+    QoSSaturation saturation;
+} QoSTenantEntry;
+
+#define QOS_TENANT_COUNTERS \
+    ((sizeof(QoSTenantEntry) - offsetof(QoSTenantEntry, stats)) / sizeof(pg_atomic_uint64))
+
+/*
+ * Tenant statistics table, sized by qos.max_tenants at startup.
+ * Entries are appended under qos_shared_state->lock and never move, so a
+ * backend can cache its entry and bump counters without locking; the extra
+ * entry at index max_tenants absorbs tenants once the table is full.
+ */
+typedef struct QoSTenantTable
+{
+    int         max_tenants;    /* qos.max_tenants value at startup */
+    int         num_tenants;    /* Entries claimed (protected by lock) */
+    uint32      generation;     /* Bumped by qos_reset_stats() to drop entries */
+    QoSTenantEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} QoSTenantTable;
+
+/*
+ * Per-queryId statistics and limits (PlannedStmt->queryId, needs
+ * compute_query_id). Kept in a shared hash of at most qos.max_queries
+ * entries, protected by its own LWLock (queries.c). Entries are never removed,
+ * so a backend may keep the pointer and update the atomics after releasing
+ * the lock. Every member from "calls" on is a counter cleared by reset.
+ */
+typedef struct QoSQueryEntry
+{
+    int64       query_id;       /* Hash key */
+    pg_atomic_uint32 active;    /* Executions holding a query slot */
+    int         max_concurrent; /* qos_set_query_limit() value (-1 = no limit) */
+    pg_atomic_uint64 calls;     /* Top-level executions finished */
+    pg_atomic_uint64 peak_active;       /* Highest concurrent executions seen */
+    pg_atomic_uint64 rejected;          /* Executions rejected by max_concurrent */
+    pg_atomic_uint64 shadow_rejected;   /* Would-be rejections (qos.enforcement = shadow) */
+    pg_atomic_uint64 throttled;         /* Plans whose parallel workers were reduced */
+    pg_atomic_uint64 throttled_time_us; /* Executor time of runs with reduced workers */
+    QoSHwCounters hw;
+} QoSQueryEntry;
+
 /* CPU Affinity Tracking Entry */
 #define MAX_CORES_PER_ENTRY 64
 typedef struct QoSAffinityEntry
@@ -72,6 +260,17 @@ typedef struct QoSAffinityEntry
 
 #define MAX_AFFINITY_ENTRIES 128
 
+/*
+ * Last perf sample per CPU, taken while picking the least busy cores.
+ * Written lock-free; a reader may pair a sample with a neighbouring time.
+ */
+#define QOS_MAX_CPUS 1024
+typedef struct QoSCpuSample
+{
+    pg_atomic_uint64 cycles;        /* CPU cycles counted in the sample window */
+    pg_atomic_uint64 sample_time;   /* TimestampTz of the sample, 0 if never sampled */
+} QoSCpuSample;
+
 /* Backend Status Entry for Concurrency Tracking */
 typedef struct QoSBackendStatus
 {
@@ -80,17 +279,38 @@ typedef struct QoSBackendStatus
     Oid     database_oid;   /* Database OID */
     CmdType cmd_type;       /* Current command type (CMD_UNKNOWN if none) */
     bool    in_transaction; /* Is in transaction? */
+    bool    session_superuser;      /* Session user is a superuser (set with in_transaction) */
+    TimestampTz statement_start;    /* When the current statement was admitted */
+    int     work_mem_kb;            /* Effective work_mem at admission */
+
+    /* Written by the owning backend without the lock (single int stores) */
+    int     parallel_workers_planned;   /* Workers in the last plan before QoS cap */
+    int     parallel_workers_granted;   /* Workers in the last plan after QoS cap */
+    TimestampTz idle_tx_since;          /* Idle in a transaction block since (0 if not) */
+    pg_atomic_uint32 idle_tx_state;     /* QoSIdleTxState, changed by compare-and-swap */
 } QoSBackendStatus;
 
+/* QoS code paths timed when qos.track_overhead is on */
+typedef enum QoSOverheadKind
+{
+    QOS_OVERHEAD_PLANNER = 0,       /* qos_planner, excluding the chained planner */
+    QOS_OVERHEAD_EXECUTOR_START,    /* qos_ExecutorStart, excluding the chained ExecutorStart */
+    QOS_OVERHEAD_EXECUTOR_END,      /* qos_ExecutorEnd, excluding the chained ExecutorEnd */
+    QOS_OVERHEAD_PROCESS_UTILITY,   /* qos_ProcessUtility, excluding the chained utility */
+    QOS_OVERHEAD_LOCK,              /* Waiting for qos_shared_state->lock */
+    QOS_OVERHEAD_COUNT
+} QoSOverheadKind;
+
 /* Shared State */
 typedef struct QoSSharedState
 {
     LWLock     *lock;
-    QoSStats    stats;
     int         settings_epoch;     /* Bumped on ALTER ROLE/DB SET qos.* to notify sessions */
     int         next_cpu_core;      /* Round-robin counter for CPU core assignment (protected by lock) */
     int         max_backends;       /* MaxBackends value at startup */
     QoSAffinityEntry affinity_entries[MAX_AFFINITY_ENTRIES]; /* Track which db+role combinations have affinity set */
+    QoSHistogram overhead[QOS_OVERHEAD_COUNT]; /* Extension overhead in nanoseconds */
+    QoSCpuSample cpu_samples[QOS_MAX_CPUS];    /* Recent load per CPU (qos_cpu_map) */
     
     /* 
      * Per-backend status array for robust concurrency tracking.
@@ -100,9 +320,122 @@ typedef struct QoSSharedState
     QoSBackendStatus backend_status[FLEXIBLE_ARRAY_MEMBER];
 } QoSSharedState;
 
+/* What an enforcement event did (see QoSEventRing) */
+typedef enum QoSEventAction
+{
+    QOS_EVENT_REJECT = 0,       /* Statement, transaction or SET work_mem refused */
+    QOS_EVENT_THROTTLE,         /* Parallel workers reduced */
+    QOS_EVENT_CAP,              /* work_mem lowered to the limit */
+    QOS_EVENT_TERMINATE,        /* Idle transaction terminated (idle_tx_slot_policy) */
+    QOS_EVENT_ACTION_COUNT
+} QoSEventAction;
+
+/* Which limit an enforcement event was checked against */
+typedef enum QoSEventLimit
+{
+    QOS_LIMIT_MAX_CONCURRENT_SELECT = 0,
+    QOS_LIMIT_MAX_CONCURRENT_UPDATE,
+    QOS_LIMIT_MAX_CONCURRENT_DELETE,
+    QOS_LIMIT_MAX_CONCURRENT_INSERT,
+    QOS_LIMIT_MAX_CONCURRENT_TX,
+    QOS_LIMIT_WORK_MEM,         /* observed/limit in kB */
+    QOS_LIMIT_CPU_CORE,         /* observed = planned workers, limit = allowed workers */
+    QOS_LIMIT_QUERY_MAX_CONCURRENT, /* qos_set_query_limit() */
+    QOS_LIMIT_COUNT
+} QoSEventLimit;
+
+/*
+ * One enforcement event. seq is 0 for a slot never written, PG_UINT64_MAX
+ * while a writer fills it and the claim number + 1 once it is complete, so
+ * readers can detect torn entries and writers never share a slot.
+ */
+typedef struct QoSEvent
+{
+    pg_atomic_uint64 seq;
+    TimestampTz event_time;
+    int     pid;
+    Oid     role_oid;
+    Oid     database_oid;
+    uint8   action;             /* QoSEventAction */
+    uint8   limit_type;         /* QoSEventLimit */
+    bool    shadow;             /* Only reported (qos.enforcement = shadow) */
+    int64   observed;
+    int64   limit_value;
+    int64   query_id;           /* 0 unless compute_query_id is active */
+} QoSEvent;
+
+/*
+ * Fixed-size ring of recent enforcement events, sized by
+ * qos.event_buffer_size. Writers claim slots with an atomic counter and
+ * never take the qos lock; the oldest events are overwritten.
+ */
+typedef struct QoSEventRing
+{
+    int         size;           /* Number of slots */
+    pg_atomic_uint64 next;      /* Next claim number; slot = claim % size */
+    QoSEvent    events[FLEXIBLE_ARRAY_MEMBER];
+} QoSEventRing;
+
+/*
+ * Statistics history kept by the qos history worker (qos.history_interval).
+ * Two rings of buckets aligned to wall-clock minutes and hours; a bucket
+ * holds, per tenant, how much each counter grew during that minute/hour.
+ */
+#define QOS_HISTORY_MINUTES     60      /* One hour at one-minute granularity */
+#define QOS_HISTORY_HOURS       168     /* One week at one-hour granularity */
+#define QOS_HISTORY_BUCKETS     (QOS_HISTORY_MINUTES + QOS_HISTORY_HOURS)
+
+typedef enum QoSHistoryValue
+{
+    QOS_HISTORY_ADMITTED = 0,       /* Statements admitted (all command types) */
+    QOS_HISTORY_REJECTED,           /* Statements rejected by max_concurrent_* */
+    QOS_HISTORY_THROTTLED,          /* Plans with parallel workers reduced */
+    QOS_HISTORY_TX_ADMITTED,
+    QOS_HISTORY_TX_REJECTED,
+    QOS_HISTORY_WORK_MEM_CAPS,
+    QOS_HISTORY_STATEMENTS,         /* Top-level executor runs (usage) */
+    QOS_HISTORY_EXEC_TIME_US,
+    QOS_HISTORY_CPU_TIME_US,        /* User + system CPU */
+    QOS_HISTORY_VALUE_COUNT
+} QoSHistoryValue;
+
+typedef struct QoSHistoryRow
+{
+    Oid     role_oid;       /* InvalidOid for the overflow entry */
+    Oid     database_oid;   /* InvalidOid for the overflow entry */
+    bool    in_use;
+    uint64  values[QOS_HISTORY_VALUE_COUNT];
+} QoSHistoryRow;
+
+typedef struct QoSHistoryBucket
+{
+    TimestampTz start;      /* Start of the minute/hour, 0 if never used */
+    int     num_rows;       /* Rows in use */
+    QoSHistoryRow rows[FLEXIBLE_ARRAY_MEMBER]; /* qos.max_tenants + 1 */
+} QoSHistoryBucket;
+
+/* QoS wait events reported in pg_stat_activity */
+typedef enum QoSWaitEvent
+{
+    QOS_WAIT_CPU_SAMPLE = 0,    /* QosCpuSample: perf sampling during core selection */
+    QOS_WAIT_HISTORY_MAIN,      /* QosHistoryMain: history worker between samples */
+    QOS_WAIT_EVENT_COUNT
+} QoSWaitEvent;
+
 /* Global variables */
 extern QoSSharedState *qos_shared_state;
+extern QoSTenantTable *qos_tenant_table;
+extern QoSEventRing *qos_event_ring;
 extern bool qos_enabled;
+extern int qos_max_tenants;
+extern bool qos_save_stats;
+extern bool qos_track_overhead;
+extern bool qos_track_hw_counters;
+extern int qos_max_queries;
+extern int qos_event_buffer_size;
+extern int qos_history_interval;
+extern int qos_idle_tx_slot_policy;
+extern int qos_idle_tx_timeout;
 
 /* exported functions */
 extern void _PG_init(void);
@@ -121,6 +454,7 @@ extern int64 qos_parse_memory_unit(const char *str);
 extern bool qos_is_valid_qos_param_name(const char *name);
 extern bool qos_apply_qos_param_value(QoSLimits *limits, const char *name,
                                       const char *value, bool strict);
+extern uint32 qos_wait_event(QoSWaitEvent event);
 /* cache/epoch notifications */
 extern void qos_notify_settings_change(void);
 
@@ -0,0 +1,286 @@
+/*
+ * queries.c - Per-queryId QoS statistics and limits
+ *
+ * This file implements the shared hash table of per-queryId statistics
+ * keyed by PlannedStmt->queryId (available when compute_query_id is on)
+ * and the qos_query_stats() and qos_set_query_limit() SQL functions. The
+ * limits are enforced in hooks_statement.c.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "queries.h"
+#include "stats.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/tuplestore.h"
+
+#define QOS_QUERY_STATS_COLS 13
+
+/* Everything after the key is a flat array of atomic counters */
+#define QOS_QUERY_COUNTERS \
+    ((sizeof(QoSQueryEntry) - offsetof(QoSQueryEntry, calls)) / sizeof(pg_atomic_uint64))
+
+StaticAssertDecl((sizeof(QoSQueryEntry) - offsetof(QoSQueryEntry, calls)) %
+                 sizeof(pg_atomic_uint64) == 0,
+                 "QoSQueryEntry counters must be pg_atomic_uint64");
+
+static HTAB *qos_query_hash = NULL;
+
+/*
+ * Protects the hash table (not the counters). Kept apart from
+ * qos_shared_state->lock so queryId lookups don't contend with admission.
+ */
+static LWLock *qos_query_lock = NULL;
+
+/* Session-local cache of the last entry looked up (entries never move) */
+static int64 cached_query_id = 0;
+static QoSQueryEntry *cached_query_entry = NULL;
+
+PG_FUNCTION_INFO_V1(qos_query_stats);
+PG_FUNCTION_INFO_V1(qos_set_query_limit);
+
+/*
+ * Shared memory needed for the queryId hash table
+ */
+Size
+qos_queries_shmem_size(void)
+{
+    return hash_estimate_size(qos_max_queries, sizeof(QoSQueryEntry));
+}
+
+/*
+ * Request the hash table's shared memory and lock (shmem_request_hook)
+ */
+void
+qos_queries_shmem_request(void)
+{
+    RequestAddinShmemSpace(qos_queries_shmem_size());
+    RequestNamedLWLockTranche("qos_queries", 1);
+}
+
+/*
+ * Initialize the queryId hash table (caller holds AddinShmemInitLock)
+ */
+void
+qos_queries_shmem_init(void)
+{
+    HASHCTL info;
+
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(int64);
+    info.entrysize = sizeof(QoSQueryEntry);
+
+    qos_query_hash = ShmemInitHash("qos_query_stats",
+                                   qos_max_queries, qos_max_queries,
+                                   &info, HASH_ELEM | HASH_BLOBS);
+    qos_query_lock = &(GetNamedLWLockTranche("qos_queries")->lock);
+}
+
+static void
+qos_query_init_entry(QoSQueryEntry *entry)
+{
+    pg_atomic_uint64 *counters = &entry->calls;
+    int i;
+
+    for (i = 0; i < (int) QOS_QUERY_COUNTERS; i++)
+        pg_atomic_init_u64(&counters[i], 0);
+
+    pg_atomic_init_u32(&entry->active, 0);
+    entry->max_concurrent = -1;
+}
+
+/*
+ * Look up or create the entry for a queryId
+ *
+ * Lookups take qos_query_lock shared; only a new queryId takes it
+ * exclusively. Once qos.max_queries entries exist, new queryIds are not
+ * tracked.
+ */
+QoSQueryEntry *
+qos_query_entry(int64 query_id, bool create)
+{
+    QoSQueryEntry *entry;
+    bool found;
+
+    if (query_id == 0 || !qos_query_hash)
+        return NULL;
+
+    if (cached_query_entry && cached_query_id == query_id)
+        return cached_query_entry;
+
+    LWLockAcquire(qos_query_lock, LW_SHARED);
+    entry = (QoSQueryEntry *) hash_search(qos_query_hash, &query_id, HASH_FIND, NULL);
+    LWLockRelease(qos_query_lock);
+
+    if (!entry && create)
+    {
+        LWLockAcquire(qos_query_lock, LW_EXCLUSIVE);
+        entry = (QoSQueryEntry *) hash_search(qos_query_hash, &query_id, HASH_FIND, NULL);
+        if (!entry && hash_get_num_entries(qos_query_hash) < qos_max_queries)
+        {
+            entry = (QoSQueryEntry *) hash_search(qos_query_hash, &query_id,
+                                                  HASH_ENTER, &found);
+            if (!found)
+                qos_query_init_entry(entry);
+        }
+        LWLockRelease(qos_query_lock);
+    }
+
+    if (entry)
+    {
+        cached_query_id = query_id;
+        cached_query_entry = entry;
+    }
+
+    return entry;
+}
+
+/*
+ * Raise peak_active to at least active (lock-free)
+ */
+void
+qos_query_note_active(QoSQueryEntry *entry, uint32 active)
+{
+    uint64 peak = pg_atomic_read_u64(&entry->peak_active);
+
+    while (active > peak)
+    {
+        if (pg_atomic_compare_exchange_u64(&entry->peak_active, &peak, active))
+            break;
+    }
+}
+
+/*
+ * Zero every entry's counters; the set of queryIds, their limits and
+ * in-progress executions are kept
+ */
+void
+qos_queries_reset(void)
+{
+    HASH_SEQ_STATUS status;
+    QoSQueryEntry *entry;
+
+    if (!qos_query_hash)
+        return;
+
+    LWLockAcquire(qos_query_lock, LW_SHARED);
+    hash_seq_init(&status, qos_query_hash);
+    while ((entry = (QoSQueryEntry *) hash_seq_search(&status)) != NULL)
+    {
+        pg_atomic_uint64 *counters = &entry->calls;
+        int i;
+
+        for (i = 0; i < (int) QOS_QUERY_COUNTERS; i++)
+            pg_atomic_write_u64(&counters[i], 0);
+    }
+    LWLockRelease(qos_query_lock);
+}
+
+/*
+ * qos_query_stats() - one row per tracked queryId
+ */
+Datum
+qos_query_stats(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    HASH_SEQ_STATUS status;
+    QoSQueryEntry *entry;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_query_hash)
+        return (Datum) 0;
+
+    LWLockAcquire(qos_query_lock, LW_SHARED);
+    hash_seq_init(&status, qos_query_hash);
+    while ((entry = (QoSQueryEntry *) hash_seq_search(&status)) != NULL)
+    {
+        Datum values[QOS_QUERY_STATS_COLS];
+        bool nulls[QOS_QUERY_STATS_COLS];
+
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = Int64GetDatum(entry->query_id);
+        values[1] = Int64GetDatum((int64) qos_stats_read(entry->calls));
+        values[2] = Int32GetDatum((int32) pg_atomic_read_u32(&entry->active));
+        if (entry->max_concurrent > 0)
+            values[3] = Int32GetDatum(entry->max_concurrent);
+        else
+            nulls[3] = true;
+        values[4] = Int64GetDatum((int64) qos_stats_read(entry->peak_active));
+        values[5] = Int64GetDatum((int64) qos_stats_read(entry->rejected));
+        values[6] = Int64GetDatum((int64) qos_stats_read(entry->shadow_rejected));
+        values[7] = Int64GetDatum((int64) qos_stats_read(entry->throttled));
+        values[8] = Int64GetDatum((int64) qos_stats_read(entry->throttled_time_us));
+        values[9] = Int64GetDatum((int64) qos_stats_read(entry->hw.cycles));
+        values[10] = Int64GetDatum((int64) qos_stats_read(entry->hw.instructions));
+        values[11] = Int64GetDatum((int64) qos_stats_read(entry->hw.llc_misses));
+        values[12] = Int64GetDatum((int64) qos_stats_read(entry->hw.task_clock_ns));
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+    LWLockRelease(qos_query_lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * qos_set_query_limit(queryid, max_concurrent) - cap concurrent executions
+ * of one queryId across all tenants; NULL or -1 removes the limit
+ */
+Datum
+qos_set_query_limit(PG_FUNCTION_ARGS)
+{
+    int64 query_id;
+    int max_concurrent;
+    QoSQueryEntry *entry;
+
+    if (PG_ARGISNULL(0))
+        ereport(ERROR,
+                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                 errmsg("qos: queryid must not be NULL")));
+
+    query_id = PG_GETARG_INT64(0);
+    max_concurrent = PG_ARGISNULL(1) ? -1 : PG_GETARG_INT32(1);
+
+    if (query_id == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("qos: queryid must not be 0")));
+
+    if (max_concurrent < -1 || max_concurrent == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("qos: invalid max_concurrent %d", max_concurrent),
+                 errhint("Use a positive number, or -1 to remove the limit.")));
+
+    entry = qos_query_entry(query_id, true);
+    if (!entry)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("qos: query statistics table is full"),
+                 errhint("Increase qos.max_queries and restart the server.")));
+
+    LWLockAcquire(qos_query_lock, LW_EXCLUSIVE);
+    entry->max_concurrent = max_concurrent;
+    LWLockRelease(qos_query_lock);
+
+    elog(DEBUG1, "qos: query limit set (queryid=" INT64_FORMAT ", max_concurrent=%d)",
+         query_id, max_concurrent);
+
+    PG_RETURN_VOID();
+}
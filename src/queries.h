@@ -0,0 +1,40 @@
+/*
+ * queries.h - PostgreSQL Quality of Service (QoS) Extension Query Statistics
+ *
+ * This header file contains the declarations for per-queryId statistics
+ * and limits kept in a shared hash table.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_QUERIES_H
+#define QOS_QUERIES_H
+
+#include "postgres.h"
+#include "qos.h"
+
+/* Shared memory setup (called from qos.c shmem hooks) */
+extern Size qos_queries_shmem_size(void);
+extern void qos_queries_shmem_request(void);
+extern void qos_queries_shmem_init(void);
+
+/*
+ * Look up (or create) the entry for a queryId; caller must NOT hold the
+ * qos lock. Returns NULL for queryId 0 or when the table is full.
+ */
+extern QoSQueryEntry *qos_query_entry(int64 query_id, bool create);
+
+/* Raise the entry's peak_active to at least active (lock-free) */
+extern void qos_query_note_active(QoSQueryEntry *entry, uint32 active);
+
+/* Zero every entry's counters (qos_reset_stats) */
+extern void qos_queries_reset(void);
+
+#endif /* QOS_QUERIES_H */
@@ -0,0 +1,1148 @@
+/*
+ * stats.c - Per-tenant QoS statistics
+ *
+ * This file implements the shared-memory tenant statistics table keyed by
+ * (role, database) and the SQL functions that read and reset it.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "stats.h"
+#include "queries.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/pg_bitutils.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include <unistd.h>
+
+#define QOS_STATS_COLS 25
+#define QOS_LATENCY_HISTOGRAM_COLS 6
+#define QOS_LATENCY_PERCENTILE_COLS 8
+#define QOS_ACTIVITY_COLS 11
+#define QOS_OVERHEAD_COLS 7
+#define QOS_SATURATION_COLS 9
+
+/* Stats file kept across clean restarts (same place as pg_stat_statements) */
+#define QOS_STATS_FILE              PGSTAT_STAT_PERMANENT_DIRECTORY "/qos.stat"
+#define QOS_STATS_FILE_HEADER       0x514f5301
+
+StaticAssertDecl((sizeof(QoSTenantEntry) - offsetof(QoSTenantEntry, stats)) %
+                 sizeof(pg_atomic_uint64) == 0,
+                 "QoSTenantEntry counters must be pg_atomic_uint64");
+
+QoSTenantTable *qos_tenant_table = NULL;
+
+/* Session-local cache of the last tenant entry looked up */
+static Oid cached_tenant_role = InvalidOid;
+static Oid cached_tenant_db = InvalidOid;
+static int cached_tenant_index = -1;
+static uint32 cached_tenant_generation = 0;
+
+static const char *const qos_latency_kind_names[QOS_LATENCY_COUNT] = {
+    "admission",
+    "planning",
+    "executor"
+};
+
+static const char *const qos_saturation_slot_names[QOS_SATURATION_COUNT] = {
+    "select",
+    "update",
+    "delete",
+    "insert",
+    "transaction"
+};
+
+static const char *const qos_overhead_kind_names[QOS_OVERHEAD_COUNT] = {
+    "planner",
+    "executor_start",
+    "executor_end",
+    "process_utility",
+    "lock_wait"
+};
+
+static void qos_stats_init_entry(QoSTenantEntry *entry);
+static void qos_stats_load_file(void);
+static void qos_stats_shmem_shutdown(int code, Datum arg);
+static int qos_hist_bucket(uint64 value);
+
+PG_FUNCTION_INFO_V1(qos_get_stats);
+PG_FUNCTION_INFO_V1(qos_reset_stats);
+PG_FUNCTION_INFO_V1(qos_latency_histogram);
+PG_FUNCTION_INFO_V1(qos_latency_percentiles);
+PG_FUNCTION_INFO_V1(qos_get_activity);
+PG_FUNCTION_INFO_V1(qos_overhead);
+PG_FUNCTION_INFO_V1(qos_get_saturation);
+
+/*
+ * Shared memory needed for the tenant table (max_tenants + overflow entry)
+ */
+Size
+qos_stats_shmem_size(void)
+{
+    Size size;
+
+    size = offsetof(QoSTenantTable, entries);
+    size = add_size(size, mul_size(qos_max_tenants + 1, sizeof(QoSTenantEntry)));
+
+    return MAXALIGN(size);
+}
+
+/*
+ * Initialize the tenant table (caller holds AddinShmemInitLock)
+ */
+void
+qos_stats_shmem_init(void)
+{
+    bool found;
+    Size size = qos_stats_shmem_size();
+
+    qos_tenant_table = ShmemInitStruct("qos_tenant_stats", size, &found);
+
+    /* The postmaster writes the stats file on clean shutdown */
+    if (!IsUnderPostmaster)
+        on_shmem_exit(qos_stats_shmem_shutdown, (Datum) 0);
+
+    if (!found)
+    {
+        int i;
+
+        memset(qos_tenant_table, 0, size);
+        qos_tenant_table->max_tenants = qos_max_tenants;
+        qos_tenant_table->num_tenants = 0;
+        qos_tenant_table->generation = 0;
+
+        for (i = 0; i <= qos_max_tenants; i++)
+        {
+            pg_atomic_uint64 *counters = (pg_atomic_uint64 *) &qos_tenant_table->entries[i].stats;
+            int c;
+
+            for (c = 0; c < QOS_TENANT_COUNTERS; c++)
+                pg_atomic_init_u64(&counters[c], 0);
+        }
+
+        qos_stats_load_file();
+    }
+}
+
+/*
+ * Reload tenant statistics saved by the previous clean shutdown.
+ * The file is removed afterwards so a later crash can't resurrect it.
+ */
+static void
+qos_stats_load_file(void)
+{
+    FILE *file;
+    uint32 header;
+    int32 num_counters;
+    int32 num_entries;
+    uint64 values[QOS_TENANT_COUNTERS];
+    int i;
+
+    file = AllocateFile(QOS_STATS_FILE, PG_BINARY_R);
+    if (file == NULL)
+    {
+        if (errno != ENOENT)
+            ereport(LOG,
+                    (errcode_for_file_access(),
+                     errmsg("qos: could not read file \"%s\": %m", QOS_STATS_FILE)));
+        return;
+    }
+
+    if (fread(&header, sizeof(uint32), 1, file) != 1 ||
+        fread(&num_counters, sizeof(int32), 1, file) != 1 ||
+        fread(&num_entries, sizeof(int32), 1, file) != 1)
+        goto read_error;
+
+    /* Counter layout changed (e.g. upgrade): start fresh */
+    if (header != QOS_STATS_FILE_HEADER || num_counters != (int32) QOS_TENANT_COUNTERS)
+    {
+        ereport(LOG,
+                (errmsg("qos: ignoring incompatible statistics file \"%s\"", QOS_STATS_FILE)));
+        goto done;
+    }
+
+    for (i = 0; i < num_entries; i++)
+    {
+        Oid keys[2];
+        QoSTenantEntry *entry;
+        pg_atomic_uint64 *counters;
+        int index;
+        int c;
+
+        if (fread(keys, sizeof(Oid), 2, file) != 2 ||
+            fread(values, sizeof(uint64), QOS_TENANT_COUNTERS, file) != QOS_TENANT_COUNTERS)
+            goto read_error;
+
+        if (!OidIsValid(keys[0]) && !OidIsValid(keys[1]))
+            index = qos_tenant_table->max_tenants;
+        else if (qos_tenant_table->num_tenants < qos_tenant_table->max_tenants)
+            index = qos_tenant_table->num_tenants++;
+        else
+            continue;   /* qos.max_tenants was lowered; drop the rest */
+
+        entry = &qos_tenant_table->entries[index];
+        entry->role_oid = keys[0];
+        entry->database_oid = keys[1];
+        entry->in_use = true;
+
+        counters = (pg_atomic_uint64 *) &entry->stats;
+        for (c = 0; c < QOS_TENANT_COUNTERS; c++)
+            pg_atomic_write_u64(&counters[c], values[c]);
+    }
+
+    elog(LOG, "qos: restored statistics for %d tenants", qos_tenant_table->num_tenants);
+    goto done;
+
+read_error:
+    ereport(LOG,
+            (errcode_for_file_access(),
+             errmsg("qos: could not read file \"%s\": %m", QOS_STATS_FILE)));
+
+done:
+    FreeFile(file);
+    unlink(QOS_STATS_FILE);
+}
+
+/*
+ * on_shmem_exit callback in the postmaster: dump tenant statistics so they
+ * survive a clean restart. Nothing is written after a crash.
+ */
+static void
+qos_stats_shmem_shutdown(int code, Datum arg)
+{
+    FILE *file;
+    uint32 header = QOS_STATS_FILE_HEADER;
+    int32 num_counters = (int32) QOS_TENANT_COUNTERS;
+    int32 num_entries = 0;
+    uint64 values[QOS_TENANT_COUNTERS];
+    int i;
+
+    if (code || !qos_tenant_table || !qos_save_stats)
+        return;
+
+    file = AllocateFile(QOS_STATS_FILE ".tmp", PG_BINARY_W);
+    if (file == NULL)
+        goto write_error;
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        if (qos_tenant_table->entries[i].in_use)
+            num_entries++;
+    }
+
+    if (fwrite(&header, sizeof(uint32), 1, file) != 1 ||
+        fwrite(&num_counters, sizeof(int32), 1, file) != 1 ||
+        fwrite(&num_entries, sizeof(int32), 1, file) != 1)
+        goto write_error;
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        pg_atomic_uint64 *counters = (pg_atomic_uint64 *) &entry->stats;
+        Oid keys[2];
+        int c;
+
+        if (!entry->in_use)
+            continue;
+
+        keys[0] = entry->role_oid;
+        keys[1] = entry->database_oid;
+        for (c = 0; c < QOS_TENANT_COUNTERS; c++)
+            values[c] = pg_atomic_read_u64(&counters[c]);
+
+        if (fwrite(keys, sizeof(Oid), 2, file) != 2 ||
+            fwrite(values, sizeof(uint64), QOS_TENANT_COUNTERS, file) != QOS_TENANT_COUNTERS)
+            goto write_error;
+    }
+
+    if (FreeFile(file))
+    {
+        file = NULL;
+        goto write_error;
+    }
+
+    (void) durable_rename(QOS_STATS_FILE ".tmp", QOS_STATS_FILE, LOG);
+    return;
+
+write_error:
+    ereport(LOG,
+            (errcode_for_file_access(),
+             errmsg("qos: could not write file \"%s\": %m", QOS_STATS_FILE ".tmp")));
+    if (file)
+        FreeFile(file);
+    unlink(QOS_STATS_FILE ".tmp");
+}
+
+int
+qos_stats_cmd_index(CmdType operation)
+{
+    switch (operation)
+    {
+        case CMD_SELECT: return QOS_CMD_SELECT;
+        case CMD_UPDATE: return QOS_CMD_UPDATE;
+        case CMD_DELETE: return QOS_CMD_DELETE;
+        case CMD_INSERT: return QOS_CMD_INSERT;
+        default: return -1;
+    }
+}
+
+/*
+ * Zero an entry's counters (caller holds the qos lock exclusively).
+ * Backends may be adding to them concurrently, so they are written
+ * atomically rather than re-initialized.
+ */
+static void
+qos_stats_init_entry(QoSTenantEntry *entry)
+{
+    pg_atomic_uint64 *counters = (pg_atomic_uint64 *) &entry->stats;
+    int c;
+
+    for (c = 0; c < QOS_TENANT_COUNTERS; c++)
+        pg_atomic_write_u64(&counters[c], 0);
+
+    memset(entry->saturation_state, 0, sizeof(entry->saturation_state));
+}
+
+/*
+ * Find the entry for role+database (caller holds qos lock). Entries
+ * dropped by qos_reset_stats() keep their key and are found too.
+ */
+static int
+qos_stats_find_tenant(Oid role_oid, Oid database_oid)
+{
+    QoSTenantTable *table = qos_tenant_table;
+    int i;
+
+    for (i = 0; i < table->num_tenants; i++)
+    {
+        if (table->entries[i].role_oid == role_oid &&
+            table->entries[i].database_oid == database_oid)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * Look up the entry for role+database, claiming a new one if needed.
+ *
+ * Entries never move and are never handed to another tenant, not even by
+ * qos_reset_stats(), so a backend still holding a stale index only ever
+ * adds to its own tenant. The index is cached per session until a reset
+ * bumps the table generation; the common case takes no lock at all. A miss
+ * scans under a shared lock and only claims (or revives a reset) entry
+ * under the exclusive lock. Once the table is full, new tenants share the
+ * overflow entry at index max_tenants.
+ */
+QoSTenantEntry *
+qos_stats_tenant_entry(Oid role_oid, Oid database_oid)
+{
+    QoSTenantTable *table = qos_tenant_table;
+    QoSTenantEntry *entry;
+    uint32 generation;
+    int index;
+
+    if (!table || !qos_shared_state)
+        return NULL;
+
+    if (cached_tenant_index >= 0 &&
+        cached_tenant_generation == table->generation &&
+        cached_tenant_role == role_oid &&
+        cached_tenant_db == database_oid)
+        return &table->entries[cached_tenant_index];
+
+    qos_lock_acquire(LW_SHARED);
+    index = qos_stats_find_tenant(role_oid, database_oid);
+    if (index >= 0 && !table->entries[index].in_use)
+        index = -1;
+    generation = table->generation;
+    LWLockRelease(qos_shared_state->lock);
+
+    if (index < 0)
+    {
+        qos_lock_acquire(LW_EXCLUSIVE);
+
+        /* Re-check: another backend may have claimed it meanwhile */
+        index = qos_stats_find_tenant(role_oid, database_oid);
+        if (index >= 0)
+        {
+            /* Dropped by qos_reset_stats(); counters are already zero */
+            table->entries[index].in_use = true;
+        }
+        else
+        {
+            if (table->num_tenants < table->max_tenants)
+            {
+                index = table->num_tenants;
+                entry = &table->entries[index];
+                entry->role_oid = role_oid;
+                entry->database_oid = database_oid;
+                qos_stats_init_entry(entry);
+                entry->in_use = true;
+                table->num_tenants++;
+            }
+            else
+            {
+                index = table->max_tenants;
+                entry = &table->entries[index];
+                if (!entry->in_use)
+                {
+                    qos_stats_init_entry(entry);
+                    entry->in_use = true;
+                    elog(LOG, "qos: tenant statistics table full (qos.max_tenants=%d), "
+                         "further tenants are counted in the overflow entry",
+                         table->max_tenants);
+                }
+            }
+        }
+        generation = table->generation;
+
+        LWLockRelease(qos_shared_state->lock);
+    }
+
+    cached_tenant_role = role_oid;
+    cached_tenant_db = database_oid;
+    cached_tenant_index = index;
+    cached_tenant_generation = generation;
+
+    return &table->entries[index];
+}
+
+/*
+ * Close the interval since the tenant's last concurrency change and start a
+ * new one at the given level.
+ *
+ * Called from the admission and release paths, which already hold
+ * qos_shared_state->lock exclusively, so the state needs no further
+ * locking. The overflow entry mixes tenants and is skipped.
+ */
+void
+qos_saturation_update(QoSTenantEntry *tenant, int slot, int active, int limit)
+{
+    QoSSaturationState *state;
+    QoSSaturation *sat;
+    TimestampTz now;
+
+    if (!tenant || !OidIsValid(tenant->role_oid))
+        return;
+
+    state = &tenant->saturation_state[slot];
+    sat = &tenant->saturation;
+    now = GetCurrentTimestamp();
+
+    if (state->last_change != 0 && now > state->last_change)
+    {
+        uint64 elapsed = (uint64) (now - state->last_change);
+
+        qos_stats_add(sat->observed_us[slot], elapsed);
+        qos_stats_add(sat->occupancy_us[slot], elapsed * (uint64) state->active);
+        if (state->limit > 0 && state->active >= state->limit)
+            qos_stats_add(sat->at_limit_us[slot], elapsed);
+    }
+
+    if ((uint64) active > qos_stats_read(sat->peak[slot]))
+        pg_atomic_write_u64(&sat->peak[slot], (uint64) active);
+
+    state->last_change = now;
+    state->active = active;
+    state->limit = limit;
+}
+
+/*
+ * This backend released a slot: one less than the last recorded level
+ * (caller holds the qos lock exclusively). The next admission rescans
+ * backend_status[], so any drift is corrected there.
+ */
+void
+qos_saturation_release(QoSTenantEntry *tenant, int slot)
+{
+    if (!tenant || !OidIsValid(tenant->role_oid))
+        return;
+
+    qos_saturation_update(tenant, slot,
+                          Max(tenant->saturation_state[slot].active - 1, 0),
+                          tenant->saturation_state[slot].limit);
+}
+
+/*
+ * Histogram helpers
+ */
+void
+qos_hist_init(QoSHistogram *hist)
+{
+    int i;
+
+    pg_atomic_init_u64(&hist->count, 0);
+    pg_atomic_init_u64(&hist->sum, 0);
+    for (i = 0; i < QOS_HIST_BUCKETS; i++)
+        pg_atomic_init_u64(&hist->buckets[i], 0);
+}
+
+/*
+ * Zero a histogram that may be updated concurrently
+ */
+void
+qos_hist_reset(QoSHistogram *hist)
+{
+    int i;
+
+    pg_atomic_write_u64(&hist->count, 0);
+    pg_atomic_write_u64(&hist->sum, 0);
+    for (i = 0; i < QOS_HIST_BUCKETS; i++)
+        pg_atomic_write_u64(&hist->buckets[i], 0);
+}
+
+static int
+qos_hist_bucket(uint64 value)
+{
+    int msb;
+
+    if (value < QOS_HIST_SUB_BUCKETS)
+        return (int) value;
+
+    msb = pg_leftmost_one_pos64(value);
+    if (msb >= QOS_HIST_VALUE_BITS)
+        return QOS_HIST_BUCKETS - 1;
+
+    return (msb - QOS_HIST_SUB_BITS + 1) * QOS_HIST_SUB_BUCKETS +
+           (int) ((value >> (msb - QOS_HIST_SUB_BITS)) & (QOS_HIST_SUB_BUCKETS - 1));
+}
+
+void
+qos_hist_record(QoSHistogram *hist, uint64 value)
+{
+    qos_stats_inc(hist->count);
+    qos_stats_add(hist->sum, value);
+    qos_stats_inc(hist->buckets[qos_hist_bucket(value)]);
+}
+
+/*
+ * Value range [lower, upper) covered by a bucket
+ */
+void
+qos_hist_bucket_bounds(int bucket, uint64 *lower, uint64 *upper)
+{
+    int group;
+    int msb;
+    uint64 width;
+
+    if (bucket < QOS_HIST_SUB_BUCKETS)
+    {
+        *lower = (uint64) bucket;
+        *upper = (uint64) bucket + 1;
+        return;
+    }
+
+    group = bucket / QOS_HIST_SUB_BUCKETS;
+    msb = group + QOS_HIST_SUB_BITS - 1;
+    width = UINT64CONST(1) << (group - 1);
+    *lower = (UINT64CONST(1) << msb) + (uint64) (bucket % QOS_HIST_SUB_BUCKETS) * width;
+    *upper = *lower + width;
+}
+
+/*
+ * Estimate a percentile (fraction in 0..1) as the upper bound of the bucket
+ * holding that rank. Returns 0 for an empty histogram.
+ */
+uint64
+qos_hist_percentile(const uint64 *buckets, uint64 total, double fraction)
+{
+    uint64 rank;
+    uint64 seen = 0;
+    uint64 lower;
+    uint64 upper;
+    int i;
+
+    if (total == 0)
+        return 0;
+
+    rank = (uint64) (fraction * (double) total);
+    if (rank < 1)
+        rank = 1;
+
+    for (i = 0; i < QOS_HIST_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    if (i == QOS_HIST_BUCKETS)
+        i = QOS_HIST_BUCKETS - 1;
+
+    qos_hist_bucket_bounds(i, &lower, &upper);
+    return upper;
+}
+
+/*
+ * Record the QoS-only time of one hook call in nanoseconds
+ */
+void
+qos_overhead_end(QoSOverheadTimer *timer, QoSOverheadKind kind)
+{
+    if (!timer->active || !qos_shared_state)
+        return;
+
+    qos_overhead_pause(timer);
+    qos_hist_record(&qos_shared_state->overhead[kind],
+                    (uint64) (INSTR_TIME_GET_DOUBLE(timer->total) * 1000000000.0));
+}
+
+/*
+ * Acquire the qos lock; with qos.track_overhead the wait is recorded
+ */
+void
+qos_lock_acquire(LWLockMode mode)
+{
+    instr_time start;
+    instr_time duration;
+
+    if (!qos_track_overhead)
+    {
+        LWLockAcquire(qos_shared_state->lock, mode);
+        return;
+    }
+
+    INSTR_TIME_SET_CURRENT(start);
+    LWLockAcquire(qos_shared_state->lock, mode);
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start);
+    qos_hist_record(&qos_shared_state->overhead[QOS_OVERHEAD_LOCK],
+                    (uint64) (INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0));
+}
+
+/*
+ * Record a latency sample for the current role+database
+ */
+void
+qos_stats_record_latency(QoSLatencyKind kind, uint64 value_us)
+{
+    QoSTenantEntry *tenant;
+
+    tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+    if (tenant)
+        qos_hist_record(&tenant->latency[kind], value_us);
+}
+
+const char *
+qos_latency_kind_name(QoSLatencyKind kind)
+{
+    return qos_latency_kind_names[kind];
+}
+
+/*
+ * qos_get_stats() - one row per tenant with its counters
+ *
+ * The shared lock only keeps the set of entries stable; counters are read
+ * atomically and may advance while the scan runs.
+ */
+Datum
+qos_get_stats(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        Datum values[QOS_STATS_COLS];
+        bool nulls[QOS_STATS_COLS];
+        int col = 0;
+        int cmd;
+
+        if (!entry->in_use)
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        if (i == qos_tenant_table->max_tenants)
+        {
+            /* Overflow entry has no owner */
+            nulls[col++] = true;
+            nulls[col++] = true;
+        }
+        else
+        {
+            values[col++] = ObjectIdGetDatum(entry->role_oid);
+            values[col++] = ObjectIdGetDatum(entry->database_oid);
+        }
+
+        for (cmd = 0; cmd < QOS_CMD_COUNT; cmd++)
+        {
+            values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.admitted[cmd]));
+            values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.rejected[cmd]));
+            values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.throttled[cmd]));
+        }
+
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.tx_admitted));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.tx_rejected));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.work_mem_caps));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.cpu_pinnings));
+
+        /* qos.enforcement = shadow counters */
+        for (cmd = 0; cmd < QOS_CMD_COUNT; cmd++)
+            values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.shadow_rejected[cmd]));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.shadow_tx_rejected));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.shadow_throttled));
+        values[col++] = Int64GetDatum((int64) qos_stats_read(entry->stats.shadow_work_mem_caps));
+
+        Assert(col == QOS_STATS_COLS);
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * qos_reset_stats() - drop all tenant entries and their counters
+ *
+ * Entries are zeroed and hidden until their tenant is seen again, but keep
+ * their key: a backend that looked an entry up just before the reset may
+ * still add to it, and that sample must not land on another tenant.
+ */
+Datum
+qos_reset_stats(PG_FUNCTION_ARGS)
+{
+    if (qos_shared_state && qos_tenant_table)
+    {
+        int i;
+
+        qos_lock_acquire(LW_EXCLUSIVE);
+        for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+        {
+            QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+
+            if (!entry->in_use)
+                continue;
+            qos_stats_init_entry(entry);
+            entry->in_use = false;
+        }
+        qos_tenant_table->generation++;
+        LWLockRelease(qos_shared_state->lock);
+    }
+    if (qos_shared_state)
+    {
+        int kind;
+
+        /* Lock-free counters; concurrent samples may survive the reset */
+        for (kind = 0; kind < QOS_OVERHEAD_COUNT; kind++)
+            qos_hist_reset(&qos_shared_state->overhead[kind]);
+
+        qos_queries_reset();
+    }
+    PG_RETURN_VOID();
+}
+
+/*
+ * qos_latency_histogram() - non-empty buckets per tenant and latency kind
+ */
+Datum
+qos_latency_histogram(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        int kind;
+
+        if (!entry->in_use)
+            continue;
+
+        for (kind = 0; kind < QOS_LATENCY_COUNT; kind++)
+        {
+            int bucket;
+
+            for (bucket = 0; bucket < QOS_HIST_BUCKETS; bucket++)
+            {
+                Datum values[QOS_LATENCY_HISTOGRAM_COLS];
+                bool nulls[QOS_LATENCY_HISTOGRAM_COLS];
+                uint64 count = qos_stats_read(entry->latency[kind].buckets[bucket]);
+                uint64 lower;
+                uint64 upper;
+
+                if (count == 0)
+                    continue;
+
+                memset(nulls, 0, sizeof(nulls));
+                qos_hist_bucket_bounds(bucket, &lower, &upper);
+
+                if (i == qos_tenant_table->max_tenants)
+                {
+                    nulls[0] = true;
+                    nulls[1] = true;
+                }
+                else
+                {
+                    values[0] = ObjectIdGetDatum(entry->role_oid);
+                    values[1] = ObjectIdGetDatum(entry->database_oid);
+                }
+                values[2] = CStringGetTextDatum(qos_latency_kind_names[kind]);
+                values[3] = Int64GetDatum((int64) lower);
+                values[4] = Int64GetDatum((int64) upper);
+                values[5] = Int64GetDatum((int64) count);
+
+                tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+            }
+        }
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * qos_latency_percentiles() - sample count, mean and p50/p95/p99 per tenant
+ * and latency kind, computed from a snapshot of the histogram buckets
+ */
+Datum
+qos_latency_percentiles(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    uint64 buckets[QOS_HIST_BUCKETS];
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        int kind;
+
+        if (!entry->in_use)
+            continue;
+
+        for (kind = 0; kind < QOS_LATENCY_COUNT; kind++)
+        {
+            QoSHistogram *hist = &entry->latency[kind];
+            Datum values[QOS_LATENCY_PERCENTILE_COLS];
+            bool nulls[QOS_LATENCY_PERCENTILE_COLS];
+            uint64 total = 0;
+            uint64 sum_us;
+            int bucket;
+
+            /* Total from the bucket snapshot keeps percentiles self-consistent */
+            for (bucket = 0; bucket < QOS_HIST_BUCKETS; bucket++)
+            {
+                buckets[bucket] = qos_stats_read(hist->buckets[bucket]);
+                total += buckets[bucket];
+            }
+
+            if (total == 0)
+                continue;
+
+            sum_us = qos_stats_read(hist->sum);
+            memset(nulls, 0, sizeof(nulls));
+
+            if (i == qos_tenant_table->max_tenants)
+            {
+                nulls[0] = true;
+                nulls[1] = true;
+            }
+            else
+            {
+                values[0] = ObjectIdGetDatum(entry->role_oid);
+                values[1] = ObjectIdGetDatum(entry->database_oid);
+            }
+            values[2] = CStringGetTextDatum(qos_latency_kind_names[kind]);
+            values[3] = Int64GetDatum((int64) total);
+            values[4] = Float8GetDatum((double) sum_us / (double) total);
+            values[5] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.50));
+            values[6] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.95));
+            values[7] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.99));
+
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        }
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
+
+/*
+ * qos_overhead() - QoS hook and lock wait timings (qos.track_overhead)
+ *
+ * Values are in nanoseconds; percentiles are bucket upper bounds.
+ */
+Datum
+qos_overhead(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    uint64 buckets[QOS_HIST_BUCKETS];
+    int kind;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state)
+        return (Datum) 0;
+
+    for (kind = 0; kind < QOS_OVERHEAD_COUNT; kind++)
+    {
+        QoSHistogram *hist = &qos_shared_state->overhead[kind];
+        Datum values[QOS_OVERHEAD_COLS];
+        bool nulls[QOS_OVERHEAD_COLS];
+        uint64 total = 0;
+        uint64 sum_ns;
+        int bucket;
+
+        for (bucket = 0; bucket < QOS_HIST_BUCKETS; bucket++)
+        {
+            buckets[bucket] = qos_stats_read(hist->buckets[bucket]);
+            total += buckets[bucket];
+        }
+        sum_ns = qos_stats_read(hist->sum);
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = CStringGetTextDatum(qos_overhead_kind_names[kind]);
+        values[1] = Int64GetDatum((int64) total);
+        values[2] = Int64GetDatum((int64) sum_ns);
+        if (total > 0)
+        {
+            values[3] = Float8GetDatum((double) sum_ns / (double) total);
+            values[4] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.50));
+            values[5] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.95));
+            values[6] = Int64GetDatum((int64) qos_hist_percentile(buckets, total, 0.99));
+        }
+        else
+        {
+            nulls[3] = nulls[4] = nulls[5] = nulls[6] = true;
+        }
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+
+static const char *
+qos_cmd_type_name(CmdType cmd_type)
+{
+    switch (cmd_type)
+    {
+        case CMD_SELECT: return "select";
+        case CMD_UPDATE: return "update";
+        case CMD_DELETE: return "delete";
+        case CMD_INSERT: return "insert";
+        default: return NULL;
+    }
+}
+
+/*
+ * qos_get_activity() - one row per backend known to QoS
+ *
+ * backend_status[] and affinity_entries[] are copied under a shared lock so
+ * every row comes from the same consistent snapshot; tuples are built after
+ * the lock is released.
+ */
+Datum
+qos_get_activity(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    QoSBackendStatus *backends;
+    QoSAffinityEntry *affinity;
+    int max_backends;
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state)
+        return (Datum) 0;
+
+    max_backends = qos_shared_state->max_backends;
+    backends = palloc(mul_size(max_backends, sizeof(QoSBackendStatus)));
+    affinity = palloc(sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+
+    qos_lock_acquire(LW_SHARED);
+    memcpy(backends, qos_shared_state->backend_status,
+           mul_size(max_backends, sizeof(QoSBackendStatus)));
+    memcpy(affinity, qos_shared_state->affinity_entries,
+           sizeof(QoSAffinityEntry) * MAX_AFFINITY_ENTRIES);
+    LWLockRelease(qos_shared_state->lock);
+
+    for (i = 0; i < max_backends; i++)
+    {
+        QoSBackendStatus *status = &backends[i];
+        Datum values[QOS_ACTIVITY_COLS];
+        bool nulls[QOS_ACTIVITY_COLS];
+        const char *command;
+        int j;
+
+        if (status->pid == 0)
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+        command = qos_cmd_type_name(status->cmd_type);
+
+        values[0] = Int32GetDatum((int32) status->pid);
+        values[1] = ObjectIdGetDatum(status->role_oid);
+        values[2] = ObjectIdGetDatum(status->database_oid);
+        if (command)
+        {
+            values[3] = CStringGetTextDatum(command);
+            values[5] = TimestampTzGetDatum(status->statement_start);
+        }
+        else
+        {
+            nulls[3] = true;
+            nulls[5] = true;
+        }
+        values[4] = BoolGetDatum(status->in_transaction);
+        if (status->work_mem_kb > 0)
+            values[6] = Int32GetDatum(status->work_mem_kb);
+        else
+            nulls[6] = true;
+        values[7] = Int32GetDatum(status->parallel_workers_planned);
+        values[8] = Int32GetDatum(status->parallel_workers_granted);
+
+        /* Cores assigned to this backend's role+database, if any */
+        nulls[9] = true;
+        for (j = 0; j < MAX_AFFINITY_ENTRIES; j++)
+        {
+            if (affinity[j].database_oid == status->database_oid &&
+                affinity[j].role_oid == status->role_oid &&
+                affinity[j].num_cores > 0)
+            {
+                Datum cores[MAX_CORES_PER_ENTRY];
+                int num_cores = Min(affinity[j].num_cores, MAX_CORES_PER_ENTRY);
+                int k;
+
+                for (k = 0; k < num_cores; k++)
+                    cores[k] = Int32GetDatum(affinity[j].assigned_cores[k]);
+
+                values[9] = PointerGetDatum(construct_array(cores, num_cores, INT4OID,
+                                                            sizeof(int32), true,
+                                                            TYPALIGN_INT));
+                nulls[9] = false;
+                break;
+            }
+        }
+
+        if (status->in_transaction && status->idle_tx_since != 0)
+            values[10] = TimestampTzGetDatum(status->idle_tx_since);
+        else
+            nulls[10] = true;
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    pfree(backends);
+    pfree(affinity);
+
+    return (Datum) 0;
+}
+
+/*
+ * qos_get_saturation() - per-tenant concurrency saturation
+ *
+ * One row per tenant and slot type that has seen an admission. The interval
+ * since the last change is added on the fly, so a tenant sitting at its
+ * limit shows up without waiting for the next admission or release.
+ */
+Datum
+qos_get_saturation(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TimestampTz now = GetCurrentTimestamp();
+    int i;
+    int slot;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i < qos_tenant_table->num_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+
+        for (slot = 0; slot < QOS_SATURATION_COUNT; slot++)
+        {
+            QoSSaturationState *state = &entry->saturation_state[slot];
+            QoSSaturation *sat = &entry->saturation;
+            Datum values[QOS_SATURATION_COLS];
+            bool nulls[QOS_SATURATION_COLS];
+            uint64 observed_us = qos_stats_read(sat->observed_us[slot]);
+            uint64 occupancy_us = qos_stats_read(sat->occupancy_us[slot]);
+            uint64 at_limit_us = qos_stats_read(sat->at_limit_us[slot]);
+            uint64 peak = qos_stats_read(sat->peak[slot]);
+
+            if (peak == 0 && state->last_change == 0)
+                continue;
+
+            if (state->last_change != 0 && now > state->last_change)
+            {
+                uint64 pending = (uint64) (now - state->last_change);
+
+                observed_us += pending;
+                occupancy_us += pending * (uint64) state->active;
+                if (state->limit > 0 && state->active >= state->limit)
+                    at_limit_us += pending;
+            }
+
+            memset(nulls, 0, sizeof(nulls));
+
+            values[0] = ObjectIdGetDatum(entry->role_oid);
+            values[1] = ObjectIdGetDatum(entry->database_oid);
+            values[2] = CStringGetTextDatum(qos_saturation_slot_names[slot]);
+            values[3] = Int32GetDatum(state->active);
+            if (state->limit > 0)
+                values[4] = Int32GetDatum(state->limit);
+            else
+                nulls[4] = true;
+            values[5] = Int64GetDatum((int64) peak);
+            values[6] = Int64GetDatum((int64) observed_us);
+            values[7] = Int64GetDatum((int64) occupancy_us);
+            values[8] = Int64GetDatum((int64) at_limit_us);
+
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        }
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * stats.h - PostgreSQL Quality of Service (QoS) Extension Statistics
+ *
+ * This header file contains the declarations for per-tenant QoS statistics
+ * kept in shared memory and exposed through SQL functions.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_STATS_H
+#define QOS_STATS_H
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "nodes/nodes.h"
+#include "portability/instr_time.h"
+#include "storage/lwlock.h"
+#include "qos.h"
+
+/* Materialized SRF setup (renamed in PG16) */
+#if PG_VERSION_NUM >= 160000
+#define qos_init_materialized_srf(fcinfo) InitMaterializedSRF((fcinfo), 0)
+#else
+#define qos_init_materialized_srf(fcinfo) SetSingleFuncCall((fcinfo), 0)
+#endif
+
+/* Lock-free counter helpers for QoSStats fields */
+#define qos_stats_inc(counter)      pg_atomic_fetch_add_u64(&(counter), 1)
+#define qos_stats_add(counter, n)   pg_atomic_fetch_add_u64(&(counter), (n))
+#define qos_stats_read(counter)     pg_atomic_read_u64(&(counter))
+
+/* Shared memory setup (called from qos.c shmem hooks) */
+extern Size qos_stats_shmem_size(void);
+extern void qos_stats_shmem_init(void);
+
+/* Map a CmdType to its QoSStats array index (-1 if not tracked) */
+extern int qos_stats_cmd_index(CmdType operation);
+
+/* Look up or claim a tenant entry; caller must NOT hold the qos lock */
+extern QoSTenantEntry *qos_stats_tenant_entry(Oid role_oid, Oid database_oid);
+
+/* Saturation: record a new concurrency level; caller holds the qos lock exclusively */
+extern void qos_saturation_update(QoSTenantEntry *tenant, int slot, int active, int limit);
+extern void qos_saturation_release(QoSTenantEntry *tenant, int slot);
+
+/* Latency histograms */
+extern void qos_hist_init(QoSHistogram *hist);
+extern void qos_hist_reset(QoSHistogram *hist);
+extern void qos_hist_record(QoSHistogram *hist, uint64 value);
+extern void qos_hist_bucket_bounds(int bucket, uint64 *lower, uint64 *upper);
+extern uint64 qos_hist_percentile(const uint64 *buckets, uint64 total, double fraction);
+extern void qos_stats_record_latency(QoSLatencyKind kind, uint64 value_us);
+extern const char *qos_latency_kind_name(QoSLatencyKind kind);
+
+/*
+ * Hook overhead timer (qos.track_overhead). Accumulates only the time spent
+ * in QoS code: pause it around chained hooks and standard_* calls.
+ */
+typedef struct QoSOverheadTimer
+{
+    bool        active;     /* qos.track_overhead at start */
+    instr_time  start;      /* Start of the running segment */
+    instr_time  total;      /* Sum of finished segments */
+} QoSOverheadTimer;
+
+static inline void
+qos_overhead_start(QoSOverheadTimer *timer)
+{
+    timer->active = qos_track_overhead;
+    if (timer->active)
+    {
+        INSTR_TIME_SET_ZERO(timer->total);
+        INSTR_TIME_SET_CURRENT(timer->start);
+    }
+}
+
+static inline void
+qos_overhead_pause(QoSOverheadTimer *timer)
+{
+    instr_time now;
+
+    if (!timer->active)
+        return;
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_ACCUM_DIFF(timer->total, now, timer->start);
+}
+
+static inline void
+qos_overhead_resume(QoSOverheadTimer *timer)
+{
+    if (timer->active)
+        INSTR_TIME_SET_CURRENT(timer->start);
+}
+
+/* Close the running segment and record the total */
+extern void qos_overhead_end(QoSOverheadTimer *timer, QoSOverheadKind kind);
+
+/* Acquire qos_shared_state->lock, timing the wait when qos.track_overhead is on */
+extern void qos_lock_acquire(LWLockMode mode);
+
+#endif /* QOS_STATS_H */
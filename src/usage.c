@@ -0,0 +1,160 @@
+/*
+ * usage.c - Per-tenant resource usage accounting
+ *
+ * This file accumulates per-tenant (role, database) CPU time, buffer, WAL
+ * and temp file usage and executor time for chargeback and capacity
+ * planning, and implements qos_get_usage().
+ *
+ * CPU time is taken from getrusage(RUSAGE_SELF) deltas around top-level
+ * ExecutorRun/ExecutorFinish calls; the other counters come from the
+ * query's totaltime instrumentation at ExecutorEnd.
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "qos.h"
+#include "stats.h"
+#include "usage.h"
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
+
+#define QOS_USAGE_COLS 10
+
+PG_FUNCTION_INFO_V1(qos_get_usage);
+
+static inline uint64
+qos_timeval_diff_us(const struct timeval *end, const struct timeval *start)
+{
+    int64 us;
+
+    us = (int64) (end->tv_sec - start->tv_sec) * 1000000 +
+         (int64) (end->tv_usec - start->tv_usec);
+
+    return (us > 0) ? (uint64) us : 0;
+}
+
+/*
+ * Add the CPU time used since start to the current tenant
+ */
+void
+qos_usage_record_cpu(const PGRUsage *start)
+{
+    QoSTenantEntry *tenant;
+    struct rusage now;
+
+    tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+    if (!tenant)
+        return;
+
+    getrusage(RUSAGE_SELF, &now);
+    qos_stats_add(tenant->usage.cpu_user_us,
+                  qos_timeval_diff_us(&now.ru_utime, &start->ru.ru_utime));
+    qos_stats_add(tenant->usage.cpu_system_us,
+                  qos_timeval_diff_us(&now.ru_stime, &start->ru.ru_stime));
+}
+
+/*
+ * Add a finished top-level executor run to the current tenant
+ */
+void
+qos_usage_record_executor(const Instrumentation *totaltime)
+{
+    QoSTenantEntry *tenant;
+    const BufferUsage *bufusage = &totaltime->bufusage;
+
+    tenant = qos_stats_tenant_entry(GetUserId(), MyDatabaseId);
+    if (!tenant)
+        return;
+
+    qos_stats_inc(tenant->usage.statements);
+    qos_stats_add(tenant->usage.exec_time_us, (uint64) (totaltime->total * 1000000.0));
+    qos_stats_add(tenant->usage.blks_hit,
+                  (uint64) (bufusage->shared_blks_hit + bufusage->local_blks_hit));
+    qos_stats_add(tenant->usage.blks_read,
+                  (uint64) (bufusage->shared_blks_read + bufusage->local_blks_read));
+    qos_stats_add(tenant->usage.temp_bytes,
+                  (uint64) bufusage->temp_blks_written * BLCKSZ);
+    qos_stats_add(tenant->usage.wal_bytes, (uint64) totaltime->walusage.wal_bytes);
+}
+
+/*
+ * Read a usage counter, or read and zero it in one atomic step
+ */
+static inline int64
+qos_usage_take(pg_atomic_uint64 *counter, bool reset)
+{
+    if (reset)
+        return (int64) pg_atomic_exchange_u64(counter, 0);
+    return (int64) pg_atomic_read_u64(counter);
+}
+
+/*
+ * qos_get_usage(reset) - per-tenant usage totals
+ *
+ * With reset = true each counter is returned and zeroed by one atomic
+ * exchange, so periodic exports never lose or double count usage.
+ */
+Datum
+qos_get_usage(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    bool reset = PG_GETARG_BOOL(0);
+    int i;
+
+    qos_init_materialized_srf(fcinfo);
+
+    if (!qos_shared_state || !qos_tenant_table)
+        return (Datum) 0;
+
+    qos_lock_acquire(LW_SHARED);
+
+    for (i = 0; i <= qos_tenant_table->max_tenants; i++)
+    {
+        QoSTenantEntry *entry = &qos_tenant_table->entries[i];
+        QoSUsage *usage = &entry->usage;
+        Datum values[QOS_USAGE_COLS];
+        bool nulls[QOS_USAGE_COLS];
+
+        if (!entry->in_use)
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        if (i == qos_tenant_table->max_tenants)
+        {
+            /* Overflow entry has no owner */
+            nulls[0] = true;
+            nulls[1] = true;
+        }
+        else
+        {
+            values[0] = ObjectIdGetDatum(entry->role_oid);
+            values[1] = ObjectIdGetDatum(entry->database_oid);
+        }
+
+        values[2] = Int64GetDatum(qos_usage_take(&usage->statements, reset));
+        values[3] = Int64GetDatum(qos_usage_take(&usage->exec_time_us, reset));
+        values[4] = Int64GetDatum(qos_usage_take(&usage->cpu_user_us, reset));
+        values[5] = Int64GetDatum(qos_usage_take(&usage->cpu_system_us, reset));
+        values[6] = Int64GetDatum(qos_usage_take(&usage->blks_hit, reset));
+        values[7] = Int64GetDatum(qos_usage_take(&usage->blks_read, reset));
+        values[8] = Int64GetDatum(qos_usage_take(&usage->wal_bytes, reset));
+        values[9] = Int64GetDatum(qos_usage_take(&usage->temp_bytes, reset));
+
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    LWLockRelease(qos_shared_state->lock);
+
+    return (Datum) 0;
+}
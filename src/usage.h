@@ -0,0 +1,31 @@
+/*
+ * usage.h - PostgreSQL Quality of Service (QoS) Extension Usage Accounting
+ *
+ * This header file contains the declarations for per-tenant resource usage
+ * accounting (CPU, buffers, WAL, temp files, executor time).
+ *
+ * Author:  M.Atif Ceylan
+ * Company: AppstoniA OÜ
+ * Created: October 17, 2026
+ * Version: 1.1
+ * License: See LICENSE file in the project root
+ *
+ * Copyright (c) 2025 AppstoniA OÜ
+ * All rights reserved.
+ */
+
+#ifndef QOS_USAGE_H
+#define QOS_USAGE_H
+
+#include "postgres.h"
+#include "executor/instrument.h"
+#include "utils/pg_rusage.h"
+#include "qos.h"
+
+/* Add the CPU time used since start to the current tenant */
+extern void qos_usage_record_cpu(const PGRUsage *start);
+
+/* Add a finished top-level executor run (after InstrEndLoop) */
+extern void qos_usage_record_executor(const Instrumentation *totaltime);
+
+#endif /* QOS_USAGE_H */
@@ -0,0 +1,193 @@
+#
+# 001_backend_slots.pl - backend_status[] slots across connection churn
+#
+# Cycles thousands of connections through statement and transaction
+# admission, then checks that no slot is left behind by disconnected,
+# failed, terminated or SIGKILLed backends and that limits still apply.
+#
+# Author:  M.Atif Ceylan
+# Company: AppstoniA OÜ
+# Created: October 17, 2026
+# Version: 1.1
+# License: See LICENSE file in the project root
+#
+# Copyright (c) 2025 AppstoniA OÜ
+# All rights reserved.
+#
+
+use strict;
+use warnings FATAL => 'all';
+
+use IPC::Run;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Connections opened by the churn phase (QOS_TAP_CONNECTIONS overrides)
+my $clients = 10;
+my $transactions = int(($ENV{QOS_TAP_CONNECTIONS} // 3000) / $clients);
+my $connections = $clients * $transactions;
+
+my $node = PostgreSQL::Test::Cluster->new('qos');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', q{
+shared_preload_libraries = 'qos'
+max_connections = 40
+});
+$node->start;
+
+$node->safe_psql(
+	'postgres', q{
+CREATE EXTENSION qos;
+CREATE ROLE qos_tap LOGIN;
+ALTER ROLE qos_tap SET qos.max_concurrent_select = '100';
+ALTER ROLE qos_tap SET qos.max_concurrent_tx = '100';
+});
+
+# Slots whose backend is gone
+my $stale_sql = q{
+SELECT count(*) FROM qos_get_activity() a
+WHERE NOT EXISTS (SELECT 1 FROM pg_stat_activity s WHERE s.pid = a.pid)};
+
+# Statement or transaction slots held by qos_tap
+my $held_sql = q{
+SELECT count(*) FROM qos_activity
+WHERE rolname = 'qos_tap' AND (command IS NOT NULL OR in_transaction)};
+
+sub check_no_leak
+{
+	my ($what) = @_;
+
+	ok($node->poll_query_until('postgres', $stale_sql, '0'),
+		"$what: no slot of an exited backend");
+	is($node->safe_psql('postgres', $held_sql), '0',
+		"$what: no statement or transaction slot held");
+}
+
+sub qos_tap_psql
+{
+	my ($sql) = @_;
+
+	return $node->psql('postgres', $sql, extra_params => [ '-U', 'qos_tap' ]);
+}
+
+# Start a psql session, as the bootstrap superuser unless a user is given;
+# the caller feeds it through the returned stdin ref
+sub start_session
+{
+	my ($user) = @_;
+	my ($stdin, $stdout, $stderr) = ('', '', '');
+	my @cmd = ('psql', '-XAtq', '-d', $node->connstr('postgres'), '-f', '-');
+
+	push @cmd, ('-U', $user) if defined $user;
+	my $h = IPC::Run::start(\@cmd, '<', \$stdin, '>', \$stdout, '2>', \$stderr);
+
+	return ($h, \$stdin);
+}
+
+# A superuser session holding advisory lock 1
+sub start_lock_holder
+{
+	my ($h, $stdin) = start_session();
+
+	$$stdin .= "SELECT pg_advisory_lock(1);\n";
+	$h->pump_nb;
+	$node->poll_query_until('postgres',
+		q{SELECT count(*) FROM pg_locks WHERE locktype = 'advisory' AND granted},
+		'1')
+	  or die "advisory lock not taken";
+
+	return ($h, $stdin);
+}
+
+# A qos_tap session inside a SELECT waiting for advisory lock 1, which
+# holds its statement slot until the lock is released; also returns the
+# backend's pid
+sub start_blocked_select
+{
+	my ($h, $stdin) = start_session('qos_tap');
+
+	$$stdin .= "SELECT pg_advisory_lock_shared(1);\n";
+	$h->pump_nb;
+	$node->poll_query_until('postgres',
+		q{SELECT count(*) FROM pg_locks WHERE locktype = 'advisory' AND NOT granted},
+		'1')
+	  or die "SELECT did not block on the advisory lock";
+
+	return ($h, $stdin,
+		$node->safe_psql('postgres',
+			q{SELECT pid FROM pg_stat_activity WHERE usename = 'qos_tap' AND wait_event_type = 'Lock'}
+		));
+}
+
+sub end_session
+{
+	my ($h, $stdin) = @_;
+
+	$$stdin .= "\\q\n";
+	eval { $h->finish; };
+	$h->kill_kill if $@;
+}
+
+# Connection churn: every pgbench transaction opens a new connection
+$node->pgbench(
+	"--no-vacuum --connect --client=$clients --transactions=$transactions --username=qos_tap postgres",
+	0,
+	[qr{processed: $connections/$connections}],
+	[qr{^$}],
+	"$connections connections through statement and transaction admission",
+	{
+		'001_qos_select' => q{SELECT 1;},
+		'002_qos_transaction' => q{
+BEGIN;
+SELECT 1;
+SELECT 2;
+COMMIT;
+}
+	});
+check_no_leak('connection churn');
+
+# Failed statements and aborted transaction blocks
+qos_tap_psql(join('', map { "SELECT 1 / 0;\nBEGIN;\nSELECT 1;\nSELECT 1 / 0;\nROLLBACK;\n" } 1 .. 200));
+check_no_leak('aborts');
+
+# From here on one SELECT at a time
+$node->safe_psql('postgres',
+	q{ALTER ROLE qos_tap SET qos.max_concurrent_select = '1'});
+
+my ($holder, $holder_stdin) = start_lock_holder();
+my ($blocked, $blocked_stdin, $blocked_pid) = start_blocked_select();
+
+my ($ret, $stdout, $stderr) = qos_tap_psql('SELECT 1');
+like($stderr, qr/maximum concurrent SELECT statements exceeded/,
+	'limit applies after connection churn');
+
+# pg_terminate_backend: the slot is freed by the exit callback
+$node->safe_psql('postgres', "SELECT pg_terminate_backend($blocked_pid)");
+end_session($blocked, $blocked_stdin);
+check_no_leak('terminated backend');
+($ret, $stdout, $stderr) = qos_tap_psql('SELECT 1');
+is($ret, 0, 'slot of terminated backend is reused');
+
+# SIGKILL: no exit callback runs, the postmaster reinitializes shared memory
+($blocked, $blocked_stdin, $blocked_pid) = start_blocked_select();
+kill 'KILL', $blocked_pid;
+end_session($blocked, $blocked_stdin);
+end_session($holder, $holder_stdin);
+$node->poll_query_until('postgres', 'SELECT 1', '1')
+  or die "server did not restart after SIGKILL";
+check_no_leak('SIGKILLed backend');
+
+($holder, $holder_stdin) = start_lock_holder();
+($blocked, $blocked_stdin, $blocked_pid) = start_blocked_select();
+($ret, $stdout, $stderr) = qos_tap_psql('SELECT 1');
+like($stderr, qr/maximum concurrent SELECT statements exceeded/,
+	'limit applies after crash restart');
+end_session($holder, $holder_stdin);
+end_session($blocked, $blocked_stdin);
+check_no_leak('after crash restart');
+
+$node->stop;
+
+done_testing();